@@ -0,0 +1,204 @@
+#include <benchmark/benchmark.h>
+
+#include <movemm/memory-allocator.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A replay of a game frame: a set of workers allocate a mix of per-frame
+// memory, objects with destructors and short-lived temporaries from the
+// general allocator, and the frame's tag is freed once they are all done.
+namespace
+{
+    // Persistent workers that run one job each per frame, so the benchmark
+    // doesn't time thread creation
+    class frame_workers
+    {
+    public:
+        inline explicit frame_workers(size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                _threads.emplace_back(
+                    [this, i]
+                    {
+                        work(i);
+                    });
+            }
+        }
+
+        inline ~frame_workers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            for (auto& thread : _threads)
+            {
+                thread.join();
+            }
+        }
+
+        // Runs job(worker) on every worker and waits for all of them
+        inline void run(const std::function<void(size_t)>& job)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _job = &job;
+            _pending = _threads.size();
+            ++_frame;
+            _wake.notify_all();
+            _done.wait(lock,
+                [this]
+                {
+                    return _pending == 0;
+                });
+        }
+
+    private:
+        inline void work(size_t index)
+        {
+            uint64_t frame = 0;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _wake.wait(lock,
+                    [&]
+                    {
+                        return _stopping || _frame != frame;
+                    });
+                if (_stopping) return;
+
+                frame = _frame;
+                auto job = _job;
+                lock.unlock();
+                (*job)(index);
+                lock.lock();
+
+                if (--_pending == 0)
+                {
+                    _done.notify_one();
+                }
+            }
+        }
+
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        const std::function<void(size_t)>* _job = nullptr;
+        size_t _pending = 0;
+        uint64_t _frame = 0;
+        bool _stopping = false;
+    };
+
+    struct frame_object
+    {
+        inline explicit frame_object(uint64_t id) : id(id)
+        {
+        }
+
+        inline ~frame_object()
+        {
+            benchmark::DoNotOptimize(id);
+        }
+
+        uint64_t id;
+        float transform[12];
+    };
+
+    constexpr size_t allocations_per_worker = 2048;
+
+    // Sizes from 16 to 512 bytes, picked by a cheap hash so every frame
+    // sees the same sequence
+    inline size_t allocation_size(size_t i)
+    {
+        auto hash = uint32_t(i) * 2654435761u;
+        return size_t(16) << ((hash >> 16) % 6);
+    }
+
+    void frame_job(movemm_heap_tag_t tag, uint64_t frame)
+    {
+        void* temporaries[allocations_per_worker / 4];
+        size_t temporaryCount = 0;
+        for (size_t i = 0; i < allocations_per_worker; ++i)
+        {
+            switch (i % 8)
+            {
+            case 0:
+                benchmark::DoNotOptimize(
+                    movemm::tagged_new<frame_object>(tag, frame));
+                break;
+            case 1:
+            case 5:
+                temporaries[temporaryCount++] =
+                    movemm_alloc(allocation_size(i));
+                break;
+            default:
+                benchmark::DoNotOptimize(
+                    movemm_tagged_heap_alloc(tag, allocation_size(i)));
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < temporaryCount; ++i)
+        {
+            movemm_free(temporaries[i]);
+        }
+    }
+
+    void frame_replay(benchmark::State& state)
+    {
+        frame_workers workers(size_t(state.range(0)));
+        movemm_heap_tag_t tag = {2000};
+        uint64_t frame = 0;
+        std::function<void(size_t)> job = [&](size_t)
+        {
+            frame_job(tag, frame);
+        };
+
+        for (auto _ : state)
+        {
+            workers.run(job);
+            movemm_tagged_heap_free(tag);
+            ++frame;
+        }
+        state.SetItemsProcessed(
+            state.iterations() * state.range(0) * allocations_per_worker);
+        state.counters["frames"] = benchmark::Counter(
+            double(state.iterations()), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(frame_replay)->DenseRange(1, 8)->UseRealTime();
+
+    // The same frame using ring tags, which free without visiting the
+    // workers' pages.  Frames carry on from the last run, since ring tags
+    // must be freed in frame order.
+    void frame_replay_ring(benchmark::State& state)
+    {
+        static uint64_t nextFrame = 0;
+
+        frame_workers workers(size_t(state.range(0)));
+        uint64_t frame = nextFrame;
+        std::function<void(size_t)> job = [&](size_t)
+        {
+            frame_job(movemm_tagged_heap_ring_tag(frame), frame);
+        };
+
+        for (auto _ : state)
+        {
+            workers.run(job);
+            movemm_tagged_heap_free(movemm_tagged_heap_ring_tag(frame));
+            ++frame;
+        }
+        nextFrame = frame;
+        state.SetItemsProcessed(
+            state.iterations() * state.range(0) * allocations_per_worker);
+        state.counters["frames"] = benchmark::Counter(
+            double(state.iterations()), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(frame_replay_ring)->DenseRange(1, 8)->UseRealTime();
+}  // namespace
@@ -0,0 +1,158 @@
+#include <benchmark/benchmark.h>
+
+#include <movemm/memory-allocator.h>
+
+#include <cstdlib>
+
+namespace
+{
+    // Allocation sizes from a small object up to a page
+    void allocation_sizes(benchmark::internal::Benchmark* benchmark)
+    {
+        benchmark->RangeMultiplier(4)->Range(16, 4096);
+    }
+
+    void malloc_free(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            auto ptr = std::malloc(bytes);
+            benchmark::DoNotOptimize(ptr);
+            std::free(ptr);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(malloc_free)->Apply(allocation_sizes);
+
+    void movemm_alloc_free(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            auto ptr = movemm_alloc(bytes);
+            benchmark::DoNotOptimize(ptr);
+            movemm_free(ptr);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(movemm_alloc_free)->Apply(allocation_sizes);
+
+    void movemm_alloc_free_sized(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            auto ptr = movemm_alloc(bytes);
+            benchmark::DoNotOptimize(ptr);
+            movemm_free_sized(ptr, bytes);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(movemm_alloc_free_sized)->Apply(allocation_sizes);
+
+    // Many live allocations at once, so the allocator can't keep handing
+    // back the block that was just freed
+    void malloc_free_many(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        constexpr size_t count = 1024;
+        void* ptrs[count];
+        for (auto _ : state)
+        {
+            for (auto& ptr : ptrs)
+            {
+                ptr = std::malloc(bytes);
+            }
+            benchmark::DoNotOptimize(ptrs);
+            for (auto ptr : ptrs)
+            {
+                std::free(ptr);
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(malloc_free_many)->Apply(allocation_sizes);
+
+    void movemm_alloc_free_many(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        constexpr size_t count = 1024;
+        void* ptrs[count];
+        for (auto _ : state)
+        {
+            for (auto& ptr : ptrs)
+            {
+                ptr = movemm_alloc(bytes);
+            }
+            benchmark::DoNotOptimize(ptrs);
+            for (auto ptr : ptrs)
+            {
+                movemm_free(ptr);
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(movemm_alloc_free_many)->Apply(allocation_sizes);
+
+    void movemm_alloc_free_batch(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        constexpr size_t count = 1024;
+        void* ptrs[count];
+        for (auto _ : state)
+        {
+            movemm_alloc_batch(bytes, count, ptrs);
+            benchmark::DoNotOptimize(ptrs);
+            movemm_free_batch(ptrs, count);
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(movemm_alloc_free_batch)->Apply(allocation_sizes);
+
+    void aligned_alloc_free(benchmark::State& state)
+    {
+        auto alignment = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            auto ptr = movemm_aligned_alloc(64, alignment);
+            benchmark::DoNotOptimize(ptr);
+            movemm_aligned_free(ptr, alignment);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(aligned_alloc_free)->RangeMultiplier(4)->Range(16, 4096);
+
+    void heap_alloc_free(benchmark::State& state)
+    {
+        auto heap = movemm_create_heap();
+        auto bytes = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            auto ptr = movemm_heap_alloc(heap, bytes);
+            benchmark::DoNotOptimize(ptr);
+            movemm_heap_free(heap, ptr);
+        }
+        state.SetItemsProcessed(state.iterations());
+        movemm_destroy_heap(heap);
+    }
+    BENCHMARK(heap_alloc_free)->Apply(allocation_sizes);
+
+    // Heaps are usually thrown away whole rather than freed block by block
+    void heap_alloc_destroy(benchmark::State& state)
+    {
+        auto bytes = size_t(state.range(0));
+        constexpr size_t count = 1024;
+        for (auto _ : state)
+        {
+            auto heap = movemm_create_heap();
+            for (size_t i = 0; i < count; ++i)
+            {
+                benchmark::DoNotOptimize(movemm_heap_alloc(heap, bytes));
+            }
+            movemm_destroy_heap(heap);
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(heap_alloc_destroy)->Apply(allocation_sizes);
+}  // namespace
@@ -0,0 +1,152 @@
+#include <benchmark/benchmark.h>
+
+#include <movemm/object_pool.hpp>
+#include <movemm/ptr_types.hpp>
+
+#include <cstdint>
+#include <utility>
+
+namespace
+{
+    struct counted_object : movemm::ref_counted<counted_object>
+    {
+        uint64_t value = 0;
+    };
+
+    template <typename Refcount>
+    inline movemm::shared_ptr<uint64_t, Refcount> make_value()
+    {
+        movemm::shared_ptr<uint64_t, Refcount> ptr;
+        ptr.create(1);
+        return ptr;
+    }
+
+    void unique_ptr_create_destroy(benchmark::State& state)
+    {
+        for (auto _ : state)
+        {
+            auto ptr = movemm::make_unique<uint64_t>(1);
+            benchmark::DoNotOptimize(ptr.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(unique_ptr_create_destroy);
+
+    void unique_ptr_move(benchmark::State& state)
+    {
+        auto ptr = movemm::make_unique<uint64_t>(1);
+        for (auto _ : state)
+        {
+            auto moved = std::move(ptr);
+            benchmark::DoNotOptimize(moved.get());
+            ptr = std::move(moved);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(unique_ptr_move);
+
+    void pooled_unique_ptr_create_destroy(benchmark::State& state)
+    {
+        movemm::object_pool<uint64_t> pool;
+        for (auto _ : state)
+        {
+            auto ptr = movemm::make_unique(pool, uint64_t(1));
+            benchmark::DoNotOptimize(ptr.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(pooled_unique_ptr_create_destroy);
+
+    template <typename Refcount>
+    void shared_ptr_create_destroy(benchmark::State& state)
+    {
+        for (auto _ : state)
+        {
+            auto ptr = make_value<Refcount>();
+            benchmark::DoNotOptimize(ptr.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_TEMPLATE(shared_ptr_create_destroy, movemm::atomic_refcount);
+    BENCHMARK_TEMPLATE(shared_ptr_create_destroy, movemm::local_refcount);
+
+    template <typename Refcount>
+    void shared_ptr_copy(benchmark::State& state)
+    {
+        auto ptr = make_value<Refcount>();
+        for (auto _ : state)
+        {
+            auto copy = ptr;
+            benchmark::DoNotOptimize(copy.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_TEMPLATE(shared_ptr_copy, movemm::atomic_refcount);
+    BENCHMARK_TEMPLATE(shared_ptr_copy, movemm::local_refcount);
+
+    // Every thread copies the same pointer, so the count's cache line
+    // bounces between them
+    void shared_ptr_copy_contended(benchmark::State& state)
+    {
+        // Threads meet at the start and end of the loop, so thread 0 can set
+        // the pointer up and tear it down on its own
+        static movemm::shared_ptr<uint64_t> shared;
+        if (state.thread_index() == 0)
+        {
+            shared = movemm::make_shared<uint64_t>(1);
+        }
+
+        for (auto _ : state)
+        {
+            auto copy = shared;
+            benchmark::DoNotOptimize(copy.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+
+        if (state.thread_index() == 0)
+        {
+            shared.destroy();
+        }
+    }
+    BENCHMARK(shared_ptr_copy_contended)->ThreadRange(1, 8)->UseRealTime();
+
+    template <typename Refcount>
+    void shared_ptr_move(benchmark::State& state)
+    {
+        auto ptr = make_value<Refcount>();
+        for (auto _ : state)
+        {
+            auto moved = std::move(ptr);
+            benchmark::DoNotOptimize(moved.get());
+            ptr = std::move(moved);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_TEMPLATE(shared_ptr_move, movemm::atomic_refcount);
+    BENCHMARK_TEMPLATE(shared_ptr_move, movemm::local_refcount);
+
+    void weak_ptr_lock(benchmark::State& state)
+    {
+        auto ptr = movemm::make_shared<uint64_t>(1);
+        movemm::weak_ptr<uint64_t> weak = ptr;
+        for (auto _ : state)
+        {
+            auto locked = weak.lock();
+            benchmark::DoNotOptimize(locked.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(weak_ptr_lock);
+
+    void intrusive_ptr_copy(benchmark::State& state)
+    {
+        auto ptr = movemm::make_intrusive<counted_object>();
+        for (auto _ : state)
+        {
+            auto copy = ptr;
+            benchmark::DoNotOptimize(copy.get());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(intrusive_ptr_copy);
+}  // namespace
@@ -0,0 +1,169 @@
+#include <benchmark/benchmark.h>
+
+#include <movemm/memory-allocator.h>
+
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    constexpr uint64_t first_thread_tag = 1000;
+
+    // Tags are freed every so often to keep the benchmark's footprint flat.
+    // The free is timed along with the allocations it releases, as it would
+    // be in a frame.
+    constexpr size_t allocations_per_free = 4096;
+
+    // Each thread allocates from a tag of its own, so threads only meet
+    // when they go to the shared page pool for a new page
+    void tagged_alloc(benchmark::State& state)
+    {
+        movemm_heap_tag_t tag = {first_thread_tag + state.thread_index()};
+        auto bytes = size_t(state.range(0));
+        size_t allocations = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(movemm_tagged_heap_alloc(tag, bytes));
+            if (++allocations == allocations_per_free)
+            {
+                movemm_tagged_heap_free(tag);
+                allocations = 0;
+            }
+        }
+        movemm_tagged_heap_free(tag);
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(tagged_alloc)
+        ->Arg(16)
+        ->Arg(256)
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+    // Every allocation switches between two tags, so each one goes through
+    // the thread's tag cache rather than repeating the last lookup
+    void tagged_alloc_alternating_tags(benchmark::State& state)
+    {
+        movemm_heap_tag_t tags[] = {
+            {first_thread_tag}, {first_thread_tag + 1}};
+        size_t allocations = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(
+                movemm_tagged_heap_alloc(tags[allocations & 1], 16));
+            if (++allocations == allocations_per_free)
+            {
+                movemm_tagged_heap_free(tags[0]);
+                movemm_tagged_heap_free(tags[1]);
+                allocations = 0;
+            }
+        }
+        movemm_tagged_heap_free(tags[0]);
+        movemm_tagged_heap_free(tags[1]);
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(tagged_alloc_alternating_tags);
+
+    // An uncontended lock, as a reference for what the tagged heap's
+    // lock-free fast path saves
+    void mutex_lock_unlock(benchmark::State& state)
+    {
+        std::mutex mutex;
+        for (auto _ : state)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+    }
+    BENCHMARK(mutex_lock_unlock);
+
+    void tagged_aligned_alloc(benchmark::State& state)
+    {
+        movemm_heap_tag_t tag = {first_thread_tag + state.thread_index()};
+        auto alignment = size_t(state.range(0));
+        size_t allocations = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(
+                movemm_tagged_heap_aligned_alloc(tag, 64, alignment));
+            if (++allocations == allocations_per_free)
+            {
+                movemm_tagged_heap_free(tag);
+                allocations = 0;
+            }
+        }
+        movemm_tagged_heap_free(tag);
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(tagged_aligned_alloc)->Arg(64)->Arg(256);
+
+    struct trivial_object
+    {
+        uint64_t values[4];
+    };
+
+    struct destructed_object
+    {
+        inline ~destructed_object()
+        {
+            benchmark::DoNotOptimize(values);
+        }
+
+        uint64_t values[4];
+    };
+
+    template <typename T>
+    void tagged_new_free(benchmark::State& state)
+    {
+        movemm_heap_tag_t tag = {first_thread_tag};
+        auto count = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                benchmark::DoNotOptimize(movemm::tagged_new<T>(tag));
+            }
+            movemm_tagged_heap_free(tag);
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK_TEMPLATE(tagged_new_free, trivial_object)->Arg(1024);
+    BENCHMARK_TEMPLATE(tagged_new_free, destructed_object)->Arg(1024);
+
+    void tagged_new_unowned_free(benchmark::State& state)
+    {
+        movemm_heap_tag_t tag = {first_thread_tag};
+        auto count = size_t(state.range(0));
+        for (auto _ : state)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                benchmark::DoNotOptimize(
+                    movemm::tagged_new_unowned<destructed_object>(tag));
+            }
+            movemm_tagged_heap_free(tag);
+        }
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(tagged_new_unowned_free)->Arg(1024);
+
+    void tagged_alloc_batch(benchmark::State& state)
+    {
+        movemm_heap_tag_t tag = {first_thread_tag};
+        constexpr size_t count = 256;
+        void* ptrs[count];
+        size_t allocations = 0;
+        for (auto _ : state)
+        {
+            movemm_tagged_heap_alloc_batch(tag, 16, count, ptrs);
+            benchmark::DoNotOptimize(ptrs);
+            if ((allocations += count) >= allocations_per_free)
+            {
+                movemm_tagged_heap_free(tag);
+                allocations = 0;
+            }
+        }
+        movemm_tagged_heap_free(tag);
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+    BENCHMARK(tagged_alloc_batch);
+}  // namespace
@@ -0,0 +1,179 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+#include "memory-allocator.h"
+
+// Replaces every global operator new and delete, including the sized, aligned
+// and nothrow forms, with movemm's allocation functions.  The definitions
+// below must be compiled into exactly one source file of each executable, or
+// of each DLL on Windows, where modules don't share their replacements.  The
+// MOVE_MEMORY_MANAGER_GLOBAL_NEW_DELETE CMake option does this for every
+// target that links move-mm, which also works when move-mm is a shared
+// library.
+//
+// Like the standard operators, a failed allocation calls the installed
+// new_handler and tries again, and throws std::bad_alloc if there is none.
+namespace movemm
+{
+    namespace detail
+    {
+        inline void* global_new(std::size_t bytes)
+        {
+            for (;;)
+            {
+                if (auto res = movemm_alloc(bytes)) return res;
+
+                auto handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+
+        inline void* global_new(std::size_t bytes, std::align_val_t alignment)
+        {
+            for (;;)
+            {
+                if (auto res = movemm_aligned_alloc(bytes, size_t(alignment)))
+                {
+                    return res;
+                }
+
+                auto handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+
+        inline void* global_new_nothrow(std::size_t bytes) noexcept
+        {
+            try
+            {
+                return global_new(bytes);
+            }
+            catch (...)
+            {
+                return nullptr;
+            }
+        }
+
+        inline void* global_new_nothrow(
+            std::size_t bytes, std::align_val_t alignment) noexcept
+        {
+            try
+            {
+                return global_new(bytes, alignment);
+            }
+            catch (...)
+            {
+                return nullptr;
+            }
+        }
+    }  // namespace detail
+}  // namespace movemm
+
+void* operator new(std::size_t bytes)
+{
+    return movemm::detail::global_new(bytes);
+}
+
+void* operator new[](std::size_t bytes)
+{
+    return movemm::detail::global_new(bytes);
+}
+
+void* operator new(std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return movemm::detail::global_new_nothrow(bytes);
+}
+
+void* operator new[](std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return movemm::detail::global_new_nothrow(bytes);
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment)
+{
+    return movemm::detail::global_new(bytes, alignment);
+}
+
+void* operator new[](std::size_t bytes, std::align_val_t alignment)
+{
+    return movemm::detail::global_new(bytes, alignment);
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept
+{
+    return movemm::detail::global_new_nothrow(bytes, alignment);
+}
+
+void* operator new[](std::size_t bytes, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept
+{
+    return movemm::detail::global_new_nothrow(bytes, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    movemm_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    movemm_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    movemm_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    movemm_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t bytes) noexcept
+{
+    movemm_free_sized(ptr, bytes);
+}
+
+void operator delete[](void* ptr, std::size_t bytes) noexcept
+{
+    movemm_free_sized(ptr, bytes);
+}
+
+void operator delete(void* ptr, std::align_val_t alignment) noexcept
+{
+    movemm_aligned_free(ptr, size_t(alignment));
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept
+{
+    movemm_aligned_free(ptr, size_t(alignment));
+}
+
+void operator delete(
+    void* ptr, std::size_t bytes, std::align_val_t alignment) noexcept
+{
+    movemm_aligned_free_sized(ptr, bytes, size_t(alignment));
+}
+
+void operator delete[](
+    void* ptr, std::size_t bytes, std::align_val_t alignment) noexcept
+{
+    movemm_aligned_free_sized(ptr, bytes, size_t(alignment));
+}
+
+void operator delete(
+    void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    movemm_aligned_free(ptr, size_t(alignment));
+}
+
+void operator delete[](
+    void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    movemm_aligned_free(ptr, size_t(alignment));
+}
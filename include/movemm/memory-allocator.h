@@ -9,18 +9,93 @@ MOVEMM_EXPORT void* movemm_alloc(size_t bytes);
 MOVEMM_EXPORT void* movemm_realloc(void* memory, size_t bytes);
 MOVEMM_EXPORT void movemm_free(void* ptr);
 
+// Frees memory whose size is known, which saves mimalloc looking it up.  The
+// size must be the one the memory was allocated with.
+MOVEMM_EXPORT void movemm_free_sized(void* ptr, size_t bytes);
+
 MOVEMM_EXPORT void* movemm_aligned_alloc(size_t bytes, size_t alignment);
 MOVEMM_EXPORT void* movemm_aligned_realloc(
     void* memory, size_t bytes, size_t alignment);
 MOVEMM_EXPORT void movemm_aligned_free(void* ptr, size_t alignment);
+MOVEMM_EXPORT void movemm_aligned_free_sized(
+    void* ptr, size_t bytes, size_t alignment);
+
+// Batched allocation.  Allocates count blocks of the same size into ptrs and
+// returns how many succeeded, stopping at the first failure.  Freeing takes
+// any movemm allocations, skipping nulls.  Thread lookups, budget checks and
+// charges, profiler sampling, trace events and, in tracking builds, table
+// locks are paid once per batch rather than once per pointer, so a batch that
+// would go over its budget category's hard limit allocates nothing.
+MOVEMM_EXPORT size_t movemm_alloc_batch(
+    size_t bytes, size_t count, void** ptrs);
+MOVEMM_EXPORT void movemm_free_batch(void** ptrs, size_t count);
+
+// Allocation tracking.  When built with MOVEMM_TRACKING_MODE every allocation
+// made through the functions above is recorded, and freeing anything that
+// isn't, or with the wrong size or alignment, throws before the memory is
+// touched.
+// Without it lookups fail and visits see nothing.
+typedef struct
+{
+    void* ptr;
+    size_t size;
+
+    // 0 for allocations made without an explicit alignment
+    size_t alignment;
+
+    // Return address of the call into movemm
+    void* callsite;
+
+    // Small sequential id of the allocating thread, starting at 1
+    uint32_t thread;
+} movemm_tracked_allocation_t;
+
+MOVEMM_EXPORT int movemm_get_tracked_allocation(
+    void* ptr, movemm_tracked_allocation_t* allocation);
+
+// Visits a snapshot of every tracked allocation and returns how many there
+// were.  The visitor runs without any tracking locks held, so it may allocate.
+typedef void (*movemm_tracked_allocation_cb_t)(
+    const movemm_tracked_allocation_t* allocation, void* user_data);
+MOVEMM_EXPORT size_t movemm_visit_tracked_allocations(
+    movemm_tracked_allocation_cb_t visitor, void* user_data);
 
-// Separate heaps.  These can only be freed in their entirety - not individual
-// allocations.
+// Size of the block behind any allocation made through movemm, which may be
+// larger than was asked for
+MOVEMM_EXPORT size_t movemm_usable_size(void* ptr);
+
+// Separate heaps.  A heap may only be allocated from on the thread that
+// created it, but its memory can be freed from any thread, either one
+// allocation at a time or all at once by destroying the heap.
 typedef void* movemm_heap_t;
 MOVEMM_EXPORT movemm_heap_t movemm_create_heap();
 MOVEMM_EXPORT void movemm_destroy_heap(movemm_heap_t);
 
 MOVEMM_EXPORT void* movemm_heap_alloc(movemm_heap_t heap, size_t bytes);
+MOVEMM_EXPORT void* movemm_heap_calloc(
+    movemm_heap_t heap, size_t count, size_t bytes);
+MOVEMM_EXPORT void* movemm_heap_realloc(
+    movemm_heap_t heap, void* memory, size_t bytes);
+
+// Frees allocations made with any of the heap's allocation functions,
+// aligned or not
+MOVEMM_EXPORT void movemm_heap_free(movemm_heap_t heap, void* ptr);
+
+MOVEMM_EXPORT void* movemm_heap_aligned_alloc(
+    movemm_heap_t heap, size_t bytes, size_t alignment);
+MOVEMM_EXPORT void* movemm_heap_aligned_realloc(
+    movemm_heap_t heap, void* memory, size_t bytes, size_t alignment);
+
+// Returns unused memory held by the heap to the OS.  Forcing it also frees
+// memory that is cached for reuse.
+MOVEMM_EXPORT void movemm_heap_collect(movemm_heap_t heap, int force);
+
+// Calls the visitor for every live allocation in the heap until it returns
+// 0.  Returns 0 if the visit was stopped early.  Must be called on the thread
+// that owns the heap.
+typedef int (*movemm_heap_visit_cb_t)(void* ptr, size_t bytes, void* user_data);
+MOVEMM_EXPORT int movemm_heap_visit_blocks(
+    movemm_heap_t heap, movemm_heap_visit_cb_t visitor, void* user_data);
 
 // Temporary allocations
 typedef struct
@@ -28,20 +103,326 @@ typedef struct
     uint64_t tag;
 } movemm_heap_tag_t;
 
+// Tagged heap memory is handed out from pages of this size.  Allocations that
+// don't fit in a single page are given a dedicated page rounded up to a
+// multiple of it.
+#define MOVEMM_TAGGED_HEAP_PAGE_SIZE (2 * 1024 * 1024)
+
+// Alignment of every movemm_tagged_heap_alloc result
+#define MOVEMM_TAGGED_HEAP_DEFAULT_ALIGNMENT 16
+
 MOVEMM_EXPORT void* movemm_tagged_heap_alloc(
     movemm_heap_tag_t tag, size_t bytes);
 
+// Alignment must be a power of two.  Returns null otherwise.
+MOVEMM_EXPORT void* movemm_tagged_heap_aligned_alloc(
+    movemm_heap_tag_t tag, size_t bytes, size_t alignment);
+
+// Allocates count blocks of the same size from the tag into ptrs and returns
+// how many were allocated.  The tag is looked up and the statistics updated
+// once for the whole batch.
+MOVEMM_EXPORT size_t movemm_tagged_heap_alloc_batch(
+    movemm_heap_tag_t tag, size_t bytes, size_t count, void** ptrs);
+
+// Alignment must be a power of two.  Nothing is allocated otherwise.
+MOVEMM_EXPORT size_t movemm_tagged_heap_aligned_alloc_batch(
+    movemm_heap_tag_t tag, size_t bytes, size_t alignment, size_t count,
+    void** ptrs);
+
+// Resizes an allocation made from the tag on the calling thread.  The most
+// recent allocation on the thread's current page for the tag grows or shrinks
+// in place.  Anything else is copied into a new allocation when it grows, and
+// left where it is when it shrinks; the old memory is released with the tag.
+// A null ptr behaves like a fresh allocation.
+MOVEMM_EXPORT void* movemm_tagged_heap_realloc(
+    movemm_heap_tag_t tag, void* ptr, size_t old_bytes, size_t new_bytes);
+
+// Alignment is the one the allocation was made with, and must be a power of
+// two.  Returns null otherwise.
+MOVEMM_EXPORT void* movemm_tagged_heap_aligned_realloc(movemm_heap_tag_t tag,
+    void* ptr, size_t old_bytes, size_t new_bytes, size_t alignment);
+
 typedef void (*movemm_destructor_cb_t)(void*);
 MOVEMM_EXPORT void movemm_register_tagged_heap_destructor(
     movemm_heap_tag_t tag, void* ptr, movemm_destructor_cb_t destructor);
 
 MOVEMM_EXPORT void movemm_tagged_heap_free(movemm_heap_tag_t tag);
 
+// Markers roll a tag back to an earlier point without freeing it.  Rewinding
+// runs the destructors registered after the marker in reverse order and makes
+// the memory allocated after it available again.  Markers are per thread:
+// they only cover allocations made on the thread that took them, and must be
+// rewound on that thread.  Rewinding is a no-op if the tag has since been
+// freed or already rewound past the marker.
+typedef struct
+{
+    uint64_t storage;
+    size_t page;
+    size_t offset;
+    size_t destructors;
+} movemm_tagged_heap_marker_t;
+
+MOVEMM_EXPORT movemm_tagged_heap_marker_t movemm_tagged_heap_get_marker(
+    movemm_heap_tag_t tag);
+MOVEMM_EXPORT void movemm_tagged_heap_rewind(
+    movemm_heap_tag_t tag, movemm_tagged_heap_marker_t marker);
+
+// Destructors are recorded per thread and run in reverse registration order
+// within each thread.  movemm_tagged_heap_free runs every thread's list on the
+// calling thread; movemm_tagged_heap_free_parallel instead hands them to a
+// caller supplied dispatcher, one job per thread that registered destructors.
+// The dispatcher must call job(job_data, i) for every i in [0, count), on any
+// threads it likes, and only return once all of the jobs have completed.
+typedef void (*movemm_job_cb_t)(void* job_data, size_t index);
+typedef void (*movemm_dispatch_cb_t)(
+    void* user_data, movemm_job_cb_t job, void* job_data, size_t count);
+
+MOVEMM_EXPORT void movemm_tagged_heap_free_parallel(movemm_heap_tag_t tag,
+    movemm_dispatch_cb_t dispatch, void* user_data);
+
+// Frame ring tags.  For memory that is always released in frame order, ring
+// tags map frames onto a fixed number of in-flight slots.  Freeing a ring tag
+// is a single atomic operation that never visits other threads; each thread's
+// pages for the slot are rewound and reused the next time it allocates in
+// that slot.  Ring tags must be freed in frame order, and a frame can't be
+// allocated from until the frame `slots` before it has been freed.
+#define MOVEMM_TAGGED_HEAP_RING_TAG_BIT (1ull << 63)
+
+// Must be called before the first ring tag is used.  Defaults to 4 slots
+// starting at frame 0.  At most 16 slots are supported.
+MOVEMM_EXPORT void movemm_tagged_heap_configure_ring(
+    uint32_t slots, uint64_t first_frame);
+MOVEMM_EXPORT movemm_heap_tag_t movemm_tagged_heap_ring_tag(uint64_t frame);
+
 MOVEMM_EXPORT size_t movemm_tagged_heap_get_current_storage();
 
 MOVEMM_EXPORT size_t movemm_tagged_heap_get_current_tag_storage(
     movemm_heap_tag_t tag);
 
+// Pages released by movemm_tagged_heap_free are kept in a global pool and
+// reused by later tags.  The limit is the amount of idle page memory the pool
+// may hold; anything released beyond it goes back to the system allocator.
+MOVEMM_EXPORT void movemm_tagged_heap_set_page_pool_limit(size_t bytes);
+MOVEMM_EXPORT size_t movemm_tagged_heap_get_page_pool_limit();
+MOVEMM_EXPORT size_t movemm_tagged_heap_get_pooled_storage();
+MOVEMM_EXPORT void movemm_tagged_heap_release_pooled_pages();
+
+// Opt-in huge page backing for tagged heap pages.  When enabled, new pages are
+// mapped directly from the OS on a huge page boundary (MAP_HUGETLB, then
+// madvise(MADV_HUGEPAGE), or MEM_LARGE_PAGES on Windows) with their metadata
+// kept out of line.  If no huge pages are available pages silently fall back
+// to the regular heap.  Pages that already exist keep their backing.
+MOVEMM_EXPORT void movemm_tagged_heap_set_huge_pages_enabled(int enabled);
+MOVEMM_EXPORT int movemm_tagged_heap_get_huge_pages_enabled();
+
+// Number of live and pooled tagged heap pages by backing
+typedef struct
+{
+    size_t heap_pages;
+    size_t transparent_huge_pages;
+    size_t huge_pages;
+
+    // Pages that fell back to the heap while huge pages were enabled
+    size_t huge_page_fallbacks;
+} movemm_tagged_heap_backing_stats_t;
+
+MOVEMM_EXPORT void movemm_tagged_heap_get_backing_stats(
+    movemm_tagged_heap_backing_stats_t* stats);
+
+// Page usage, measured from each thread's pages when it is read
+typedef struct
+{
+    size_t pages;
+
+    // Bytes reserved by the pages, handed out from them, and lost at the end
+    // of pages that allocation has moved past
+    size_t bytes_reserved;
+    size_t bytes_used;
+    size_t bytes_wasted;
+} movemm_tagged_heap_tag_statistics_t;
+
+// The cumulative counters are kept in per-thread shards that only their own
+// thread writes, so keeping them costs the allocation path no more than a
+// plain increment.  Reading them takes the tagged heap locks.
+typedef struct
+{
+    size_t pages_live;
+    size_t pages_pooled;
+    size_t bytes_reserved;
+    size_t bytes_used;
+    size_t bytes_wasted;
+    size_t destructors_pending;
+
+    // Since startup
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    uint64_t destructors_registered;
+    uint64_t destructors_run;
+} movemm_tagged_heap_statistics_t;
+
+MOVEMM_EXPORT void movemm_tagged_heap_get_statistics(
+    movemm_tagged_heap_statistics_t* statistics);
+MOVEMM_EXPORT void movemm_tagged_heap_get_tag_statistics(
+    movemm_heap_tag_t tag, movemm_tagged_heap_tag_statistics_t* statistics);
+
+// Process wide statistics as reported by mimalloc, plus the tagged heap's
+typedef struct
+{
+    size_t committed;
+    size_t peak_committed;
+    size_t resident;
+    size_t peak_resident;
+    size_t page_faults;
+
+    movemm_tagged_heap_statistics_t tagged;
+} movemm_statistics_t;
+
+MOVEMM_EXPORT void movemm_get_statistics(movemm_statistics_t* statistics);
+
+// Sampling heap profiler.  Allocations through movemm_alloc,
+// movemm_aligned_alloc and the tagged heap allocation functions are sampled on
+// average once every `bytes` bytes, recording the backtrace of each sample.
+// Tagged heap samples only count towards allocated bytes, since their memory
+// is released by tag.  A period of 0 disables sampling, which is the default.
+MOVEMM_EXPORT void movemm_profile_set_sample_period(size_t bytes);
+MOVEMM_EXPORT size_t movemm_profile_get_sample_period();
+
+// Writes the live and cumulative samples gathered so far as a legacy pprof
+// heap profile (heap_v2), which can be read with `pprof <binary> <file>`.
+// Returns 0 if the file couldn't be written.
+MOVEMM_EXPORT int movemm_profile_dump(const char* path);
+
+// Allocation tracing.  While a trace is running, allocations, reallocations
+// and frees through the movemm_*, movemm_heap_* and tagged heap functions are
+// recorded with the thread that made them and a timestamp.  Events collect in
+// per-thread buffers and are copied to a ring file mapped at `path`, `bytes`
+// long, whenever a buffer fills, its thread exits or the trace is stopped.
+// The file layout is described in memory-trace.h, and can be replayed with
+// move-mm-replay.  Returns 0 if the file couldn't be mapped or a trace is
+// already running.
+MOVEMM_EXPORT int movemm_trace_start(const char* path, size_t bytes);
+MOVEMM_EXPORT void movemm_trace_stop();
+
+// Writes out the calling thread's buffered events
+MOVEMM_EXPORT void movemm_trace_flush();
+
+// Memory budgets.  Each thread has a current budget category, none by default,
+// and everything it allocates through the movemm_*, movemm_heap_* and tagged
+// heap functions is charged to it until freed.  General and heap allocations
+// are charged their usable size, and come from a range of address space
+// reserved for their category, so they are credited back whichever thread
+// frees them.  Each range is 8GB, or 16MB in 32-bit builds, which caps how
+// much a category can have allocated at once; if the ranges can't be
+// reserved, allocations go uncharged.  Tagged heaps are charged a page at a
+// time, to the category of the thread that takes the page, until their tag is
+// freed.  A ring tag's pages stay charged after it is freed, until the thread
+// reuses its slot and they are taken again for the new frame.
+typedef uint32_t movemm_budget_category_t;
+#define MOVEMM_BUDGET_NONE 0
+#define MOVEMM_BUDGET_MAX_CATEGORIES 64
+
+// Returns the category with the given name, registering it if there isn't
+// one yet, or MOVEMM_BUDGET_NONE once every category is taken
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_register(
+    const char* name);
+MOVEMM_EXPORT const char* movemm_budget_get_name(
+    movemm_budget_category_t category);
+
+// Sets the calling thread's category and returns the one it replaces
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_set_thread_category(
+    movemm_budget_category_t category);
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_get_thread_category();
+
+// Allocates into a category regardless of the thread's.  The memory is freed
+// with the usual movemm_free and movemm_aligned_free functions.
+MOVEMM_EXPORT void* movemm_budget_alloc(
+    movemm_budget_category_t category, size_t bytes);
+MOVEMM_EXPORT void* movemm_budget_aligned_alloc(
+    movemm_budget_category_t category, size_t bytes, size_t alignment);
+
+// Called on the allocating thread when a category's usage goes over its soft
+// limit.  It may allocate.
+typedef void (*movemm_budget_limit_cb_t)(movemm_budget_category_t category,
+    size_t usage, size_t limit, void* user_data);
+
+// A limit of 0 is no limit.  Allocations that would take a category over its
+// hard limit fail and return null.  Usage is kept in per-thread accumulators
+// that are only merged into the category's total every 64KB, so limits are
+// checked against that total plus the calling thread's own accumulator and
+// may be overshot by up to 64KB per thread.
+MOVEMM_EXPORT void movemm_budget_set_limits(
+    movemm_budget_category_t category, size_t soft_limit, size_t hard_limit);
+MOVEMM_EXPORT void movemm_budget_set_soft_limit_callback(
+    movemm_budget_category_t category, movemm_budget_limit_cb_t callback,
+    void* user_data);
+
+typedef struct
+{
+    // Bytes charged, including every thread's unmerged accumulator
+    size_t usage;
+    size_t soft_limit;
+    size_t hard_limit;
+
+    // Since startup
+    uint64_t soft_limit_exceeded;
+    uint64_t failed_allocations;
+} movemm_budget_statistics_t;
+
+MOVEMM_EXPORT void movemm_budget_get_statistics(
+    movemm_budget_category_t category, movemm_budget_statistics_t* statistics);
+
+// Out of memory handling.  When the system can't satisfy an allocation made
+// through the movemm_*, movemm_heap_* or tagged heap functions, movemm first
+// releases the memory it caches itself, the tagged heap's pooled pages and
+// mimalloc's free pages, and calls the pressure callback at
+// MOVEMM_MEMORY_PRESSURE_CRITICAL so the caller can drop its own caches and
+// collect its idle heaps.  Then it tries again.  If that fails too, the OOM
+// handler is called and the allocation retried for as long as the handler
+// returns nonzero.  Only once it returns 0, or if there is none, does the
+// allocation fail.  Allocations refused by a budget's hard limit aren't out of
+// memory and fail straight away.
+//
+// Both run on the failing thread without any movemm locks held, and may
+// allocate and free; allocations that fail inside them aren't handled again.
+typedef enum
+{
+    // Raised by the caller through movemm_signal_memory_pressure, such as
+    // on a low memory notification from the OS
+    MOVEMM_MEMORY_PRESSURE_MODERATE = 1,
+
+    // An allocation of `bytes` has failed
+    MOVEMM_MEMORY_PRESSURE_CRITICAL = 2,
+} movemm_memory_pressure_t;
+
+typedef void (*movemm_pressure_cb_t)(
+    movemm_memory_pressure_t level, size_t bytes, void* user_data);
+
+// `attempt` counts the handler's calls for this allocation from 0
+typedef int (*movemm_oom_handler_t)(
+    size_t bytes, uint32_t attempt, void* user_data);
+
+MOVEMM_EXPORT void movemm_set_pressure_callback(
+    movemm_pressure_cb_t callback, void* user_data);
+MOVEMM_EXPORT void movemm_set_oom_handler(
+    movemm_oom_handler_t handler, void* user_data);
+
+// Releases movemm's cached memory and calls the pressure callback with a
+// size of 0.  Only a critical level returns mimalloc's free pages to the OS.
+MOVEMM_EXPORT void movemm_signal_memory_pressure(
+    movemm_memory_pressure_t level);
+
+// Emergency reserve.  Commits a region up front that movemm_emergency_alloc
+// hands out once the rest of memory is gone, such as to write a crash report
+// from the OOM handler.  Reserving replaces nothing and returns 0 if there is
+// already a reserve or the region couldn't be allocated.
+MOVEMM_EXPORT int movemm_reserve_emergency_memory(size_t bytes);
+
+// Bump allocates from the reserve, aligned to max_align_t, and returns
+// null once it is used up.  The memory is never freed, and must not be passed
+// to movemm_free.
+MOVEMM_EXPORT void* movemm_emergency_alloc(size_t bytes);
+MOVEMM_EXPORT size_t movemm_get_emergency_memory_remaining();
+
 #if defined(MOVEMM_WINDOWS)
 #define movemm_stack_alloc(bytes) _alloca(bytes)
 #elif defined(MOVEMM_UNIX)
@@ -49,6 +430,9 @@ MOVEMM_EXPORT size_t movemm_tagged_heap_get_current_tag_storage(
 #endif
 
 #ifdef __cplusplus
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
 namespace movemm
 {
@@ -58,11 +442,20 @@ namespace movemm
         return new (movemm_alloc(sizeof(T))) T(std::forward<Args>(args)...);
     }
 
+    // Objects that can't be of a more derived type are freed with their size.
+    // A pointer to a polymorphic base may point into something bigger.
     template <typename T>
     inline void mmdelete(T* ptr)
     {
         ptr->~T();
-        movemm_free(ptr);
+        if constexpr (!std::is_polymorphic_v<T> || std::is_final_v<T>)
+        {
+            movemm_free_sized(ptr, sizeof(T));
+        }
+        else
+        {
+            movemm_free(ptr);
+        }
     }
 
     inline void* alloc(size_t bytes)
@@ -80,6 +473,21 @@ namespace movemm
         movemm_free(ptr);
     }
 
+    inline void free_sized(void* ptr, size_t bytes)
+    {
+        movemm_free_sized(ptr, bytes);
+    }
+
+    inline size_t alloc_batch(size_t bytes, size_t count, void** ptrs)
+    {
+        return movemm_alloc_batch(bytes, count, ptrs);
+    }
+
+    inline void free_batch(void** ptrs, size_t count)
+    {
+        movemm_free_batch(ptrs, count);
+    }
+
     inline void* aligned_alloc(size_t bytes, size_t alignment)
     {
         return movemm_aligned_alloc(bytes, alignment);
@@ -95,27 +503,272 @@ namespace movemm
         movemm_aligned_free(ptr, alignment);
     }
 
+    inline void aligned_free_sized(void* ptr, size_t bytes, size_t alignment)
+    {
+        movemm_aligned_free_sized(ptr, bytes, alignment);
+    }
+
     inline void* tagged_alloc(movemm_heap_tag_t tag, size_t bytes)
     {
         return movemm_tagged_heap_alloc(tag, bytes);
     }
 
+    inline void* tagged_aligned_alloc(
+        movemm_heap_tag_t tag, size_t bytes, size_t alignment)
+    {
+        return movemm_tagged_heap_aligned_alloc(tag, bytes, alignment);
+    }
+
+    inline size_t tagged_alloc_batch(
+        movemm_heap_tag_t tag, size_t bytes, size_t count, void** ptrs)
+    {
+        return movemm_tagged_heap_alloc_batch(tag, bytes, count, ptrs);
+    }
+
+    inline size_t tagged_aligned_alloc_batch(movemm_heap_tag_t tag,
+        size_t bytes, size_t alignment, size_t count, void** ptrs)
+    {
+        return movemm_tagged_heap_aligned_alloc_batch(
+            tag, bytes, alignment, count, ptrs);
+    }
+
+    inline void* tagged_realloc(movemm_heap_tag_t tag, void* ptr,
+        size_t oldBytes, size_t newBytes)
+    {
+        return movemm_tagged_heap_realloc(tag, ptr, oldBytes, newBytes);
+    }
+
+    inline void* tagged_aligned_realloc(movemm_heap_tag_t tag, void* ptr,
+        size_t oldBytes, size_t newBytes, size_t alignment)
+    {
+        return movemm_tagged_heap_aligned_realloc(
+            tag, ptr, oldBytes, newBytes, alignment);
+    }
+
     inline void tagged_free(movemm_heap_tag_t tag)
     {
         movemm_tagged_heap_free(tag);
     }
 
+    // Charges the thread's allocations to a budget category until the scope
+    // is destroyed, when the previous category is restored
+    class budget_scope
+    {
+    public:
+        explicit budget_scope(movemm_budget_category_t category)
+            : _previous(movemm_budget_set_thread_category(category))
+        {
+        }
+
+        ~budget_scope()
+        {
+            movemm_budget_set_thread_category(_previous);
+        }
+
+        budget_scope(const budget_scope&) = delete;
+        budget_scope& operator=(const budget_scope&) = delete;
+
+    private:
+        movemm_budget_category_t _previous;
+    };
+
+    // Rewinds the tag to where it was when the scope was created.  Must be
+    // destroyed on the thread that created it.
+    class tagged_scope
+    {
+    public:
+        explicit tagged_scope(movemm_heap_tag_t tag)
+            : _tag(tag), _marker(movemm_tagged_heap_get_marker(tag))
+        {
+        }
+
+        ~tagged_scope()
+        {
+            movemm_tagged_heap_rewind(_tag, _marker);
+        }
+
+        tagged_scope(const tagged_scope&) = delete;
+        tagged_scope& operator=(const tagged_scope&) = delete;
+
+        movemm_heap_tag_t tag() const
+        {
+            return _tag;
+        }
+
+    private:
+        movemm_heap_tag_t _tag;
+        movemm_tagged_heap_marker_t _marker;
+    };
+
+    // Trivially destructible types are never registered, so creating them
+    // costs nothing beyond the allocation itself.  Returns null if the
+    // allocation fails.
     template <typename T, typename... Args>
     inline T* tagged_new(movemm_heap_tag_t tag, Args&&... args)
     {
-        void* ptr = tagged_alloc(tag, sizeof(T));
+        void* ptr = tagged_aligned_alloc(tag, sizeof(T), alignof(T));
+        if (!ptr) return 0;
+
         T* res = new (ptr) T(std::forward<Args>(args)...);
-        movemm_register_tagged_heap_destructor(tag, ptr,
-            [](void* ptr)
-            {
-                ((T*)ptr)->~T();
-            });
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            movemm_register_tagged_heap_destructor(tag, ptr,
+                [](void* ptr)
+                {
+                    ((T*)ptr)->~T();
+                });
+        }
         return res;
     }
+
+    namespace detail
+    {
+        // Arrays that need their length to be destroyed or freed are prefixed
+        // with their element count.  Tagged arrays of non-trivially
+        // destructible types use it so a single destructor record can cover
+        // all of them, and mmnew_array so the array is freed with its size.
+        template <typename T>
+        struct array_header
+        {
+            static constexpr size_t alignment =
+                alignof(T) > alignof(size_t) ? alignof(T) : alignof(size_t);
+            static constexpr size_t size =
+                (sizeof(size_t) + alignment - 1) / alignment * alignment;
+            // The most elements whose bytes and header fit in a size_t
+            static constexpr size_t max_count = (SIZE_MAX - size) / sizeof(T);
+
+            static T* elements(void* header)
+            {
+                return reinterpret_cast<T*>(static_cast<char*>(header) + size);
+            }
+
+            static void* header_of(T* elements)
+            {
+                return reinterpret_cast<char*>(elements) - size;
+            }
+
+            static void destroy(void* header)
+            {
+                auto count = *static_cast<size_t*>(header);
+                auto arr = elements(header);
+                while (count)
+                {
+                    arr[--count].~T();
+                }
+            }
+        };
+    }  // namespace detail
+
+    // Value-initializes count elements behind a header holding the count,
+    // so that mmdelete_array can destroy them and free them with their size
+    template <typename T>
+    inline T* mmnew_array(size_t count)
+    {
+        using header = detail::array_header<T>;
+        constexpr bool overaligned =
+            header::alignment > alignof(std::max_align_t);
+
+        if (count > header::max_count) return 0;
+        auto bytes = header::size + sizeof(T) * count;
+        void* ptr = overaligned ? movemm_aligned_alloc(bytes, header::alignment)
+                                : movemm_alloc(bytes);
+        if (!ptr) return 0;
+
+        auto constructed = static_cast<size_t*>(ptr);
+        *constructed = 0;
+        T* arr = header::elements(ptr);
+        try
+        {
+            for (; *constructed < count; ++*constructed)
+            {
+                new (arr + *constructed) T();
+            }
+        }
+        catch (...)
+        {
+            header::destroy(ptr);
+            if (overaligned)
+            {
+                movemm_aligned_free_sized(ptr, bytes, header::alignment);
+            }
+            else
+            {
+                movemm_free_sized(ptr, bytes);
+            }
+            throw;
+        }
+        return arr;
+    }
+
+    template <typename T>
+    inline void mmdelete_array(T* arr)
+    {
+        if (!arr) return;
+
+        using header = detail::array_header<T>;
+        void* ptr = header::header_of(arr);
+        auto bytes = header::size + sizeof(T) * *static_cast<size_t*>(ptr);
+        header::destroy(ptr);
+        if constexpr (header::alignment > alignof(std::max_align_t))
+        {
+            movemm_aligned_free_sized(ptr, bytes, header::alignment);
+        }
+        else
+        {
+            movemm_free_sized(ptr, bytes);
+        }
+    }
+
+    // Constructs an object in a tagged heap without registering its
+    // destructor, for an owner that destroys it before the tag is freed
+    template <typename T, typename... Args>
+    inline T* tagged_new_unowned(movemm_heap_tag_t tag, Args&&... args)
+    {
+        void* ptr = tagged_aligned_alloc(tag, sizeof(T), alignof(T));
+        if (!ptr) return 0;
+        return new (ptr) T(std::forward<Args>(args)...);
+    }
+
+    // Constructs `count` elements from `args`, passed as lvalues to each one
+    // (value-initialized when there are none).  Elements are destroyed in
+    // reverse order when the tag is freed, through one destructor record for
+    // the whole array.
+    template <typename T, typename... Args>
+    inline T* tagged_new_array(
+        movemm_heap_tag_t tag, size_t count, Args&&... args)
+    {
+        if (count > detail::array_header<T>::max_count) return 0;
+        if constexpr (std::is_trivially_destructible_v<T>)
+        {
+            T* arr = static_cast<T*>(
+                tagged_aligned_alloc(tag, sizeof(T) * count, alignof(T)));
+            if (!arr) return 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                new (arr + i) T(args...);
+            }
+            return arr;
+        }
+        else
+        {
+            // The stored count only covers constructed elements, so a
+            // throwing constructor leaves a record that is still valid.
+            using header = detail::array_header<T>;
+            void* ptr = tagged_aligned_alloc(
+                tag, header::size + sizeof(T) * count, header::alignment);
+            if (!ptr) return 0;
+
+            auto constructed = static_cast<size_t*>(ptr);
+            *constructed = 0;
+            movemm_register_tagged_heap_destructor(tag, ptr, &header::destroy);
+
+            T* arr = header::elements(ptr);
+            for (; *constructed < count; ++*constructed)
+            {
+                new (arr + *constructed) T(args...);
+            }
+            return arr;
+        }
+    }
 }  // namespace movemm
 #endif
\ No newline at end of file
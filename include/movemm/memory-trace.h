@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+// Layout of the trace files written by movemm_trace_start.  The file is a ring
+// of fixed size chunks following a header chunk.  Each chunk holds a run of
+// events from a single thread, in the order that thread made them.  Chunks are
+// numbered as they are written, and once the ring is full the oldest chunks
+// are overwritten, so a reader should sort the chunks it finds by sequence
+// and expect the first frees to refer to allocations it never saw.
+#define MOVEMM_TRACE_MAGIC 0x45434152544d4d4dull  // "MMMTRACE"
+#define MOVEMM_TRACE_VERSION 3
+#define MOVEMM_TRACE_CHUNK_BYTES 4096
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t chunk_bytes;
+
+    // Chunks in the ring, not counting the header
+    uint64_t chunk_count;
+} movemm_trace_file_header_t;
+
+typedef struct
+{
+    // Starts at 1, and is 0 for chunks that are unused or being written
+    uint64_t sequence;
+    uint32_t thread;
+    uint32_t count;
+} movemm_trace_chunk_header_t;
+
+typedef enum
+{
+    // ptr, size
+    MOVEMM_TRACE_ALLOC = 1,
+    // ptr
+    MOVEMM_TRACE_FREE = 2,
+    // ptr, size, extra is the old pointer
+    MOVEMM_TRACE_REALLOC = 3,
+    // ptr, size, extra is the heap
+    MOVEMM_TRACE_HEAP_ALLOC = 4,
+    // ptr, size, extra is the old pointer, which came from the same heap
+    MOVEMM_TRACE_HEAP_REALLOC = 5,
+    // ptr, extra is the heap
+    MOVEMM_TRACE_HEAP_FREE = 6,
+    // extra is the heap
+    MOVEMM_TRACE_HEAP_DESTROY = 7,
+    // ptr, size, extra is the tag
+    MOVEMM_TRACE_TAGGED_ALLOC = 8,
+    // ptr, size, extra is the old pointer, which came from the same tag
+    MOVEMM_TRACE_TAGGED_REALLOC = 9,
+    // extra is the tag
+    MOVEMM_TRACE_TAGGED_FREE = 10,
+    // ptr is the first of the batch, size, extra is the number of pointers.
+    // The rest of the pointers follow it in the same chunk, packed four to an
+    // event, in MOVEMM_TRACE_BATCH_EVENTS(extra) events with no header.
+    MOVEMM_TRACE_ALLOC_BATCH = 11,
+    // ptr is the id of the storage a marker was taken from, size is
+    // MOVEMM_TRACE_MARKER_POSITION of the marker, extra is the tag
+    MOVEMM_TRACE_TAGGED_MARKER = 12,
+    // Names the marker rewound to the same way as MOVEMM_TRACE_TAGGED_MARKER
+    MOVEMM_TRACE_TAGGED_REWIND = 13,
+} movemm_trace_event_type_t;
+
+typedef struct
+{
+    // Nanoseconds since the trace started in the low 48 bits, the event type
+    // in the top 8 and log2 of the alignment, or 0, in the 8 between
+    uint64_t header;
+    uint64_t ptr;
+    uint64_t size;
+    uint64_t extra;
+} movemm_trace_event_t;
+
+#define MOVEMM_TRACE_EVENTS_PER_CHUNK                                          \
+    ((MOVEMM_TRACE_CHUNK_BYTES - sizeof(movemm_trace_chunk_header_t)) /        \
+        sizeof(movemm_trace_event_t))
+
+// Events taken up by the pointers after the first in a batch of `count`
+#define MOVEMM_TRACE_BATCH_EVENTS(count) (((count) + 2) / 4)
+
+// A marker's page and offset in that page, which orders markers taken from the
+// same storage
+#define MOVEMM_TRACE_MARKER_POSITION(page, offset)                             \
+    (((uint64_t)(page) << 40) | (uint64_t)(offset))
+
+#define MOVEMM_TRACE_EVENT_TIME(header) ((header)&0xffffffffffffull)
+#define MOVEMM_TRACE_EVENT_TYPE(header) ((uint32_t)((header) >> 56))
+#define MOVEMM_TRACE_EVENT_ALIGNMENT(header)                                   \
+    ((((header) >> 48) & 0xff) ? (1ull << (((header) >> 48) & 0xff)) : 0)
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "memory-allocator.h"
+
+// std::pmr adapters for each movemm backend.  Allocation failures throw
+// std::bad_alloc, as std::pmr requires.
+namespace movemm
+{
+    // The global movemm allocator
+    class memory_resource : public std::pmr::memory_resource
+    {
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            auto res = alignment > alignof(std::max_align_t)
+                           ? movemm_aligned_alloc(bytes, alignment)
+                           : movemm_alloc(bytes);
+            if (!res) throw std::bad_alloc();
+            return res;
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+        {
+            if (alignment > alignof(std::max_align_t))
+            {
+                movemm_aligned_free_sized(ptr, bytes, alignment);
+                return;
+            }
+            movemm_free_sized(ptr, bytes);
+        }
+
+        bool do_is_equal(
+            const std::pmr::memory_resource& rhs) const noexcept override
+        {
+            return dynamic_cast<const movemm::memory_resource*>(&rhs) != 0;
+        }
+    };
+
+    // A first-class heap.  Must only be allocated from on the thread that
+    // owns the heap.
+    class heap_memory_resource : public std::pmr::memory_resource
+    {
+    public:
+        inline explicit heap_memory_resource(movemm_heap_t heap) : _heap(heap)
+        {
+        }
+
+        inline movemm_heap_t heap() const
+        {
+            return _heap;
+        }
+
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            auto res = alignment > alignof(std::max_align_t)
+                           ? movemm_heap_aligned_alloc(_heap, bytes, alignment)
+                           : movemm_heap_alloc(_heap, bytes);
+            if (!res) throw std::bad_alloc();
+            return res;
+        }
+
+        void do_deallocate(void* ptr, size_t, size_t) override
+        {
+            movemm_heap_free(_heap, ptr);
+        }
+
+        bool do_is_equal(
+            const std::pmr::memory_resource& rhs) const noexcept override
+        {
+            auto other = dynamic_cast<const heap_memory_resource*>(&rhs);
+            return other && other->_heap == _heap;
+        }
+
+    private:
+        movemm_heap_t _heap;
+    };
+
+    // A tagged heap on the calling thread.  Deallocation is a no-op and the
+    // memory is released when the tag is freed, so frame-temp containers pay
+    // nothing per element to clean up.
+    class tagged_memory_resource : public std::pmr::memory_resource
+    {
+    public:
+        inline explicit tagged_memory_resource(movemm_heap_tag_t tag)
+            : _tag(tag)
+        {
+        }
+
+        inline movemm_heap_tag_t tag() const
+        {
+            return _tag;
+        }
+
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            auto res = movemm_tagged_heap_aligned_alloc(_tag, bytes, alignment);
+            if (!res) throw std::bad_alloc();
+            return res;
+        }
+
+        void do_deallocate(void*, size_t, size_t) override
+        {
+        }
+
+        bool do_is_equal(
+            const std::pmr::memory_resource& rhs) const noexcept override
+        {
+            auto other = dynamic_cast<const tagged_memory_resource*>(&rhs);
+            return other && other->_tag.tag == _tag.tag;
+        }
+
+    private:
+        movemm_heap_tag_t _tag;
+    };
+}  // namespace movemm
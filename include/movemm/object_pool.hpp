@@ -0,0 +1,493 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "memory-allocator.h"
+#include "ptr_types.hpp"
+
+namespace movemm
+{
+    namespace detail
+    {
+        // A free slot in a pool.  Slots are chained into batches through
+        // next, and the first slot of a batch in the depot also holds the
+        // next batch and its own batch's size.
+        struct pool_free_slot
+        {
+            pool_free_slot* next;
+            pool_free_slot* nextBatch;
+            size_t count;
+        };
+
+        class object_pool_base;
+
+        // One thread's free slots for one pool.  The thread owns the cache
+        // and the pool keeps a list of them so it can detach them all when
+        // it is destroyed.
+        struct pool_thread_cache
+        {
+            inline explicit pool_thread_cache(object_pool_base* pool)
+                : pool(pool), head(0), count(0), prev(0), next(0)
+            {
+            }
+
+            object_pool_base* pool;
+            pool_free_slot* head;
+            size_t count;
+
+            pool_thread_cache* prev;
+            pool_thread_cache* next;
+        };
+
+        // Guards the link between caches and their pools.  It is only taken
+        // when a thread starts or stops using a pool and when a pool is
+        // destroyed, never to allocate or free.
+        inline std::mutex g_poolCacheLock;
+
+        inline void release_pool_thread_cache(pool_thread_cache* cache);
+
+        // The caches a thread is using, looked up by pool id.  Ids are never
+        // reused, so an entry for a destroyed pool can never be hit again and
+        // is only released when it is evicted or the thread exits.
+        struct pool_cache_table
+        {
+            static constexpr size_t capacity = 8;
+
+            struct entry
+            {
+                uint64_t pool;
+                pool_thread_cache* cache;
+            };
+
+            inline ~pool_cache_table()
+            {
+                for (auto& entry : entries)
+                {
+                    if (entry.cache)
+                    {
+                        release_pool_thread_cache(entry.cache);
+                    }
+                }
+            }
+
+            entry entries[capacity] = {};
+        };
+
+        inline thread_local pool_cache_table t_poolCaches;
+        inline std::atomic<uint64_t> g_nextPoolId = {1};
+
+        // Everything about a pool that doesn't depend on the type it holds.
+        // Slabs are aligned to their size and start with a header pointing
+        // back at the pool, so any slot can find the pool it came from.
+        class object_pool_base
+        {
+            friend void release_pool_thread_cache(pool_thread_cache*);
+
+        public:
+            struct slab_header
+            {
+                object_pool_base* pool;
+                slab_header* next;
+            };
+
+            inline object_pool_base(movemm_heap_t heap, size_t slabSize,
+                size_t slotSize, size_t slotAlignment)
+                : _id(g_nextPoolId.fetch_add(1, std::memory_order_relaxed)),
+                  _heap(heap),
+                  _slabSize(slabSize),
+                  _slotSize(round_up(slotSize, slotAlignment)),
+                  _firstSlot(round_up(sizeof(slab_header), slotAlignment)),
+                  _batchSize(std::clamp<size_t>(4096 / _slotSize, 4, 64)),
+                  _depot(0),
+                  _slabs(0),
+                  _slabCount(0),
+                  _carve(0),
+                  _carveEnd(0),
+                  _caches(0)
+            {
+            }
+
+            object_pool_base(const object_pool_base&) = delete;
+            object_pool_base& operator=(const object_pool_base&) = delete;
+
+            // Every object must have been destroyed by now.  Threads that
+            // still have a cache for this pool find it detached and drop it.
+            inline ~object_pool_base()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(g_poolCacheLock);
+                    for (auto cache = _caches; cache; cache = cache->next)
+                    {
+                        cache->pool = 0;
+                    }
+                    _caches = 0;
+                }
+
+                while (_slabs)
+                {
+                    auto slab = _slabs;
+                    _slabs = slab->next;
+                    free_slab(slab);
+                }
+            }
+
+        public:
+            // Returns an uninitialised slot, or null if no slab could be
+            // allocated
+            inline void* allocate()
+            {
+                auto cache = thread_cache();
+                if (!cache->head && !refill(cache)) return 0;
+
+                auto slot = cache->head;
+                cache->head = slot->next;
+                --cache->count;
+                return slot;
+            }
+
+            // Returns a slot to the calling thread's cache, handing a batch
+            // to the depot once the cache holds two
+            inline void deallocate(void* ptr)
+            {
+                if (!ptr) return;
+
+                auto cache = thread_cache();
+                auto slot = static_cast<pool_free_slot*>(ptr);
+                slot->next = cache->head;
+                cache->head = slot;
+                if (++cache->count >= _batchSize * 2)
+                {
+                    flush_batch(cache);
+                }
+            }
+
+            inline size_t slot_size() const
+            {
+                return _slotSize;
+            }
+
+            inline size_t slab_count() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                return _slabCount;
+            }
+
+        protected:
+            static constexpr size_t round_up(size_t value, size_t alignment)
+            {
+                return (value + alignment - 1) & ~(alignment - 1);
+            }
+
+        private:
+            inline pool_thread_cache* thread_cache()
+            {
+                auto& table = t_poolCaches;
+                for (auto& entry : table.entries)
+                {
+                    if (entry.pool == _id) return entry.cache;
+                }
+                return add_thread_cache(table);
+            }
+
+            inline pool_thread_cache* add_thread_cache(pool_cache_table& table)
+            {
+                auto cache = mmnew<pool_thread_cache>(this);
+                {
+                    std::lock_guard<std::mutex> lock(g_poolCacheLock);
+                    cache->next = _caches;
+                    if (_caches) _caches->prev = cache;
+                    _caches = cache;
+                }
+
+                // Take an empty entry if there is one, otherwise evict
+                auto slot = &table.entries[_id % pool_cache_table::capacity];
+                for (auto& entry : table.entries)
+                {
+                    if (!entry.cache)
+                    {
+                        slot = &entry;
+                        break;
+                    }
+                }
+                if (slot->cache)
+                {
+                    release_pool_thread_cache(slot->cache);
+                }
+                slot->pool = _id;
+                slot->cache = cache;
+                return cache;
+            }
+
+            // Moves the first batch of the cache to the depot
+            inline void flush_batch(pool_thread_cache* cache)
+            {
+                auto batch = cache->head;
+                auto last = batch;
+                for (size_t i = 1; i < _batchSize; ++i)
+                {
+                    last = last->next;
+                }
+                cache->head = last->next;
+                cache->count -= _batchSize;
+                last->next = 0;
+                push_batch(batch, _batchSize);
+            }
+
+            inline void push_batch(pool_free_slot* batch, size_t count)
+            {
+                if (!count) return;
+
+                std::lock_guard<std::mutex> lock(_lock);
+                batch->nextBatch = _depot;
+                batch->count = count;
+                _depot = batch;
+            }
+
+            // Fills an empty cache with a batch from the depot, or failing
+            // that with slots carved from the current slab
+            inline bool refill(pool_thread_cache* cache)
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                if (_depot)
+                {
+                    cache->head = _depot;
+                    cache->count = _depot->count;
+                    _depot = _depot->nextBatch;
+                    return true;
+                }
+
+                pool_free_slot* head = 0;
+                pool_free_slot* tail = 0;
+                size_t count = 0;
+                while (count < _batchSize)
+                {
+                    if (_carve == _carveEnd && !add_slab()) break;
+
+                    auto slot = reinterpret_cast<pool_free_slot*>(_carve);
+                    _carve += _slotSize;
+                    slot->next = 0;
+                    if (tail) tail->next = slot;
+                    else head = slot;
+                    tail = slot;
+                    ++count;
+                }
+                cache->head = head;
+                cache->count = count;
+                return count != 0;
+            }
+
+            // Must be called with the lock held
+            inline bool add_slab()
+            {
+                auto memory =
+                    _heap
+                        ? movemm_heap_aligned_alloc(_heap, _slabSize, _slabSize)
+                        : movemm_aligned_alloc(_slabSize, _slabSize);
+                auto slab = static_cast<slab_header*>(memory);
+                if (!slab) return false;
+
+                slab->pool = this;
+                slab->next = _slabs;
+                _slabs = slab;
+                ++_slabCount;
+
+                auto bytes = reinterpret_cast<char*>(slab);
+                _carve = bytes + _firstSlot;
+                _carveEnd = _carve +
+                            (_slabSize - _firstSlot) / _slotSize * _slotSize;
+                return true;
+            }
+
+            inline void free_slab(slab_header* slab)
+            {
+                if (_heap)
+                {
+                    movemm_heap_free(_heap, slab);
+                }
+                else
+                {
+                    movemm_aligned_free_sized(slab, _slabSize, _slabSize);
+                }
+            }
+
+        private:
+            const uint64_t _id;
+            const movemm_heap_t _heap;
+            const size_t _slabSize;
+            const size_t _slotSize;
+            const size_t _firstSlot;
+            const size_t _batchSize;
+
+            mutable std::mutex _lock;
+            pool_free_slot* _depot;
+            slab_header* _slabs;
+            size_t _slabCount;
+            char* _carve;
+            char* _carveEnd;
+            pool_thread_cache* _caches;
+        };
+
+        // Returns a cache's slots to its pool, if the pool is still alive,
+        // and frees it
+        inline void release_pool_thread_cache(pool_thread_cache* cache)
+        {
+            {
+                std::lock_guard<std::mutex> lock(g_poolCacheLock);
+                if (auto pool = cache->pool)
+                {
+                    pool->push_batch(cache->head, cache->count);
+                    if (cache->prev) cache->prev->next = cache->next;
+                    else pool->_caches = cache->next;
+                    if (cache->next) cache->next->prev = cache->prev;
+                }
+            }
+            mmdelete(cache);
+        }
+    }  // namespace detail
+
+    // A pool of fixed size slots for objects of a single type.  Slots are
+    // carved from slabs of BlockSize bytes, allocated from movemm or from a
+    // heap, and are never returned to them until the pool is destroyed.
+    // Freed slots go to an intrusive free list in a per-thread cache, which
+    // trades whole batches with a shared depot so that the lock is only
+    // taken once per batch.  Objects may be created and destroyed on any
+    // thread, but a pool backed by a heap must only grow on the heap's
+    // thread.  Every object must be destroyed before the pool is.
+    template <typename T, size_t BlockSize = 64 * 1024>
+    class object_pool : public detail::object_pool_base
+    {
+        static_assert((BlockSize & (BlockSize - 1)) == 0,
+            "BlockSize must be a power of two");
+
+        static constexpr size_t slot_alignment =
+            std::max(alignof(T), alignof(detail::pool_free_slot));
+        static constexpr size_t slot_size =
+            std::max(sizeof(T), sizeof(detail::pool_free_slot));
+
+        static_assert(round_up(sizeof(slab_header), slot_alignment) +
+                              round_up(slot_size, slot_alignment) <=
+                          BlockSize,
+            "BlockSize must fit at least one object");
+
+    public:
+        inline object_pool() : object_pool(0)
+        {
+        }
+
+        inline explicit object_pool(movemm_heap_t heap)
+            : object_pool_base(heap, BlockSize, slot_size, slot_alignment)
+        {
+        }
+
+    public:
+        // Returns null, without constructing anything, if no memory could
+        // be allocated
+        template <typename... Args>
+        inline T* create(Args&&... args)
+        {
+            auto slot = allocate();
+            if (!slot) return 0;
+
+            if constexpr (std::is_nothrow_constructible_v<T, Args&&...>)
+            {
+                return new (slot) T(std::forward<Args>(args)...);
+            }
+            else
+            {
+                try
+                {
+                    return new (slot) T(std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    deallocate(slot);
+                    throw;
+                }
+            }
+        }
+
+        inline void destroy(T* ptr)
+        {
+            if (!ptr) return;
+
+            ptr->~T();
+            deallocate(ptr);
+        }
+
+        // The pool an object was created by, found through its slab
+        static inline object_pool<T, BlockSize>* owner(const T* ptr)
+        {
+            auto slab = reinterpret_cast<const slab_header*>(
+                reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(BlockSize - 1));
+            return static_cast<object_pool<T, BlockSize>*>(slab->pool);
+        }
+
+        // Destroys an object created by any pool of this type
+        static inline void delete_object(void* ptr)
+        {
+            auto object = static_cast<T*>(ptr);
+            owner(object)->destroy(object);
+        }
+    };
+
+    // A pool whose slots hold an object together with its shared_ptr
+    // counts, for use with make_shared
+    template <typename T, size_t BlockSize = 64 * 1024,
+        typename Refcount = atomic_refcount>
+    using shared_object_pool =
+        object_pool<detail::shared_block<T, Refcount>, BlockSize>;
+
+    namespace detail
+    {
+        template <typename T, size_t BlockSize, typename Refcount>
+        struct pooled_shared_block
+        {
+            using pool_t = shared_object_pool<T, BlockSize, Refcount>;
+
+            static void deallocate(shared_control_block<Refcount>* block)
+            {
+                pool_t::delete_object(
+                    static_cast<shared_block<T, Refcount>*>(block));
+            }
+
+            static constexpr shared_block_ops<Refcount> ops = {
+                &shared_block<T, Refcount>::destroy_value, &deallocate};
+        };
+    }  // namespace detail
+
+    // Returns objects to whichever pool of this type they came from
+    template <typename T, size_t BlockSize = 64 * 1024>
+    struct pool_delete
+    {
+        inline void operator()(T* ptr) const
+        {
+            object_pool<T, BlockSize>::owner(ptr)->destroy(ptr);
+        }
+    };
+
+    template <typename T, size_t BlockSize, typename... Args>
+    inline unique_ptr<T, pool_delete<T, BlockSize>> make_unique(
+        object_pool<T, BlockSize>& pool, Args&&... args)
+    {
+        return unique_ptr<T, pool_delete<T, BlockSize>>(
+            pool.create(std::forward<Args>(args)...));
+    }
+
+    // The object is destroyed as soon as the last shared_ptr lets go of it,
+    // but its slot goes back to the pool only once no weak_ptr refers to it.
+    // The pool's refcount policy decides the kind of shared_ptr returned.
+    template <typename T, size_t BlockSize, typename Refcount,
+        typename... Args>
+    inline shared_ptr<T, Refcount> make_shared(
+        shared_object_pool<T, BlockSize, Refcount>& pool, Args&&... args)
+    {
+        using block_t = detail::pooled_shared_block<T, BlockSize, Refcount>;
+        return detail::shared_ptr_access::adopt(
+            pool.create(&block_t::ops, std::forward<Args>(args)...));
+    }
+}  // namespace movemm
@@ -1,5 +1,8 @@
 #pragma once
 #include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <thread>
 #include <type_traits>
 #include <utility>
 
@@ -7,42 +10,173 @@
 
 namespace movemm
 {
+    // Deletes objects made with mmnew
     template <typename T>
-    class unique_ptr
+    struct default_delete
     {
-        template <typename R>
-        friend class unique_ptr;
+        constexpr default_delete() = default;
 
-    private:
-        typedef void (*delete_fn_t)(void*);
-        static void anon_deallocate(void* ptr)
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline default_delete(const default_delete<R>&)
+        {
+        }
+
+        inline void operator()(T* ptr) const
+        {
+            mmdelete(ptr);
+        }
+    };
+
+    // Deletes arrays made with mmnew_array
+    template <typename T>
+    struct default_delete<T[]>
+    {
+        inline void operator()(T* ptr) const
+        {
+            mmdelete_array(ptr);
+        }
+    };
+
+    // Destroys an object made with tagged_new_unowned.  Its memory goes
+    // back with the tag.
+    template <typename T>
+    struct tagged_delete
+    {
+        constexpr tagged_delete() = default;
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline tagged_delete(const tagged_delete<R>&)
+        {
+        }
+
+        inline void operator()(T* ptr) const
+        {
+            ptr->~T();
+        }
+    };
+
+    // Deletes an object allocated from a heap.  mimalloc frees by pointer
+    // alone, but the heap is kept so tracking builds can check ownership.
+    template <typename T>
+    struct heap_delete
+    {
+        inline heap_delete() : heap(0)
+        {
+        }
+
+        inline explicit heap_delete(movemm_heap_t heap) : heap(heap)
+        {
+        }
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline heap_delete(const heap_delete<R>& rhs) : heap(rhs.heap)
+        {
+        }
+
+        inline void operator()(T* ptr) const
         {
-            mmdelete(static_cast<T*>(ptr));
+            ptr->~T();
+            movemm_heap_free(heap, ptr);
         }
 
+        movemm_heap_t heap;
+    };
+
+    namespace detail
+    {
+        // Stateless deleters are a base of the pointer so they take no
+        // space, anything else is stored as a member
+        template <typename Deleter,
+            bool = std::is_empty_v<Deleter> && !std::is_final_v<Deleter>>
+        class deleter_holder : private Deleter
+        {
+        public:
+            inline deleter_holder() = default;
+
+            template <typename D>
+            inline deleter_holder(D&& deleter)
+                : Deleter(std::forward<D>(deleter))
+            {
+            }
+
+            inline Deleter& get_deleter()
+            {
+                return *this;
+            }
+
+            inline const Deleter& get_deleter() const
+            {
+                return *this;
+            }
+        };
+
+        template <typename Deleter>
+        class deleter_holder<Deleter, false>
+        {
+        public:
+            inline deleter_holder() = default;
+
+            template <typename D>
+            inline deleter_holder(D&& deleter)
+                : _deleter(std::forward<D>(deleter))
+            {
+            }
+
+            inline Deleter& get_deleter()
+            {
+                return _deleter;
+            }
+
+            inline const Deleter& get_deleter() const
+            {
+                return _deleter;
+            }
+
+        private:
+            Deleter _deleter;
+        };
+    }  // namespace detail
+
+    // Sole ownership of an object.  With a stateless deleter it is a single
+    // pointer wide.
+    template <typename T, typename Deleter = default_delete<T>>
+    class unique_ptr : private detail::deleter_holder<Deleter>
+    {
+        template <typename R, typename RDeleter>
+        friend class unique_ptr;
+
+        using holder_t = detail::deleter_holder<Deleter>;
+
     public:
-        inline unique_ptr() : _data(0), _deleter(&anon_deallocate)
+        inline unique_ptr() : _data(0)
+        {
+        }
+
+        inline unique_ptr(T* ptrToManage) : _data(ptrToManage)
         {
         }
 
-        inline unique_ptr(T* ptrToManage)
-            : _data(ptrToManage), _deleter(&anon_deallocate)
+        inline unique_ptr(T* ptrToManage, const Deleter& deleter)
+            : holder_t(deleter), _data(ptrToManage)
         {
         }
 
-        inline unique_ptr(const unique_ptr<T>& rhs) = delete;
+        inline unique_ptr(const unique_ptr<T, Deleter>& rhs) = delete;
 
-        inline unique_ptr(unique_ptr<T>&& rhs)
-            : _data(rhs._data), _deleter(rhs._deleter)
+        inline unique_ptr(unique_ptr<T, Deleter>&& rhs)
+            : holder_t(std::move(rhs.get_deleter())), _data(rhs._data)
         {
             rhs._data = 0;
         }
 
-        template <typename R>
-        inline unique_ptr(unique_ptr<R>&& rhs)
-            : _data(rhs._data), _deleter(rhs._deleter)
+        template <typename R, typename RDeleter>
+        inline unique_ptr(unique_ptr<R, RDeleter>&& rhs)
+            : holder_t(std::move(rhs.get_deleter())), _data(rhs._data)
         {
-            static_assert(std::is_same_v<R, T> || std::is_convertible_v<R*, T*>,
+            static_assert(std::is_convertible_v<R*, T*>,
                 "Cannot convert unique_ptr to a different type");
 
             rhs._data = 0;
@@ -57,6 +191,9 @@ namespace movemm
         template <typename... Args>
         inline void create(Args&&... args)
         {
+            static_assert(std::is_same_v<Deleter, default_delete<T>>,
+                "Only unique_ptrs that free with mmdelete can create");
+
             destroy();
             _data = mmnew<T>(std::forward<Args>(args)...);
         }
@@ -65,13 +202,23 @@ namespace movemm
         {
             if (_data)
             {
-                _deleter(_data);
+                get_deleter()(_data);
                 _data = 0;
                 return true;
             }
             return false;
         }
 
+        // Gives up ownership without deleting anything
+        inline T* release()
+        {
+            auto res = _data;
+            _data = 0;
+            return res;
+        }
+
+        using holder_t::get_deleter;
+
         inline T* get()
         {
             return _data;
@@ -113,56 +260,205 @@ namespace movemm
             return *_data;
         }
 
-        inline unique_ptr<T>& operator=(const unique_ptr<T>& rhs) = delete;
-        inline unique_ptr<T>& operator=(unique_ptr<T>&& rhs)
+        inline unique_ptr<T, Deleter>& operator=(
+            const unique_ptr<T, Deleter>& rhs) = delete;
+        inline unique_ptr<T, Deleter>& operator=(unique_ptr<T, Deleter>&& rhs)
         {
-            destroy();
-            _data = rhs._data;
-            rhs._data = 0;
-            rhs._deleter = 0;
+            if (this != &rhs)
+            {
+                destroy();
+                get_deleter() = std::move(rhs.get_deleter());
+                _data = rhs.release();
+            }
             return *this;
         }
 
-        template <typename R>
-        inline unique_ptr<T>& operator=(unique_ptr<R>&& rhs)
+        template <typename R, typename RDeleter>
+        inline unique_ptr<T, Deleter>& operator=(unique_ptr<R, RDeleter>&& rhs)
         {
             static_assert(std::is_convertible<R*, T*>::value,
                 "Cannot convert unique_ptr to a different type");
 
             destroy();
-            _data = rhs._data;
+            get_deleter() = std::move(rhs.get_deleter());
+            _data = rhs.release();
+            return *this;
+        }
+
+    private:
+        T* _data;
+    };
+
+    // Sole ownership of an array, freed with its size
+    template <typename T, typename Deleter>
+    class unique_ptr<T[], Deleter> : private detail::deleter_holder<Deleter>
+    {
+        using holder_t = detail::deleter_holder<Deleter>;
+
+    public:
+        inline unique_ptr() : _data(0)
+        {
+        }
+
+        inline explicit unique_ptr(T* ptrToManage) : _data(ptrToManage)
+        {
+        }
+
+        inline unique_ptr(T* ptrToManage, const Deleter& deleter)
+            : holder_t(deleter), _data(ptrToManage)
+        {
+        }
+
+        inline unique_ptr(const unique_ptr<T[], Deleter>& rhs) = delete;
+
+        inline unique_ptr(unique_ptr<T[], Deleter>&& rhs)
+            : holder_t(std::move(rhs.get_deleter())), _data(rhs._data)
+        {
             rhs._data = 0;
+        }
+
+        inline ~unique_ptr()
+        {
+            destroy();
+        }
+
+    public:
+        inline bool destroy()
+        {
+            if (_data)
+            {
+                get_deleter()(_data);
+                _data = 0;
+                return true;
+            }
+            return false;
+        }
+
+        inline T* release()
+        {
+            auto res = _data;
+            _data = 0;
+            return res;
+        }
+
+        using holder_t::get_deleter;
+
+        inline T* get()
+        {
+            return _data;
+        }
+
+        inline T const* get() const
+        {
+            return _data;
+        }
+
+        inline bool valid() const
+        {
+            return _data;
+        }
+
+    public:
+        inline operator bool() const
+        {
+            return valid();
+        }
+
+        inline T& operator[](size_t index)
+        {
+            return _data[index];
+        }
+
+        inline const T& operator[](size_t index) const
+        {
+            return _data[index];
+        }
+
+        inline unique_ptr<T[], Deleter>& operator=(
+            const unique_ptr<T[], Deleter>& rhs) = delete;
+        inline unique_ptr<T[], Deleter>& operator=(
+            unique_ptr<T[], Deleter>&& rhs)
+        {
+            if (this != &rhs)
+            {
+                destroy();
+                get_deleter() = std::move(rhs.get_deleter());
+                _data = rhs.release();
+            }
             return *this;
         }
 
     private:
         T* _data;
-        delete_fn_t _deleter;
     };
 
     template <typename T, typename... Args>
-    inline unique_ptr<T> make_unique(Args&&... args)
+    inline std::enable_if_t<!std::is_array_v<T>, unique_ptr<T>> make_unique(
+        Args&&... args)
     {
         return unique_ptr<T>(mmnew<T>(std::forward<Args>(args)...));
     }
 
+    // Value-initializes count elements
     template <typename T>
-    class weak_ptr
+    inline std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0,
+        unique_ptr<T>>
+    make_unique(size_t count)
+    {
+        return unique_ptr<T>(mmnew_array<std::remove_extent_t<T>>(count));
+    }
+
+    // The object is destroyed when the pointer is, and its memory released
+    // with the tag
+    template <typename T, typename... Args>
+    inline unique_ptr<T, tagged_delete<T>> make_tagged_unique(
+        movemm_heap_tag_t tag, Args&&... args)
+    {
+        return unique_ptr<T, tagged_delete<T>>(
+            tagged_new_unowned<T>(tag, std::forward<Args>(args)...));
+    }
+
+    // Must be called on the heap's thread
+    template <typename T, typename... Args>
+    inline unique_ptr<T, heap_delete<T>> make_heap_unique(
+        movemm_heap_t heap, Args&&... args)
+    {
+        void* memory = 0;
+        if constexpr (alignof(T) > alignof(std::max_align_t))
+        {
+            memory = movemm_heap_aligned_alloc(heap, sizeof(T), alignof(T));
+        }
+        else
+        {
+            memory = movemm_heap_alloc(heap, sizeof(T));
+        }
+        if (!memory) return unique_ptr<T, heap_delete<T>>();
+
+        return unique_ptr<T, heap_delete<T>>(
+            new (memory) T(std::forward<Args>(args)...), heap_delete<T>(heap));
+    }
+
+    // A non-owning pointer to an object owned elsewhere, typically by a
+    // unique_ptr.  It is never told when the object goes away.
+    template <typename T>
+    class observer_ptr
     {
     public:
-        inline weak_ptr() : _data(0)
+        inline observer_ptr() : _data(0)
         {
         }
 
-        inline weak_ptr(T* ptrToManage) : _data(ptrToManage)
+        inline observer_ptr(T* ptrToManage) : _data(ptrToManage)
         {
         }
 
-        inline weak_ptr(unique_ptr<T>& ptrToManage) : _data(ptrToManage.get())
+        template <typename Deleter>
+        inline observer_ptr(unique_ptr<T, Deleter>& ptrToManage)
+            : _data(ptrToManage.get())
         {
         }
 
-        inline weak_ptr(const weak_ptr<T>& rhs) = default;
+        inline observer_ptr(const observer_ptr<T>& rhs) = default;
 
     public:
         inline void set(T* value)
@@ -210,76 +506,105 @@ namespace movemm
         T* _data;
     };
 
-    namespace detail
+    // Base for types that carry their own reference count, for use with
+    // intrusive_ptr.  Derived is the type the object is deleted as, so a
+    // hierarchy should derive from ref_counted<Base> and give Base a virtual
+    // destructor.
+    template <typename Derived>
+    class ref_counted
     {
-        template <typename T>
-        struct refcounted_data
+    public:
+        inline ref_counted() : _refcount(0)
         {
-            template <typename R>
-            friend class shared_ptr;
+        }
 
-            template <typename... Args>
-            inline refcounted_data(Args&&... args)
-                : value(std::forward<Args>(args)...), refcount(1)
-            {
-            }
+        // The count belongs to the object, not its value
+        inline ref_counted(const ref_counted&) : _refcount(0)
+        {
+        }
+
+        inline ref_counted& operator=(const ref_counted&)
+        {
+            return *this;
+        }
+
+        inline size_t refcount() const
+        {
+            return _refcount.load(std::memory_order_relaxed);
+        }
+
+        friend inline void intrusive_add_ref(const ref_counted* ptr)
+        {
+            ptr->_refcount.fetch_add(1, std::memory_order_relaxed);
+        }
 
-            inline ~refcounted_data()
+        // Whoever drops the last reference must see every write made through
+        // the others, hence acq_rel
+        friend inline void intrusive_release(const ref_counted* ptr)
+        {
+            if (ptr->_refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
             {
+                mmdelete(
+                    static_cast<Derived*>(const_cast<ref_counted*>(ptr)));
             }
+        }
 
-            T value;
-            std::atomic_size_t refcount;
-        };
-    }  // namespace detail
+    protected:
+        inline ~ref_counted()
+        {
+        }
+
+    private:
+        mutable std::atomic_size_t _refcount;
+    };
 
+    // A single pointer to an object that counts its own references.  The
+    // count is found through intrusive_add_ref and intrusive_release, which
+    // ref_counted provides, so a raw pointer to a live object can always be
+    // turned back into an owning one.
     template <typename T>
-    class shared_ptr
+    class intrusive_ptr
     {
         template <typename R>
-        friend class shared_ptr;
+        friend class intrusive_ptr;
 
     public:
-        // Creates an invalid shared_ptr
-        inline shared_ptr() : _data(0)
+        inline intrusive_ptr() : _data(0)
         {
         }
 
-        inline shared_ptr(shared_ptr<T>& rhs) : _data(rhs._data)
+        // Adopts an existing reference instead of adding one if addRef is
+        // false
+        inline intrusive_ptr(T* ptr, bool addRef = true) : _data(ptr)
         {
-            if (_data)
-            {
-                ++_data->refcount;
-            }
+            if (_data && addRef) intrusive_add_ref(_data);
         }
 
-        inline shared_ptr(shared_ptr<T>&& rhs) : _data(rhs._data)
+        inline intrusive_ptr(const intrusive_ptr<T>& rhs) : _data(rhs._data)
         {
-            rhs._data = 0;
+            if (_data) intrusive_add_ref(_data);
         }
 
-        // template <typename R>
-        // inline shared_ptr(const shared_ptr<R>& rhs) : _data(rhs._data)
-        // {
-        //     static_assert(std::is_same_v<T, R> || std::is_assignable_v<T, R>,
-        //         "R must be assignable to T");
-
-        //     if (_data)
-        //     {
-        //         ++_data->refcount;
-        //     }
-        // }
+        inline intrusive_ptr(intrusive_ptr<T>&& rhs) : _data(rhs._data)
+        {
+            rhs._data = 0;
+        }
 
-        // template <typename R>
-        // inline shared_ptr(shared_ptr<R>&& rhs) : _data(rhs._data)
-        // {
-        //     static_assert(std::is_same_v<T, R> || std::is_assignable_v<T, R>,
-        //         "R must be assignable to T");
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline intrusive_ptr(const intrusive_ptr<R>& rhs) : _data(rhs._data)
+        {
+            if (_data) intrusive_add_ref(_data);
+        }
 
-        //     rhs._data = 0;
-        // }
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline intrusive_ptr(intrusive_ptr<R>&& rhs) : _data(rhs._data)
+        {
+            rhs._data = 0;
+        }
 
-        inline ~shared_ptr()
+        inline ~intrusive_ptr()
         {
             destroy();
         }
@@ -289,37 +614,36 @@ namespace movemm
         inline T& create(Args&&... args)
         {
             destroy();
-            return (_data = mmnew<detail::refcounted_data<T>>(
-                        std::forward<Args>(args)...))
-                ->value;
+            _data = mmnew<T>(std::forward<Args>(args)...);
+            intrusive_add_ref(_data);
+            return *_data;
         }
 
         inline void destroy()
         {
             if (_data)
             {
-                if ((--_data->refcount) == 0)
-                {
-                    mmdelete<detail::refcounted_data<T>>(_data);
-                }
+                intrusive_release(_data);
                 _data = 0;
             }
         }
 
-        inline size_t refcount() const
+        // Gives up ownership without releasing the reference
+        inline T* detach()
         {
-            return _data ? _data->refcount.load() : 0;
+            auto res = _data;
+            _data = 0;
+            return res;
         }
 
         inline T* get()
         {
-            if (_data) return &_data->value;
-            return 0;
+            return _data;
         }
 
         inline T const* get() const
         {
-            return &_data->value;
+            return _data;
         }
 
         inline bool valid() const
@@ -335,100 +659,707 @@ namespace movemm
 
         inline T* operator->()
         {
-            return &_data->value;
+            return _data;
         }
 
         inline T const* operator->() const
         {
-            return &_data->value;
+            return _data;
         }
 
         inline T& operator*()
         {
-            return _data->value;
+            return *_data;
         }
 
         inline const T& operator*() const
         {
-            return _data->value;
+            return *_data;
         }
 
-    public:
-        inline shared_ptr<T>& operator=(shared_ptr<T>& rhs)
+        inline intrusive_ptr<T>& operator=(const intrusive_ptr<T>& rhs)
         {
-            if (_data != rhs._data)
-            {
-                destroy();
+            intrusive_ptr<T>(rhs).swap(*this);
+            return *this;
+        }
 
-                _data = rhs._data;
-                if (_data)
-                {
-                    ++_data->refcount;
-                }
-            }
+        inline intrusive_ptr<T>& operator=(intrusive_ptr<T>&& rhs)
+        {
+            intrusive_ptr<T>(std::move(rhs)).swap(*this);
             return *this;
         }
 
-        inline shared_ptr<T>& operator=(shared_ptr<T>&& rhs)
+        template <typename R>
+        inline intrusive_ptr<T>& operator=(const intrusive_ptr<R>& rhs)
         {
-            if (_data != rhs._data)
-            {
-                destroy();
-                _data = rhs._data;
-                rhs._data = 0;
-            }
+            intrusive_ptr<T>(rhs).swap(*this);
             return *this;
         }
 
-        // template <typename R>
-        // inline shared_ptr<T>& operator=(const shared_ptr<R>& rhs)
-        // {
-        //     static_assert(std::is_same_v<T, R> || std::is_assignable_v<T, R>,
-        //         "R must be assignable to T");
-
-        //     if (_data != rhs._data)
-        //     {
-        //         destroy();
-
-        //         _data = rhs._data;
-        //         if (_data)
-        //         {
-        //             ++_data->refcount;
-        //         }
-        //     }
-        //     return *this;
-        // }
-
-        // template <typename R>
-        // inline shared_ptr<T>& operator=(shared_ptr<R>&& rhs)
-        // {
-        //     static_assert(std::is_same_v<T, R> || std::is_assignable_v<T, R>,
-        //         "R must be assignable to T");
-
-        //     if (_data != rhs._data)
-        //     {
-        //         destroy();
-        //         _data = rhs._data;
-        //         rhs._data = 0;
-        //     }
-        //     return *this;
-        // }
+        template <typename R>
+        inline intrusive_ptr<T>& operator=(intrusive_ptr<R>&& rhs)
+        {
+            intrusive_ptr<T>(std::move(rhs)).swap(*this);
+            return *this;
+        }
 
-    public:
-        inline bool operator==(const shared_ptr<T>& rhs) const
+        inline void swap(intrusive_ptr<T>& rhs)
         {
-            return _data == rhs._data;
+            std::swap(_data, rhs._data);
         }
 
-        inline bool operator!=(const shared_ptr<T>& rhs) const
+        template <typename R>
+        inline bool operator==(const intrusive_ptr<R>& rhs) const
         {
-            return _data != rhs._data;
+            return _data == rhs._data;
+        }
+
+        template <typename R>
+        inline bool operator!=(const intrusive_ptr<R>& rhs) const
+        {
+            return _data != rhs._data;
         }
 
     private:
-        detail::refcounted_data<T>* _data;
+        T* _data;
     };
 
+    template <typename T, typename... Args>
+    inline intrusive_ptr<T> make_intrusive(Args&&... args)
+    {
+        return intrusive_ptr<T>(mmnew<T>(std::forward<Args>(args)...));
+    }
+
+    // How shared_ptr counts references.  atomic_refcount may be shared
+    // across threads.  local_refcount is a plain counter for objects that
+    // never leave the thread that created them, which debug builds check on
+    // every count change.
+    struct atomic_refcount
+    {
+        struct counter
+        {
+            inline explicit counter(size_t value) : value(value)
+            {
+            }
+
+            std::atomic_size_t value;
+        };
+
+        // Taking a reference needs no ordering, since the caller already
+        // holds one that keeps the block alive
+        static inline void increment(counter& count)
+        {
+            count.value.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Whoever releases last must see every write made through the other
+        // references before tearing anything down
+        static inline bool decrement(counter& count)
+        {
+            return count.value.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+        // Only takes a reference if there still is one
+        static inline bool try_increment(counter& count)
+        {
+            auto value = count.value.load(std::memory_order_relaxed);
+            while (value != 0)
+            {
+                if (count.value.compare_exchange_weak(value, value + 1,
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static inline size_t load(const counter& count)
+        {
+            return count.value.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct local_refcount
+    {
+        struct counter
+        {
+            inline explicit counter(size_t value) : value(value)
+            {
+#if !defined(NDEBUG)
+                owner = std::this_thread::get_id();
+#endif
+            }
+
+            size_t value;
+#if !defined(NDEBUG)
+            std::thread::id owner;
+#endif
+        };
+
+        static inline void increment(counter& count)
+        {
+            check_owner(count);
+            ++count.value;
+        }
+
+        static inline bool decrement(counter& count)
+        {
+            check_owner(count);
+            return --count.value == 0;
+        }
+
+        static inline bool try_increment(counter& count)
+        {
+            check_owner(count);
+            if (!count.value) return false;
+            ++count.value;
+            return true;
+        }
+
+        static inline size_t load(const counter& count)
+        {
+            return count.value;
+        }
+
+    private:
+        static inline void check_owner(const counter& count)
+        {
+#if !defined(NDEBUG)
+            assert(count.owner == std::this_thread::get_id() &&
+                   "local_shared_ptr used from a thread that doesn't own it");
+#endif
+        }
+    };
+
+    template <typename T, typename Refcount = atomic_refcount>
+    class shared_ptr;
+
+    template <typename T, typename Refcount = atomic_refcount>
+    class weak_ptr;
+
+    // A shared_ptr for objects that are only ever used on one thread
+    template <typename T>
+    using local_shared_ptr = shared_ptr<T, local_refcount>;
+
+    template <typename T>
+    using local_weak_ptr = weak_ptr<T, local_refcount>;
+
+    namespace detail
+    {
+        template <typename Refcount>
+        struct shared_control_block;
+
+        // How to end each half of a control block's life.  One static table
+        // per object type and allocator, so a block only carries a pointer.
+        template <typename Refcount>
+        struct shared_block_ops
+        {
+            void (*destroy)(shared_control_block<Refcount>*);
+            void (*deallocate)(shared_control_block<Refcount>*);
+        };
+
+        // Counts shared by every shared_ptr and weak_ptr to an object.  The
+        // strong references together hold a single weak reference, so the
+        // object is destroyed with the last strong reference and the block
+        // freed with the last reference of either kind.
+        template <typename Refcount>
+        struct shared_control_block
+        {
+            inline explicit shared_control_block(
+                const shared_block_ops<Refcount>* ops)
+                : strong(1), weak(1), ops(ops)
+            {
+            }
+
+            inline void add_strong()
+            {
+                Refcount::increment(strong);
+            }
+
+            inline void add_weak()
+            {
+                Refcount::increment(weak);
+            }
+
+            inline void release_strong()
+            {
+                if (Refcount::decrement(strong))
+                {
+                    ops->destroy(this);
+                    release_weak();
+                }
+            }
+
+            inline void release_weak()
+            {
+                if (Refcount::decrement(weak))
+                {
+                    ops->deallocate(this);
+                }
+            }
+
+            // Takes a strong reference only if the object is still alive
+            inline bool try_add_strong()
+            {
+                return Refcount::try_increment(strong);
+            }
+
+            inline size_t strong_count() const
+            {
+                return Refcount::load(strong);
+            }
+
+            typename Refcount::counter strong;
+            typename Refcount::counter weak;
+            const shared_block_ops<Refcount>* ops;
+        };
+
+        // The control block and the object in a single allocation.  The
+        // object lives in a union so that it can be destroyed while weak
+        // references keep the block around.
+        template <typename T, typename Refcount = atomic_refcount>
+        struct shared_block : public shared_control_block<Refcount>
+        {
+            using block_t = shared_control_block<Refcount>;
+
+            template <typename... Args>
+            inline explicit shared_block(
+                const shared_block_ops<Refcount>* ops, Args&&... args)
+                : block_t(ops)
+            {
+                new (&value) T(std::forward<Args>(args)...);
+            }
+
+            inline ~shared_block()
+            {
+            }
+
+            static void destroy_value(block_t* block)
+            {
+                static_cast<shared_block<T, Refcount>*>(block)->value.~T();
+            }
+
+            static void deallocate(block_t* block)
+            {
+                mmdelete(static_cast<shared_block<T, Refcount>*>(block));
+            }
+
+            static constexpr shared_block_ops<Refcount> ops = {
+                &destroy_value, &deallocate};
+
+            union
+            {
+                T value;
+            };
+        };
+
+        // Lets allocators outside this header hand a freshly created block
+        // to a shared_ptr
+        struct shared_ptr_access
+        {
+            template <typename T, typename Refcount>
+            static inline shared_ptr<T, Refcount> adopt(
+                shared_block<T, Refcount>* block);
+        };
+    }  // namespace detail
+
+    // Lets an object managed by a shared_ptr hand out more references to
+    // itself.  It is hooked up by make_shared.
+    template <typename T, typename Refcount = atomic_refcount>
+    class enable_shared_from_this
+    {
+        template <typename R, typename RRefcount>
+        friend class shared_ptr;
+
+    public:
+        inline shared_ptr<T, Refcount> shared_from_this();
+        inline shared_ptr<T const, Refcount> shared_from_this() const;
+
+        inline weak_ptr<T, Refcount> weak_from_this()
+        {
+            return _weakThis;
+        }
+
+    protected:
+        inline enable_shared_from_this()
+        {
+        }
+
+        // Copies are different objects with owners of their own
+        inline enable_shared_from_this(const enable_shared_from_this&)
+        {
+        }
+
+        inline enable_shared_from_this& operator=(
+            const enable_shared_from_this&)
+        {
+            return *this;
+        }
+
+        inline ~enable_shared_from_this()
+        {
+        }
+
+    private:
+        mutable weak_ptr<T, Refcount> _weakThis;
+    };
+
+    // A reference counted pointer.  The object is created together with its
+    // counts in one allocation by make_shared, and a shared_ptr may point to
+    // a base of that object, or to anything it owns, while keeping the whole
+    // of it alive.
+    template <typename T, typename Refcount>
+    class shared_ptr
+    {
+        template <typename R, typename RRefcount>
+        friend class shared_ptr;
+
+        template <typename R, typename RRefcount>
+        friend class weak_ptr;
+
+        friend struct detail::shared_ptr_access;
+
+        using block_t = detail::shared_control_block<Refcount>;
+
+    public:
+        // Creates an invalid shared_ptr
+        inline shared_ptr() : _data(0), _block(0)
+        {
+        }
+
+        inline shared_ptr(const shared_ptr<T, Refcount>& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            if (_block) _block->add_strong();
+        }
+
+        inline shared_ptr(shared_ptr<T, Refcount>&& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            rhs._data = 0;
+            rhs._block = 0;
+        }
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline shared_ptr(const shared_ptr<R, Refcount>& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            if (_block) _block->add_strong();
+        }
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline shared_ptr(shared_ptr<R, Refcount>&& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            rhs._data = 0;
+            rhs._block = 0;
+        }
+
+        // Shares ownership with owner while pointing at data, typically a
+        // member of the owned object
+        template <typename R>
+        inline shared_ptr(const shared_ptr<R, Refcount>& owner, T* data)
+            : _data(data), _block(owner._block)
+        {
+            if (_block) _block->add_strong();
+        }
+
+        inline ~shared_ptr()
+        {
+            destroy();
+        }
+
+    public:
+        template <typename... Args>
+        inline T& create(Args&&... args)
+        {
+            *this = make(std::forward<Args>(args)...);
+            return *_data;
+        }
+
+        inline void destroy()
+        {
+            if (_block)
+            {
+                _block->release_strong();
+                _block = 0;
+            }
+            _data = 0;
+        }
+
+        inline size_t refcount() const
+        {
+            return _block ? _block->strong_count() : 0;
+        }
+
+        inline T* get()
+        {
+            return _data;
+        }
+
+        inline T const* get() const
+        {
+            return _data;
+        }
+
+        inline bool valid() const
+        {
+            return _data;
+        }
+
+    public:
+        inline operator bool() const
+        {
+            return valid();
+        }
+
+        inline T* operator->()
+        {
+            return _data;
+        }
+
+        inline T const* operator->() const
+        {
+            return _data;
+        }
+
+        inline T& operator*()
+        {
+            return *_data;
+        }
+
+        inline const T& operator*() const
+        {
+            return *_data;
+        }
+
+    public:
+        inline shared_ptr<T, Refcount>& operator=(
+            const shared_ptr<T, Refcount>& rhs)
+        {
+            shared_ptr<T, Refcount>(rhs).swap(*this);
+            return *this;
+        }
+
+        inline shared_ptr<T, Refcount>& operator=(
+            shared_ptr<T, Refcount>&& rhs)
+        {
+            shared_ptr<T, Refcount>(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        template <typename R>
+        inline shared_ptr<T, Refcount>& operator=(
+            const shared_ptr<R, Refcount>& rhs)
+        {
+            shared_ptr<T, Refcount>(rhs).swap(*this);
+            return *this;
+        }
+
+        template <typename R>
+        inline shared_ptr<T, Refcount>& operator=(
+            shared_ptr<R, Refcount>&& rhs)
+        {
+            shared_ptr<T, Refcount>(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        inline void swap(shared_ptr<T, Refcount>& rhs)
+        {
+            std::swap(_data, rhs._data);
+            std::swap(_block, rhs._block);
+        }
+
+    public:
+        template <typename R>
+        inline bool operator==(const shared_ptr<R, Refcount>& rhs) const
+        {
+            return _data == rhs._data;
+        }
+
+        template <typename R>
+        inline bool operator!=(const shared_ptr<R, Refcount>& rhs) const
+        {
+            return _data != rhs._data;
+        }
+
+    private:
+        // Takes over the reference the block was created with
+        inline shared_ptr(T* data, block_t* block) : _data(data), _block(block)
+        {
+        }
+
+        template <typename... Args>
+        static inline shared_ptr<T, Refcount> make(Args&&... args)
+        {
+            using shared_block_t =
+                detail::shared_block<std::remove_cv_t<T>, Refcount>;
+            auto block = mmnew<shared_block_t>(
+                &shared_block_t::ops, std::forward<Args>(args)...);
+            return detail::shared_ptr_access::adopt(block);
+        }
+
+        template <typename R>
+        inline void enable_shared_from(
+            const enable_shared_from_this<R, Refcount>* base)
+        {
+            if (base && base->_weakThis.expired())
+            {
+                base->_weakThis = shared_ptr<R, Refcount>(*this);
+            }
+        }
+
+        inline void enable_shared_from(...)
+        {
+        }
+
+        T* _data;
+        block_t* _block;
+    };
+
+    // A non-owning reference to an object managed by shared_ptr.  It keeps
+    // the control block alive, but not the object, which lock checks for.
+    template <typename T, typename Refcount>
+    class weak_ptr
+    {
+        template <typename R, typename RRefcount>
+        friend class weak_ptr;
+
+        using block_t = detail::shared_control_block<Refcount>;
+
+    public:
+        inline weak_ptr() : _data(0), _block(0)
+        {
+        }
+
+        inline weak_ptr(const weak_ptr<T, Refcount>& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            if (_block) _block->add_weak();
+        }
+
+        inline weak_ptr(weak_ptr<T, Refcount>&& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            rhs._data = 0;
+            rhs._block = 0;
+        }
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline weak_ptr(const weak_ptr<R, Refcount>& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            if (_block) _block->add_weak();
+        }
+
+        template <typename R,
+            typename = std::enable_if_t<std::is_convertible_v<R*, T*>>>
+        inline weak_ptr(const shared_ptr<R, Refcount>& rhs)
+            : _data(rhs._data), _block(rhs._block)
+        {
+            if (_block) _block->add_weak();
+        }
+
+        inline ~weak_ptr()
+        {
+            destroy();
+        }
+
+    public:
+        // Returns an invalid shared_ptr once the object has been destroyed
+        inline shared_ptr<T, Refcount> lock() const
+        {
+            if (_block && _block->try_add_strong())
+            {
+                return shared_ptr<T, Refcount>(_data, _block);
+            }
+            return shared_ptr<T, Refcount>();
+        }
+
+        inline bool expired() const
+        {
+            return refcount() == 0;
+        }
+
+        inline size_t refcount() const
+        {
+            return _block ? _block->strong_count() : 0;
+        }
+
+        inline void destroy()
+        {
+            if (_block)
+            {
+                _block->release_weak();
+                _block = 0;
+            }
+            _data = 0;
+        }
+
+        inline weak_ptr<T, Refcount>& operator=(
+            const weak_ptr<T, Refcount>& rhs)
+        {
+            weak_ptr<T, Refcount>(rhs).swap(*this);
+            return *this;
+        }
+
+        inline weak_ptr<T, Refcount>& operator=(weak_ptr<T, Refcount>&& rhs)
+        {
+            weak_ptr<T, Refcount>(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        template <typename R>
+        inline weak_ptr<T, Refcount>& operator=(
+            const shared_ptr<R, Refcount>& rhs)
+        {
+            weak_ptr<T, Refcount>(rhs).swap(*this);
+            return *this;
+        }
+
+        inline void swap(weak_ptr<T, Refcount>& rhs)
+        {
+            std::swap(_data, rhs._data);
+            std::swap(_block, rhs._block);
+        }
+
+    private:
+        T* _data;
+        block_t* _block;
+    };
+
+    namespace detail
+    {
+        template <typename T, typename Refcount>
+        inline shared_ptr<T, Refcount> shared_ptr_access::adopt(
+            shared_block<T, Refcount>* block)
+        {
+            if (!block) return shared_ptr<T, Refcount>();
+
+            shared_ptr<T, Refcount> res(&block->value, block);
+            res.enable_shared_from(&block->value);
+            return res;
+        }
+    }  // namespace detail
+
+    template <typename T, typename Refcount>
+    inline shared_ptr<T, Refcount>
+    enable_shared_from_this<T, Refcount>::shared_from_this()
+    {
+        return _weakThis.lock();
+    }
+
+    template <typename T, typename Refcount>
+    inline shared_ptr<T const, Refcount>
+    enable_shared_from_this<T, Refcount>::shared_from_this() const
+    {
+        return _weakThis.lock();
+    }
+
     template <typename T, typename... Args>
     inline shared_ptr<T> make_shared(Args&&... args)
     {
@@ -436,4 +1367,12 @@ namespace movemm
         res.create(std::forward<Args>(args)...);
         return res;
     }
+
+    template <typename T, typename... Args>
+    inline local_shared_ptr<T> make_local_shared(Args&&... args)
+    {
+        local_shared_ptr<T> res;
+        res.create(std::forward<Args>(args)...);
+        return res;
+    }
 }  // namespace movemm
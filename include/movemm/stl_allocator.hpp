@@ -1,4 +1,7 @@
 #pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 #include "memory-allocator.h"
@@ -17,6 +20,9 @@ namespace movemm
         using size_type = size_t;
         using difference_type = ptrdiff_t;
 
+        using propagate_on_container_move_assignment = std::true_type;
+        using is_always_equal = std::true_type;
+
         inline constexpr stl_allocator() noexcept
         {
         }
@@ -33,12 +39,14 @@ namespace movemm
     public:
         inline T* allocate(size_t count)
         {
-            return static_cast<T*>(movemm_alloc(count * sizeof(T)));
+            auto res = static_cast<T*>(movemm_alloc(count * sizeof(T)));
+            if (!res) throw std::bad_alloc();
+            return res;
         }
 
         inline void deallocate(T* p, size_t count)
         {
-            return movemm_free(p);
+            movemm_free_sized(p, count * sizeof(T));
         }
 
         template <class U, class... Args>
@@ -66,4 +74,161 @@ namespace movemm
     {
         return !(x == y);
     }
+
+    // Allocates from a specific movemm heap.  Containers using it must only
+    // grow on the thread that owns the heap.  The heap follows the memory on
+    // move assignment and swap, so neither has to copy elements.
+    template <typename T>
+    class heap_stl_allocator
+    {
+        template <typename U>
+        friend class heap_stl_allocator;
+
+    public:
+        using value_type = T;
+        using reference = T&;
+        using const_reference = T const&;
+        using pointer = T*;
+        using const_pointer = T const*;
+        using size_type = size_t;
+        using difference_type = ptrdiff_t;
+
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        using is_always_equal = std::false_type;
+
+        inline explicit heap_stl_allocator(movemm_heap_t heap) noexcept
+            : _heap(heap)
+        {
+        }
+
+        template <class U>
+        heap_stl_allocator(heap_stl_allocator<U> const& rhs) noexcept
+            : _heap(rhs._heap)
+        {
+        }
+
+        inline heap_stl_allocator(const heap_stl_allocator&) noexcept =
+            default;
+
+    public:
+        inline T* allocate(size_t count)
+        {
+            T* res;
+            if constexpr (alignof(T) > alignof(std::max_align_t))
+            {
+                res = static_cast<T*>(movemm_heap_aligned_alloc(
+                    _heap, count * sizeof(T), alignof(T)));
+            }
+            else
+            {
+                res = static_cast<T*>(
+                    movemm_heap_alloc(_heap, count * sizeof(T)));
+            }
+            if (!res) throw std::bad_alloc();
+            return res;
+        }
+
+        inline void deallocate(T* p, size_t)
+        {
+            movemm_heap_free(_heap, p);
+        }
+
+        inline movemm_heap_t heap() const noexcept
+        {
+            return _heap;
+        }
+
+    private:
+        movemm_heap_t _heap;
+    };
+
+    template <class T, class U>
+    bool operator==(heap_stl_allocator<T> const& x,
+        heap_stl_allocator<U> const& y) noexcept
+    {
+        return x.heap() == y.heap();
+    }
+
+    template <class T, class U>
+    bool operator!=(heap_stl_allocator<T> const& x,
+        heap_stl_allocator<U> const& y) noexcept
+    {
+        return !(x == y);
+    }
+
+    // Allocates from a tagged heap on the calling thread.  Deallocation is a
+    // no-op: the memory is released when the tag is freed, so containers
+    // using it must not outlive the tag.  The tag follows the memory on move
+    // assignment and swap.
+    template <typename T>
+    class tagged_stl_allocator
+    {
+        template <typename U>
+        friend class tagged_stl_allocator;
+
+    public:
+        using value_type = T;
+        using reference = T&;
+        using const_reference = T const&;
+        using pointer = T*;
+        using const_pointer = T const*;
+        using size_type = size_t;
+        using difference_type = ptrdiff_t;
+
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        using is_always_equal = std::false_type;
+
+        inline explicit tagged_stl_allocator(movemm_heap_tag_t tag) noexcept
+            : _tag(tag)
+        {
+        }
+
+        template <class U>
+        tagged_stl_allocator(tagged_stl_allocator<U> const& rhs) noexcept
+            : _tag(rhs._tag)
+        {
+        }
+
+        inline tagged_stl_allocator(const tagged_stl_allocator&) noexcept =
+            default;
+
+    public:
+        inline T* allocate(size_t count)
+        {
+            auto res = static_cast<T*>(
+                tagged_aligned_alloc(_tag, count * sizeof(T), alignof(T)));
+            if (!res) throw std::bad_alloc();
+            return res;
+        }
+
+        inline void deallocate(T*, size_t)
+        {
+        }
+
+        inline movemm_heap_tag_t tag() const noexcept
+        {
+            return _tag;
+        }
+
+    private:
+        movemm_heap_tag_t _tag;
+    };
+
+    template <class T, class U>
+    bool operator==(tagged_stl_allocator<T> const& x,
+        tagged_stl_allocator<U> const& y) noexcept
+    {
+        return x.tag().tag == y.tag().tag;
+    }
+
+    template <class T, class U>
+    bool operator!=(tagged_stl_allocator<T> const& x,
+        tagged_stl_allocator<U> const& y) noexcept
+    {
+        return !(x == y);
+    }
 }  // namespace movemm
\ No newline at end of file
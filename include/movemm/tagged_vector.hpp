@@ -0,0 +1,256 @@
+#pragma once
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "memory-allocator.h"
+
+namespace movemm
+{
+    // A vector whose storage lives in a tagged heap.  Growth goes through
+    // movemm_tagged_heap_aligned_realloc, so a vector that is the most recent
+    // allocation on its thread's page grows in place without copying.
+    // Storage is never freed individually; it is released with the tag, so the
+    // vector must not outlive it.  Elements are destroyed by the vector
+    // itself, and it must only grow on the thread that created it.
+    template <typename T>
+    class tagged_vector
+    {
+    public:
+        using value_type = T;
+        using size_type = size_t;
+        using iterator = T*;
+        using const_iterator = T const*;
+
+        inline explicit tagged_vector(movemm_heap_tag_t tag)
+            : _tag(tag), _data(0), _size(0), _capacity(0)
+        {
+        }
+
+        inline tagged_vector(const tagged_vector<T>& rhs) = delete;
+
+        inline tagged_vector(tagged_vector<T>&& rhs)
+            : _tag(rhs._tag),
+              _data(rhs._data),
+              _size(rhs._size),
+              _capacity(rhs._capacity)
+        {
+            rhs._data = 0;
+            rhs._size = 0;
+            rhs._capacity = 0;
+        }
+
+        inline ~tagged_vector()
+        {
+            clear();
+        }
+
+        inline tagged_vector<T>& operator=(const tagged_vector<T>& rhs) =
+            delete;
+        inline tagged_vector<T>& operator=(tagged_vector<T>&& rhs)
+        {
+            clear();
+            _tag = rhs._tag;
+            _data = rhs._data;
+            _size = rhs._size;
+            _capacity = rhs._capacity;
+            rhs._data = 0;
+            rhs._size = 0;
+            rhs._capacity = 0;
+            return *this;
+        }
+
+    public:
+        inline void reserve(size_t capacity)
+        {
+            if (capacity > _capacity)
+            {
+                reallocate(capacity);
+            }
+        }
+
+        // Gives back unused capacity, which only helps when the vector is
+        // still the most recent allocation on its page
+        inline void shrink_to_fit()
+        {
+            if (_data && _size < _capacity)
+            {
+                tagged_aligned_realloc(_tag, _data, _capacity * sizeof(T),
+                    _size * sizeof(T), alignof(T));
+                _capacity = _size;
+            }
+        }
+
+        template <typename... Args>
+        inline T& emplace_back(Args&&... args)
+        {
+            if (_size == _capacity)
+            {
+                if (_capacity > max_capacity / 2) throw std::bad_alloc();
+                reallocate(_capacity ? _capacity * 2 : min_capacity);
+            }
+            auto res = new (_data + _size) T(std::forward<Args>(args)...);
+            ++_size;
+            return *res;
+        }
+
+        inline void push_back(const T& value)
+        {
+            emplace_back(value);
+        }
+
+        inline void push_back(T&& value)
+        {
+            emplace_back(std::move(value));
+        }
+
+        inline void pop_back()
+        {
+            _data[--_size].~T();
+        }
+
+        inline void resize(size_t size)
+        {
+            reserve(size);
+            while (_size < size)
+            {
+                new (_data + _size) T();
+                ++_size;
+            }
+            while (_size > size)
+            {
+                pop_back();
+            }
+        }
+
+        inline void clear()
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                while (_size)
+                {
+                    _data[--_size].~T();
+                }
+            }
+            _size = 0;
+        }
+
+    public:
+        inline movemm_heap_tag_t tag() const
+        {
+            return _tag;
+        }
+
+        inline T* data()
+        {
+            return _data;
+        }
+
+        inline T const* data() const
+        {
+            return _data;
+        }
+
+        inline size_t size() const
+        {
+            return _size;
+        }
+
+        inline size_t capacity() const
+        {
+            return _capacity;
+        }
+
+        inline bool empty() const
+        {
+            return _size == 0;
+        }
+
+        inline T& operator[](size_t index)
+        {
+            return _data[index];
+        }
+
+        inline const T& operator[](size_t index) const
+        {
+            return _data[index];
+        }
+
+        inline T& front()
+        {
+            return _data[0];
+        }
+
+        inline const T& front() const
+        {
+            return _data[0];
+        }
+
+        inline T& back()
+        {
+            return _data[_size - 1];
+        }
+
+        inline const T& back() const
+        {
+            return _data[_size - 1];
+        }
+
+        inline iterator begin()
+        {
+            return _data;
+        }
+
+        inline const_iterator begin() const
+        {
+            return _data;
+        }
+
+        inline iterator end()
+        {
+            return _data + _size;
+        }
+
+        inline const_iterator end() const
+        {
+            return _data + _size;
+        }
+
+    private:
+        static constexpr size_t min_capacity = 8;
+        static constexpr size_t max_capacity = SIZE_MAX / sizeof(T);
+
+        // Throws std::bad_alloc and leaves the vector as it was when the
+        // storage cannot grow
+        inline void reallocate(size_t capacity)
+        {
+            if (capacity > max_capacity) throw std::bad_alloc();
+            auto data = static_cast<T*>(tagged_aligned_realloc(_tag, _data,
+                _capacity * sizeof(T), capacity * sizeof(T), alignof(T)));
+            if (!data) throw std::bad_alloc();
+
+            // Reallocating copies bytes, which is all trivially copyable types
+            // need.  Anything else is moved properly from the old storage,
+            // which stays valid until the tag is freed.
+            if constexpr (!std::is_trivially_copyable_v<T>)
+            {
+                if (data != _data)
+                {
+                    for (size_t i = 0; i < _size; ++i)
+                    {
+                        new (data + i) T(std::move(_data[i]));
+                        _data[i].~T();
+                    }
+                }
+            }
+            _data = data;
+            _capacity = capacity;
+        }
+
+    private:
+        movemm_heap_tag_t _tag;
+        T* _data;
+        size_t _size;
+        size_t _capacity;
+    };
+}  // namespace movemm
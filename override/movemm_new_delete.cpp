@@ -0,0 +1,4 @@
+// Added to every target linking move-mm when
+// MOVE_MEMORY_MANAGER_GLOBAL_NEW_DELETE is on.  It lives outside src so it is
+// compiled into the executables rather than the library itself.
+#include <movemm/global_new_delete.hpp>
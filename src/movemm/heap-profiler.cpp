@@ -0,0 +1,369 @@
+#include <movemm/memory-allocator.h>
+#include "heap-profiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <mimalloc.h>
+
+#if defined(MOVEMM_UNIX)
+#include <execinfo.h>
+#elif defined(MOVEMM_WINDOWS)
+#include <windows.h>
+#endif
+
+namespace
+{
+    // While disabled, threads still come back to check for a new period
+    // after this many bytes
+    constexpr int64_t disabled_recheck_bytes = 16 * 1024 * 1024;
+
+    constexpr size_t max_stack_depth = 32;
+
+    // Frames at the top of every backtrace that belong to movemm: the sampler
+    // and the allocation function it was called from
+    constexpr int skipped_frames = 2;
+
+    std::atomic_size_t _samplePeriod = {0};
+
+    // A unique backtrace and the samples taken from it.  Slots are claimed
+    // by swapping in the stack's hash, and the frames are published by
+    // `ready` once written.  Counts and bytes are the raw sampled values;
+    // pprof scales them back up using the sample period.
+    struct profile_stack
+    {
+        std::atomic<uint64_t> hash;
+        std::atomic<uint32_t> ready;
+        uint32_t depth;
+        void* frames[max_stack_depth];
+
+        std::atomic<int64_t> liveCount;
+        std::atomic<int64_t> liveBytes;
+        std::atomic<uint64_t> allocCount;
+        std::atomic<uint64_t> allocBytes;
+    };
+
+    // Sampled allocations that can be freed by pointer.  Each pointer has a
+    // fixed window of slots and lookups scan the whole window, so a slot can
+    // be emptied on free without breaking any probe chain.  A sample that
+    // finds its window full is only counted as allocated.
+    struct sampled_allocation
+    {
+        // 1 while the slot is being filled in
+        std::atomic<uintptr_t> ptr;
+        profile_stack* stack;
+        size_t bytes;
+    };
+
+    constexpr size_t stack_capacity = 4096;
+    constexpr size_t sample_capacity = 16384;
+    constexpr size_t sample_window = 16;
+    constexpr uintptr_t filling = 1;
+
+    // Allocated straight from mimalloc the first time anything is sampled,
+    // so nothing is paid until the profiler is used.  The last stack slot is
+    // reserved for samples that don't fit in the table.
+    struct profile_tables
+    {
+        profile_stack stacks[stack_capacity + 1];
+        sampled_allocation samples[sample_capacity];
+    };
+
+    std::atomic<profile_tables*> _tables = {0};
+
+    profile_tables* get_tables()
+    {
+        auto tables = _tables.load(std::memory_order_acquire);
+        if (tables) return tables;
+
+        auto created =
+            static_cast<profile_tables*>(mi_zalloc(sizeof(profile_tables)));
+        if (!_tables.compare_exchange_strong(
+                tables, created, std::memory_order_acq_rel))
+        {
+            mi_free(created);
+            return tables;
+        }
+        return created;
+    }
+
+    // Draws the distance to the next sample from an exponential distribution
+    // with the period as its mean, so that samples form a Poisson process
+    // over allocated bytes regardless of allocation sizes.
+    int64_t next_sample_distance(size_t period)
+    {
+        thread_local uint64_t state = 0;
+        if (!state)
+        {
+            state = uint64_t(reinterpret_cast<uintptr_t>(&state)) ^
+                    0x9E3779B97F4A7C15ull;
+        }
+
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        auto bits = (state * 0x2545F4914F6CDD1Dull) >> 11;
+
+        // Uniform in (0, 1]
+        auto uniform = (double(bits) + 1.0) / double(1ull << 53);
+        auto distance = -std::log(uniform) * double(period);
+        return int64_t(distance) + 1;
+    }
+
+    int capture_stack(void** frames)
+    {
+#if defined(MOVEMM_UNIX)
+        void* buffer[max_stack_depth + skipped_frames];
+        int depth = backtrace(buffer, max_stack_depth + skipped_frames);
+        depth = depth > skipped_frames ? depth - skipped_frames : 0;
+        memcpy(frames, buffer + skipped_frames, depth * sizeof(void*));
+        return depth;
+#elif defined(MOVEMM_WINDOWS)
+        return CaptureStackBackTrace(
+            skipped_frames, max_stack_depth, frames, 0);
+#else
+        return 0;
+#endif
+    }
+
+    uint64_t hash_stack(void* const* frames, int depth)
+    {
+        // FNV-1a over the addresses, never 0 since that marks an empty slot
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (int i = 0; i < depth; ++i)
+        {
+            hash ^= uint64_t(reinterpret_cast<uintptr_t>(frames[i]));
+            hash *= 0x100000001b3ull;
+        }
+        return hash ? hash : 1;
+    }
+
+    profile_stack* find_or_add_stack(
+        profile_tables& tables, void* const* frames, int depth)
+    {
+        auto hash = hash_stack(frames, depth);
+        for (size_t probe = 0; probe < stack_capacity; ++probe)
+        {
+            auto& stack = tables.stacks[(hash + probe) % stack_capacity];
+            auto current = stack.hash.load(std::memory_order_acquire);
+            if (current == 0)
+            {
+                if (stack.hash.compare_exchange_strong(
+                        current, hash, std::memory_order_acq_rel))
+                {
+                    memcpy(stack.frames, frames, depth * sizeof(void*));
+                    stack.depth = uint32_t(depth);
+                    stack.ready.store(1, std::memory_order_release);
+                    return &stack;
+                }
+            }
+
+            if (current == hash)
+            {
+                while (!stack.ready.load(std::memory_order_acquire))
+                {
+                }
+                if (stack.depth == uint32_t(depth) &&
+                    !memcmp(stack.frames, frames, depth * sizeof(void*)))
+                {
+                    return &stack;
+                }
+            }
+        }
+        return &tables.stacks[stack_capacity];
+    }
+
+    inline size_t sample_window_start(uintptr_t ptr)
+    {
+        return size_t(((ptr >> 4) * 0x9E3779B97F4A7C15ull) >> 32) %
+               sample_capacity;
+    }
+
+    void track_sample(
+        profile_tables& tables, void* ptr, profile_stack* stack, size_t bytes)
+    {
+        auto key = reinterpret_cast<uintptr_t>(ptr);
+        auto start = sample_window_start(key);
+        for (size_t i = 0; i < sample_window; ++i)
+        {
+            auto& slot = tables.samples[(start + i) % sample_capacity];
+            uintptr_t expected = 0;
+            if (slot.ptr.compare_exchange_strong(
+                    expected, filling, std::memory_order_acquire))
+            {
+                slot.stack = stack;
+                slot.bytes = bytes;
+                stack->liveCount.fetch_add(1, std::memory_order_relaxed);
+                stack->liveBytes.fetch_add(
+                    int64_t(bytes), std::memory_order_relaxed);
+                movemm::profiler::g_liveSamples.fetch_add(
+                    1, std::memory_order_relaxed);
+                slot.ptr.store(key, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    void write_profile(FILE* file)
+    {
+        auto tables = _tables.load(std::memory_order_acquire);
+
+        // The header carries the totals, so they are summed first
+        int64_t liveCount = 0, liveBytes = 0;
+        uint64_t allocCount = 0, allocBytes = 0;
+        for (size_t i = 0; tables && i <= stack_capacity; ++i)
+        {
+            auto& stack = tables->stacks[i];
+            auto count = stack.liveCount.load(std::memory_order_relaxed);
+            auto bytes = stack.liveBytes.load(std::memory_order_relaxed);
+            liveCount += count > 0 ? count : 0;
+            liveBytes += bytes > 0 ? bytes : 0;
+            allocCount += stack.allocCount.load(std::memory_order_relaxed);
+            allocBytes += stack.allocBytes.load(std::memory_order_relaxed);
+        }
+
+        fprintf(file,
+            "heap profile: %lld: %lld [%llu: %llu] @ heap_v2/%llu\n",
+            (long long)liveCount, (long long)liveBytes,
+            (unsigned long long)allocCount, (unsigned long long)allocBytes,
+            (unsigned long long)_samplePeriod.load(std::memory_order_relaxed));
+
+        for (size_t i = 0; tables && i <= stack_capacity; ++i)
+        {
+            auto& stack = tables->stacks[i];
+            auto samples = stack.allocCount.load(std::memory_order_relaxed);
+            if (!samples) continue;
+            if (i < stack_capacity &&
+                !stack.ready.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            auto count = stack.liveCount.load(std::memory_order_relaxed);
+            auto bytes = stack.liveBytes.load(std::memory_order_relaxed);
+            fprintf(file, "%lld: %lld [%llu: %llu] @",
+                (long long)(count > 0 ? count : 0),
+                (long long)(bytes > 0 ? bytes : 0),
+                (unsigned long long)samples,
+                (unsigned long long)stack.allocBytes.load(
+                    std::memory_order_relaxed));
+            for (uint32_t frame = 0; frame < stack.depth; ++frame)
+            {
+                fprintf(file, " %p", stack.frames[frame]);
+            }
+            fprintf(file, "\n");
+        }
+
+        // pprof needs the mappings to symbolize the addresses
+#if defined(__linux__)
+        fprintf(file, "\nMAPPED_LIBRARIES:\n");
+        if (auto maps = fopen("/proc/self/maps", "r"))
+        {
+            char buffer[4096];
+            size_t read;
+            while ((read = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+            {
+                fwrite(buffer, 1, read, file);
+            }
+            fclose(maps);
+        }
+#endif
+    }
+}  // namespace
+
+namespace movemm
+{
+    namespace profiler
+    {
+        // Refills the thread's byte budget and, if the profiler is enabled,
+        // records the allocation that ran it out
+        void sample(void* ptr, size_t bytes, bool freeable)
+        {
+            // Capturing the backtrace may allocate, which must not recurse
+            thread_local bool sampling = false;
+
+            auto period = _samplePeriod.load(std::memory_order_relaxed);
+            t_bytesUntilSample = period ? next_sample_distance(period)
+                                        : disabled_recheck_bytes;
+            if (!period || !ptr || sampling) return;
+
+            sampling = true;
+            auto tables = get_tables();
+            if (tables)
+            {
+                void* frames[max_stack_depth];
+                auto depth = capture_stack(frames);
+                auto stack = find_or_add_stack(*tables, frames, depth);
+                stack->allocCount.fetch_add(1, std::memory_order_relaxed);
+                stack->allocBytes.fetch_add(bytes, std::memory_order_relaxed);
+                if (freeable)
+                {
+                    track_sample(*tables, ptr, stack, bytes);
+                }
+            }
+            sampling = false;
+        }
+
+        bool take(void* ptr, taken_sample& out)
+        {
+            auto tables = _tables.load(std::memory_order_acquire);
+            if (!tables) return false;
+
+            auto key = reinterpret_cast<uintptr_t>(ptr);
+            auto start = sample_window_start(key);
+            for (size_t i = 0; i < sample_window; ++i)
+            {
+                auto& slot = tables->samples[(start + i) % sample_capacity];
+                if (slot.ptr.load(std::memory_order_acquire) == key)
+                {
+                    auto stack = slot.stack;
+                    auto bytes = slot.bytes;
+                    slot.ptr.store(0, std::memory_order_release);
+
+                    stack->liveCount.fetch_sub(1, std::memory_order_relaxed);
+                    stack->liveBytes.fetch_sub(
+                        int64_t(bytes), std::memory_order_relaxed);
+                    g_liveSamples.fetch_sub(1, std::memory_order_relaxed);
+                    out.stack = stack;
+                    out.bytes = bytes;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void restore(void* ptr, const taken_sample& sample)
+        {
+            if (auto tables = _tables.load(std::memory_order_acquire))
+            {
+                track_sample(*tables, ptr,
+                    static_cast<profile_stack*>(sample.stack), sample.bytes);
+            }
+        }
+    }  // namespace profiler
+}  // namespace movemm
+
+MOVEMM_EXPORT void movemm_profile_set_sample_period(size_t bytes)
+{
+    _samplePeriod.store(bytes, std::memory_order_relaxed);
+
+    // Start sampling on this thread straight away rather than once its
+    // current budget runs out
+    movemm::profiler::t_bytesUntilSample = 0;
+}
+
+MOVEMM_EXPORT size_t movemm_profile_get_sample_period()
+{
+    return _samplePeriod.load(std::memory_order_relaxed);
+}
+
+MOVEMM_EXPORT int movemm_profile_dump(const char* path)
+{
+    auto file = fopen(path, "w");
+    if (!file) return 0;
+
+    write_profile(file);
+    return fclose(file) == 0;
+}
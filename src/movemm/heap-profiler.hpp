@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation hooks for the sampling heap profiler.  These are inlined into the
+// allocation functions, so with sampling disabled each costs one predictable
+// branch: allocations count down a per-thread byte budget that only runs out
+// every few megabytes, and frees only look a pointer up while sampled
+// allocations are live.
+namespace movemm
+{
+    namespace profiler
+    {
+        // Bytes this thread may allocate before the next sample
+        inline thread_local int64_t t_bytesUntilSample = 0;
+
+        // Sampled allocations that can still be freed by pointer
+        inline std::atomic_size_t g_liveSamples = {0};
+
+        // A live sample taken out of the table, which can be put back
+        struct taken_sample
+        {
+            void* stack = 0;
+            size_t bytes = 0;
+        };
+
+        void sample(void* ptr, size_t bytes, bool freeable);
+        bool take(void* ptr, taken_sample& out);
+        void restore(void* ptr, const taken_sample& sample);
+
+        inline void record_allocation(void* ptr, size_t bytes)
+        {
+            if ((t_bytesUntilSample -= int64_t(bytes)) < 0)
+            {
+                sample(ptr, bytes, true);
+            }
+        }
+
+        // A batch counts down once, and is sampled as whichever of its
+        // allocations ran the countdown out
+        inline void record_allocation_batch(
+            void* const* ptrs, size_t count, size_t bytes)
+        {
+            auto before = t_bytesUntilSample;
+            if ((t_bytesUntilSample -= int64_t(count * bytes)) < 0)
+            {
+                auto index = before > 0 && bytes ? size_t(before) / bytes : 0;
+                sample(ptrs[index < count ? index : count - 1], bytes, true);
+            }
+        }
+
+        // Tagged heap memory goes away with its tag, so it is only counted
+        // towards the bytes allocated
+        inline void record_tagged_allocation(void* ptr, size_t bytes)
+        {
+            if ((t_bytesUntilSample -= int64_t(bytes)) < 0)
+            {
+                sample(ptr, bytes, false);
+            }
+        }
+
+        inline void record_free(void* ptr)
+        {
+            if (g_liveSamples.load(std::memory_order_relaxed) != 0)
+            {
+                taken_sample taken;
+                take(ptr, taken);
+            }
+        }
+
+        // The old block's sample is taken before the reallocation can free
+        // it, since another thread may be handed the same address straight
+        // away, and is put back if the reallocation fails
+        class reallocation
+        {
+        public:
+            inline explicit reallocation(void* memory) : _memory(memory)
+            {
+                if (memory && g_liveSamples.load(std::memory_order_relaxed))
+                {
+                    take(memory, _old);
+                }
+            }
+
+            inline void complete(void* res, size_t bytes)
+            {
+                if (res)
+                {
+                    record_allocation(res, bytes);
+                }
+                else if (_old.stack)
+                {
+                    restore(_memory, _old);
+                }
+            }
+
+            reallocation(const reallocation&) = delete;
+            reallocation& operator=(const reallocation&) = delete;
+
+        private:
+            void* _memory;
+            taken_sample _old;
+        };
+    }  // namespace profiler
+}  // namespace movemm
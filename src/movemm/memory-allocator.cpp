@@ -1,42 +1,417 @@
 #include <movemm/memory-allocator.h>
+#include <atomic>
 #include <cstring>
 #include <mutex>
-#include <unordered_set>
+#include <new>
+#include <stdexcept>
 
 #include <mimalloc.h>
 
+#include "heap-profiler.hpp"
+#include "memory-budget.hpp"
+#include "memory-pressure.hpp"
+#include "trace-recorder.hpp"
+
 #if defined(MOVEMM_TRACKING_MODE)
-static std::mutex _globalMutex;
-static std::unordered_set<void*> _allocations;
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MOVEMM_CALLSITE() _ReturnAddress()
+#else
+#define MOVEMM_CALLSITE() __builtin_return_address(0)
 #endif
 
-MOVEMM_EXPORT void* movemm_alloc(size_t bytes)
+namespace
 {
-#if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
+    // One shard of the allocation table: an open addressing hash table with
+    // linear probing, guarded by its own lock.  Pointers are spread over the
+    // shards by hash, so threads rarely contend on the same lock.  The table's
+    // memory comes straight from mimalloc so tracking never tracks itself.
+    struct tracking_shard
+    {
+        static constexpr uintptr_t empty = 0;
+        static constexpr uintptr_t tombstone = 1;
+        static constexpr size_t initial_capacity = 256;
+
+        void insert(const movemm_tracked_allocation_t& record, size_t hash)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            insert_unsafe(record, hash);
+        }
+
+        bool find(void* ptr, size_t hash, movemm_tracked_allocation_t* out)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto slot = find_unsafe(ptr, hash);
+            if (!slot) return false;
+            if (out) *out = *slot;
+            return true;
+        }
+
+        bool take(void* ptr, size_t hash, movemm_tracked_allocation_t& out)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return take_unsafe(ptr, hash, out);
+        }
+
+        void insert_unsafe(const movemm_tracked_allocation_t& record,
+            size_t hash)
+        {
+            if ((used + 1) * 4 > capacity * 3)
+            {
+                rehash();
+            }
+
+            auto mask = capacity - 1;
+            for (auto i = hash & mask;; i = (i + 1) & mask)
+            {
+                auto key = uintptr_t(slots[i].ptr);
+                if (key == empty || key == tombstone)
+                {
+                    if (key == empty) ++used;
+                    slots[i] = record;
+                    ++count;
+                    return;
+                }
+            }
+        }
+
+        bool take_unsafe(void* ptr, size_t hash,
+            movemm_tracked_allocation_t& out)
+        {
+            auto slot = find_unsafe(ptr, hash);
+            if (!slot) return false;
+            out = *slot;
+            slot->ptr = reinterpret_cast<void*>(tombstone);
+            --count;
+            return true;
+        }
+
+        // Copies the live records out so the caller can use them unlocked
+        movemm_tracked_allocation_t* snapshot(size_t& size)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size = 0;
+            if (!count) return 0;
+
+            auto res = static_cast<movemm_tracked_allocation_t*>(
+                mi_malloc(count * sizeof(movemm_tracked_allocation_t)));
+            for (size_t i = 0; i < capacity; ++i)
+            {
+                if (uintptr_t(slots[i].ptr) > tombstone)
+                {
+                    res[size++] = slots[i];
+                }
+            }
+            return res;
+        }
+
+    private:
+        movemm_tracked_allocation_t* find_unsafe(void* ptr, size_t hash)
+        {
+            if (!capacity) return 0;
+
+            auto mask = capacity - 1;
+            for (auto i = hash & mask;; i = (i + 1) & mask)
+            {
+                if (slots[i].ptr == ptr) return &slots[i];
+                if (uintptr_t(slots[i].ptr) == empty) return 0;
+            }
+        }
+
+        // Doubles the table if it is genuinely full, otherwise just clears out
+        // the tombstones
+        void rehash()
+        {
+            auto newCapacity = capacity ? capacity : initial_capacity;
+            if ((count + 1) * 2 > newCapacity) newCapacity *= 2;
+
+            auto oldSlots = slots;
+            auto oldCapacity = capacity;
+            slots = static_cast<movemm_tracked_allocation_t*>(
+                mi_zalloc(newCapacity * sizeof(movemm_tracked_allocation_t)));
+            capacity = newCapacity;
+            used = count;
+
+            auto mask = capacity - 1;
+            for (size_t i = 0; i < oldCapacity; ++i)
+            {
+                if (uintptr_t(oldSlots[i].ptr) <= tombstone) continue;
+
+                auto j = hash_of(oldSlots[i].ptr) & mask;
+                while (slots[j].ptr)
+                {
+                    j = (j + 1) & mask;
+                }
+                slots[j] = oldSlots[i];
+            }
+            mi_free(oldSlots);
+        }
+
+    public:
+        static size_t hash_of(void* ptr)
+        {
+            return size_t((uintptr_t(ptr) >> 4) * 0x9E3779B97F4A7C15ull);
+        }
+
+        // Taken directly by the batch functions, which visit each shard once
+        std::mutex mutex;
+
+    private:
+        movemm_tracked_allocation_t* slots = 0;
+        size_t capacity = 0;
+        size_t count = 0;
+
+        // Live records plus tombstones
+        size_t used = 0;
+    };
+
+    constexpr size_t tracking_shard_bits = 6;
+    constexpr size_t tracking_shard_count = size_t(1) << tracking_shard_bits;
+
+    // Constant initialized, so allocations made during static initialization
+    // are tracked too
+    tracking_shard _trackingShards[tracking_shard_count];
+
+    // The low bits of the hash pick the slot, so the shard comes from the top
+    inline size_t shard_index(size_t hash)
+    {
+        return hash >> (sizeof(size_t) * 8 - tracking_shard_bits);
+    }
+
+    inline tracking_shard& shard_for(size_t hash)
+    {
+        return _trackingShards[shard_index(hash)];
+    }
+
+    // Calls fn(shard, index) for every non-null pointer, visiting each shard
+    // the pointers fall into once and holding its lock throughout
+    template <typename Fn>
+    inline void for_each_shard_locked(void** ptrs, size_t count, Fn&& fn)
+    {
+        static_assert(tracking_shard_count <= 64, "Shards must fit a mask");
+
+        uint64_t shards = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!ptrs[i]) continue;
+            shards |= uint64_t(1)
+                      << shard_index(tracking_shard::hash_of(ptrs[i]));
+        }
+
+        for (size_t index = 0; index < tracking_shard_count; ++index)
+        {
+            if (!(shards & (uint64_t(1) << index))) continue;
+
+            auto& shard = _trackingShards[index];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!ptrs[i]) continue;
+                auto hash = tracking_shard::hash_of(ptrs[i]);
+                if (shard_index(hash) == index) fn(shard, hash, i);
+            }
+        }
+    }
+
+    inline uint32_t current_thread_id()
+    {
+        static std::atomic<uint32_t> s_NextId = {1};
+        thread_local uint32_t id =
+            s_NextId.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    inline void track(void* ptr, size_t bytes, size_t alignment,
+        void* callsite)
+    {
+        if (!ptr) return;
+
+        movemm_tracked_allocation_t record;
+        record.ptr = ptr;
+        record.size = bytes;
+        record.alignment = alignment;
+        record.callsite = callsite;
+        record.thread = current_thread_id();
+
+        auto hash = tracking_shard::hash_of(ptr);
+        shard_for(hash).insert(record, hash);
+    }
+
+    inline void untrack(void* ptr, movemm_tracked_allocation_t& record)
+    {
+        auto hash = tracking_shard::hash_of(ptr);
+        if (!shard_for(hash).take(ptr, hash, record))
+        {
+            throw std::runtime_error(
+                "Attempted to free memory that was not allocated by movemm");
+        }
+    }
+
+    inline void retrack(const movemm_tracked_allocation_t& record)
+    {
+        auto hash = tracking_shard::hash_of(record.ptr);
+        shard_for(hash).insert(record, hash);
+    }
+
+    inline void track_batch(void** ptrs, size_t count, size_t bytes,
+        void* callsite)
+    {
+        movemm_tracked_allocation_t record;
+        record.size = bytes;
+        record.alignment = 0;
+        record.callsite = callsite;
+        record.thread = current_thread_id();
+
+        for_each_shard_locked(ptrs, count,
+            [&](tracking_shard& shard, size_t hash, size_t i)
+            {
+                record.ptr = ptrs[i];
+                shard.insert_unsafe(record, hash);
+            });
+    }
+
+    // Either every pointer is untracked or, if any of them isn't known, none
+    // are and this throws
+    inline void untrack_batch(void** ptrs, size_t count)
+    {
+        auto records = static_cast<movemm_tracked_allocation_t*>(
+            mi_malloc(count * sizeof(movemm_tracked_allocation_t)));
+        bool valid = true;
+        for_each_shard_locked(ptrs, count,
+            [&](tracking_shard& shard, size_t hash, size_t i)
+            {
+                if (!shard.take_unsafe(ptrs[i], hash, records[i]))
+                {
+                    records[i].ptr = 0;
+                    valid = false;
+                }
+            });
+
+        if (!valid)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (ptrs[i] && records[i].ptr) retrack(records[i]);
+            }
+        }
+        mi_free(records);
+
+        if (!valid)
+        {
+            throw std::runtime_error(
+                "Attempted to free memory that was not allocated by movemm");
+        }
+    }
+
+    // Puts a record taken by untrack back if the free doesn't match how it
+    // was allocated, so nothing reaches mimalloc
+    inline void validate_free(const movemm_tracked_allocation_t& record,
+        bool matches, const char* message)
+    {
+        if (!matches)
+        {
+            retrack(record);
+            throw std::runtime_error(message);
+        }
+    }
+
+    constexpr const char* size_mismatch =
+        "Attempted to free memory with a different size than it was "
+        "allocated with";
+    constexpr const char* alignment_mismatch =
+        "Attempted to free aligned memory with a different alignment than it "
+        "was allocated with";
+}  // namespace
 #endif
-    auto res = mi_malloc(bytes);
+
+namespace
+{
+    // Blocks that stay in their budget category are resized by mimalloc, in
+    // the category's heap if they have one.  Blocks changing category are
+    // copied into the new one's heap, as resizing in place would leave them
+    // outside of its range.
+    void* resize(mi_heap_t* heap, bool moves, void* memory, size_t bytes,
+        size_t alignment)
+    {
+        if (heap && moves)
+        {
+            auto res = alignment
+                           ? mi_heap_malloc_aligned(heap, bytes, alignment)
+                           : mi_heap_malloc(heap, bytes);
+            if (res && memory)
+            {
+                auto old = mi_usable_size(memory);
+                memcpy(res, memory, old < bytes ? old : bytes);
+                mi_free(memory);
+            }
+            return res;
+        }
+
+        if (alignment)
+        {
+            return heap
+                       ? mi_heap_realloc_aligned(heap, memory, bytes, alignment)
+                       : mi_realloc_aligned(memory, bytes, alignment);
+        }
+        return heap ? mi_heap_realloc(heap, memory, bytes)
+                    : mi_realloc(memory, bytes);
+    }
+}  // namespace
+
+MOVEMM_EXPORT void* movemm_alloc(size_t bytes)
+{
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto heap = movemm::budget::allocation_heap();
+    auto allocate = [&]
+    {
+        return heap ? mi_heap_malloc(heap, bytes) : mi_malloc(bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    movemm::budget::record_allocation(res);
+    movemm::profiler::record_allocation(res, bytes);
+    movemm::trace::record_allocation(res, bytes, 0);
 #if defined(MOVEMM_TRACKING_MODE)
-    _allocations.insert(res);
+    track(res, bytes, 0, MOVEMM_CALLSITE());
 #endif
     return res;
 }
 
 MOVEMM_EXPORT void* movemm_realloc(void* memory, size_t bytes)
 {
-#if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
-    auto it = _allocations.find(memory);
-#endif
-    auto res = mi_realloc(memory, bytes);
+    movemm::budget::reallocation budget(memory);
+    if (!budget.allow(bytes)) return 0;
 
+    movemm::profiler::reallocation profile(memory);
+    auto category = budget.category();
+    auto heap = category ? movemm::budget::thread_heap(category) : 0;
+    auto reallocate = [&]
+    {
+        return resize(heap, budget.moves(), memory, bytes, 0);
+    };
 #if defined(MOVEMM_TRACKING_MODE)
-    if (it != _allocations.end())
+    // Validated before mimalloc ever sees the pointer
+    movemm_tracked_allocation_t record = {};
+    if (memory) untrack(memory, record);
+
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
+    if (res)
     {
-        _allocations.erase(it);
-        _allocations.insert(res);
+        track(res, bytes, record.alignment, MOVEMM_CALLSITE());
     }
+    else if (memory)
+    {
+        retrack(record);
+    }
+#else
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
 #endif
+    budget.complete(res);
+    profile.complete(res, bytes);
+    movemm::trace::record_reallocation(memory, res, bytes, 0);
     return res;
 }
 
@@ -45,26 +420,97 @@ MOVEMM_EXPORT void movemm_free(void* memory)
     if (!memory) return;
 
 #if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
-    auto it = _allocations.find(memory);
-    if (it == _allocations.end())
+    movemm_tracked_allocation_t record;
+    untrack(memory, record);
+#endif
+    movemm::profiler::record_free(memory);
+    movemm::trace::record_free(memory);
+    movemm::budget::record_free(memory);
+    mi_free(memory);
+}
+
+MOVEMM_EXPORT void movemm_free_sized(void* memory, size_t bytes)
+{
+    if (!memory) return;
+
+#if defined(MOVEMM_TRACKING_MODE)
+    movemm_tracked_allocation_t record;
+    untrack(memory, record);
+    validate_free(record, record.size == bytes, size_mismatch);
+#endif
+    movemm::profiler::record_free(memory);
+    movemm::trace::record_free(memory);
+    movemm::budget::record_free(memory);
+    mi_free_size(memory, bytes);
+}
+
+// mimalloc's own functions look up the thread's default heap on every call,
+// so a batch looks it up once, or the budget category's, and allocates from
+// it directly.  The budget, profiler and trace each see the batch as a whole.
+MOVEMM_EXPORT size_t movemm_alloc_batch(
+    size_t bytes, size_t count, void** ptrs)
+{
+    if (bytes && count > SIZE_MAX / bytes) return 0;
+    if (!movemm::budget::allow_allocation(count * bytes)) return 0;
+
+    auto heap = movemm::budget::allocation_heap();
+    if (!heap) heap = mi_heap_get_default();
+    auto allocate = [&]
     {
-        throw std::runtime_error(
-            "Attempted to free memory that was not allocated by movemm");
+        return mi_heap_malloc(heap, bytes);
+    };
+    size_t allocated = 0;
+    for (; allocated < count; ++allocated)
+    {
+        auto res = allocate();
+        if (!res) res = movemm::oom::retry(bytes, allocate);
+        if (!res) break;
+        ptrs[allocated] = res;
     }
-    _allocations.erase(it);
+    if (allocated)
+    {
+        movemm::budget::record_allocation_batch(ptrs, allocated);
+        movemm::profiler::record_allocation_batch(ptrs, allocated, bytes);
+        movemm::trace::record_allocation_batch(ptrs, allocated, bytes);
+    }
+#if defined(MOVEMM_TRACKING_MODE)
+    track_batch(ptrs, allocated, bytes, MOVEMM_CALLSITE());
 #endif
-    mi_free(memory);
+    return allocated;
 }
 
-MOVEMM_EXPORT void* movemm_aligned_alloc(size_t bytes, size_t alignment)
+MOVEMM_EXPORT void movemm_free_batch(void** ptrs, size_t count)
 {
 #if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
+    untrack_batch(ptrs, count);
 #endif
-    auto res = mi_aligned_alloc(alignment, bytes);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!ptrs[i]) continue;
+        movemm::profiler::record_free(ptrs[i]);
+        movemm::trace::record_free(ptrs[i]);
+        movemm::budget::record_free(ptrs[i]);
+        mi_free(ptrs[i]);
+    }
+}
+
+MOVEMM_EXPORT void* movemm_aligned_alloc(size_t bytes, size_t alignment)
+{
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto heap = movemm::budget::allocation_heap();
+    auto allocate = [&]
+    {
+        return heap ? mi_heap_malloc_aligned(heap, bytes, alignment)
+                    : mi_aligned_alloc(alignment, bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    movemm::budget::record_allocation(res);
+    movemm::profiler::record_allocation(res, bytes);
+    movemm::trace::record_allocation(res, bytes, alignment);
 #if defined(MOVEMM_TRACKING_MODE)
-    _allocations.insert(res);
+    track(res, bytes, alignment, MOVEMM_CALLSITE());
 #endif
     return res;
 }
@@ -72,19 +518,37 @@ MOVEMM_EXPORT void* movemm_aligned_alloc(size_t bytes, size_t alignment)
 MOVEMM_EXPORT void* movemm_aligned_realloc(
     void* memory, size_t bytes, size_t alignment)
 {
-#if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
-    auto it = _allocations.find(memory);
-#endif
-    auto res = mi_realloc_aligned(memory, alignment, bytes);
+    movemm::budget::reallocation budget(memory);
+    if (!budget.allow(bytes)) return 0;
 
+    movemm::profiler::reallocation profile(memory);
+    auto category = budget.category();
+    auto heap = category ? movemm::budget::thread_heap(category) : 0;
+    auto reallocate = [&]
+    {
+        return resize(heap, budget.moves(), memory, bytes, alignment);
+    };
 #if defined(MOVEMM_TRACKING_MODE)
-    if (it != _allocations.end())
+    movemm_tracked_allocation_t record = {};
+    if (memory) untrack(memory, record);
+
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
+    if (res)
+    {
+        track(res, bytes, alignment, MOVEMM_CALLSITE());
+    }
+    else if (memory)
     {
-        _allocations.erase(it);
-        _allocations.insert(res);
+        retrack(record);
     }
+#else
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
 #endif
+    budget.complete(res);
+    profile.complete(res, bytes);
+    movemm::trace::record_reallocation(memory, res, bytes, alignment);
     return res;
 }
 
@@ -93,49 +557,420 @@ MOVEMM_EXPORT void movemm_aligned_free(void* memory, size_t alignment)
     if (!memory) return;
 
 #if defined(MOVEMM_TRACKING_MODE)
-    std::lock_guard<std::mutex> lock(_globalMutex);
-    auto it = _allocations.find(memory);
+    // The pointer must be known and freed with the alignment it was allocated
+    // with before anything is handed back to mimalloc
+    movemm_tracked_allocation_t record;
+    untrack(memory, record);
+    validate_free(record, record.alignment == alignment, alignment_mismatch);
 #endif
+    movemm::profiler::record_free(memory);
+    movemm::trace::record_free(memory);
+    movemm::budget::record_free(memory);
     mi_free_aligned(memory, alignment);
+}
+
+MOVEMM_EXPORT void movemm_aligned_free_sized(
+    void* memory, size_t bytes, size_t alignment)
+{
+    if (!memory) return;
 
 #if defined(MOVEMM_TRACKING_MODE)
-    if (it == _allocations.end())
+    movemm_tracked_allocation_t record;
+    untrack(memory, record);
+    validate_free(record, record.alignment == alignment, alignment_mismatch);
+    validate_free(record, record.size == bytes, size_mismatch);
+#endif
+    movemm::profiler::record_free(memory);
+    movemm::trace::record_free(memory);
+    movemm::budget::record_free(memory);
+    mi_free_size_aligned(memory, bytes, alignment);
+}
+
+// Charged to the category as though it were the thread's
+MOVEMM_EXPORT void* movemm_budget_alloc(
+    movemm_budget_category_t category, size_t bytes)
+{
+    movemm::budget::category_scope scope(category);
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto heap = movemm::budget::allocation_heap();
+    auto allocate = [&]
     {
-        throw std::runtime_error(
-            "Attempted to free memory that was not allocated by movemm");
+        return heap ? mi_heap_malloc(heap, bytes) : mi_malloc(bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    movemm::budget::record_allocation(res);
+    movemm::profiler::record_allocation(res, bytes);
+    movemm::trace::record_allocation(res, bytes, 0);
+#if defined(MOVEMM_TRACKING_MODE)
+    track(res, bytes, 0, MOVEMM_CALLSITE());
+#endif
+    return res;
+}
+
+MOVEMM_EXPORT void* movemm_budget_aligned_alloc(
+    movemm_budget_category_t category, size_t bytes, size_t alignment)
+{
+    movemm::budget::category_scope scope(category);
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto heap = movemm::budget::allocation_heap();
+    auto allocate = [&]
+    {
+        return heap ? mi_heap_malloc_aligned(heap, bytes, alignment)
+                    : mi_aligned_alloc(alignment, bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    movemm::budget::record_allocation(res);
+    movemm::profiler::record_allocation(res, bytes);
+    movemm::trace::record_allocation(res, bytes, alignment);
+#if defined(MOVEMM_TRACKING_MODE)
+    track(res, bytes, alignment, MOVEMM_CALLSITE());
+#endif
+    return res;
+}
+
+MOVEMM_EXPORT int movemm_get_tracked_allocation(
+    void* ptr, movemm_tracked_allocation_t* allocation)
+{
+#if defined(MOVEMM_TRACKING_MODE)
+    auto hash = tracking_shard::hash_of(ptr);
+    return shard_for(hash).find(ptr, hash, allocation);
+#else
+    (void)ptr;
+    (void)allocation;
+    return 0;
+#endif
+}
+
+MOVEMM_EXPORT size_t movemm_visit_tracked_allocations(
+    movemm_tracked_allocation_cb_t visitor, void* user_data)
+{
+    size_t res = 0;
+#if defined(MOVEMM_TRACKING_MODE)
+    for (auto& shard : _trackingShards)
+    {
+        size_t size;
+        auto records = shard.snapshot(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            visitor(&records[i], user_data);
+        }
+        mi_free(records);
+        res += size;
     }
-    _allocations.erase(it);
+#else
+    (void)visitor;
+    (void)user_data;
 #endif
+    return res;
+}
+
+MOVEMM_EXPORT void movemm_get_statistics(movemm_statistics_t* statistics)
+{
+    mi_process_info(0, 0, 0, &statistics->resident,
+        &statistics->peak_resident, &statistics->committed,
+        &statistics->peak_committed, &statistics->page_faults);
+    movemm_tagged_heap_get_statistics(&statistics->tagged);
 }
 
-// MOVEMM_EXPORT void movemm_get_statistics(movemm_statistics_t* statistics)
-// {
-//     static_assert(
-//         sizeof(mimalloc) == sizeof(movemm_statistics_t),
-//         "rpmalloc statistics size mismatch with movemm statistics size");
+namespace
+{
+    // A heap's allocations charged to a budget category come from a companion
+    // heap in the category's range.  Each counts what it has charged, so
+    // destroying the heap can credit it without visiting every block.
+    struct charged_heap
+    {
+        mi_heap_t* heap;
+        movemm_budget_category_t category;
+        std::atomic<int64_t> bytes;
+        charged_heap* next;
+    };
+
+    // Companions are only added by the thread that owns the heap, but blocks
+    // can be freed from any thread
+    struct user_heap
+    {
+        mi_heap_t* heap;
+        std::atomic<charged_heap*> charged;
+
+        inline explicit user_heap(mi_heap_t* heap) : heap(heap), charged(0)
+        {
+        }
+
+        charged_heap* first() const
+        {
+            return charged.load(std::memory_order_acquire);
+        }
+
+        charged_heap* find(movemm_budget_category_t category) const
+        {
+            auto node = first();
+            while (node && node->category != category) node = node->next;
+            return node;
+        }
+
+        // The heap to allocate from, falling back to the uncharged one if the
+        // category's range couldn't be set up
+        mi_heap_t* heap_for(movemm_budget_category_t category)
+        {
+            if (!category) return heap;
+            if (auto node = find(category)) return node->heap;
+
+            auto companion = movemm::budget::new_heap(category);
+            if (!companion) return heap;
+
+            auto memory = mi_malloc(sizeof(charged_heap));
+            if (!memory)
+            {
+                mi_heap_delete(companion);
+                return heap;
+            }
+
+            auto node = new (memory) charged_heap{companion, category, {0},
+                charged.load(std::memory_order_relaxed)};
+            charged.store(node, std::memory_order_release);
+            return companion;
+        }
 
-//     rpmalloc_global_statistics_t stats;
-//     rpmalloc_global_statistics(&stats);
+        void count(movemm_budget_category_t category, int64_t bytes)
+        {
+            if (!category || !bytes) return;
+            if (auto node = find(category))
+            {
+                node->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+        }
 
-//     memcpy(statistics, &stats, sizeof(movemm_statistics_t));
-// }
+        bool owns(const void* ptr) const
+        {
+            if (mi_heap_check_owned(heap, ptr)) return true;
+            for (auto node = first(); node; node = node->next)
+            {
+                if (mi_heap_check_owned(node->heap, ptr)) return true;
+            }
+            return false;
+        }
+    };
+
+    inline user_heap* as_user_heap(movemm_heap_t heap)
+    {
+        return static_cast<user_heap*>(heap);
+    }
+}  // namespace
 
 MOVEMM_EXPORT movemm_heap_t movemm_create_heap()
 {
-    return mi_heap_new();
+    auto heap = mi_heap_new();
+    if (!heap) return 0;
+
+    auto memory = mi_malloc(sizeof(user_heap));
+    if (!memory)
+    {
+        mi_heap_delete(heap);
+        return 0;
+    }
+    return new (memory) user_heap(heap);
 }
 
 MOVEMM_EXPORT void movemm_destroy_heap(movemm_heap_t heap)
 {
-    mi_heap_destroy((mi_heap_t*)(heap));
+    movemm::trace::record_heap_destroy(heap);
+
+    auto owner = as_user_heap(heap);
+    auto node = owner->first();
+    while (node)
+    {
+        auto next = node->next;
+        movemm::budget::add(
+            node->category, -node->bytes.load(std::memory_order_relaxed));
+        mi_heap_destroy(node->heap);
+        node->~charged_heap();
+        mi_free(node);
+        node = next;
+    }
+
+    mi_heap_destroy(owner->heap);
+    owner->~user_heap();
+    mi_free(owner);
 }
 
 MOVEMM_EXPORT void* movemm_heap_alloc(movemm_heap_t heap, size_t bytes)
 {
-    return mi_heap_alloc_new((mi_heap_t*)heap, bytes);
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto owner = as_user_heap(heap);
+    auto target = owner->heap_for(movemm::budget::t_category);
+    auto allocate = [&]
+    {
+        return mi_heap_malloc(target, bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    owner->count(movemm::budget::category_of(res),
+        int64_t(movemm::budget::record_allocation(res)));
+    movemm::trace::record_heap_allocation(heap, res, bytes, 0);
+    return res;
 }
 
-// MOVEMM_EXPORT void movemm_heap_free(movemm_heap_t heap, void* ptr)
-// {
-//     mi_heap_((mi_heap_t*)heap, ptr);
-// }
\ No newline at end of file
+MOVEMM_EXPORT void* movemm_heap_calloc(
+    movemm_heap_t heap, size_t count, size_t bytes)
+{
+    if (bytes && count > SIZE_MAX / bytes) return 0;
+    if (!movemm::budget::allow_allocation(count * bytes)) return 0;
+
+    auto owner = as_user_heap(heap);
+    auto target = owner->heap_for(movemm::budget::t_category);
+    auto allocate = [&]
+    {
+        return mi_heap_calloc(target, count, bytes);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(count * bytes, allocate);
+    owner->count(movemm::budget::category_of(res),
+        int64_t(movemm::budget::record_allocation(res)));
+    movemm::trace::record_heap_allocation(heap, res, count * bytes, 0);
+    return res;
+}
+
+MOVEMM_EXPORT void* movemm_heap_realloc(
+    movemm_heap_t heap, void* memory, size_t bytes)
+{
+    movemm::budget::reallocation budget(memory);
+    if (!budget.allow(bytes)) return 0;
+
+    auto owner = as_user_heap(heap);
+    auto target = owner->heap_for(budget.category());
+    auto reallocate = [&]
+    {
+        return resize(target, budget.moves(), memory, bytes, 0);
+    };
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
+    if (res)
+    {
+        owner->count(budget.old_category(), -int64_t(budget.old_bytes()));
+    }
+    owner->count(movemm::budget::category_of(res),
+        int64_t(budget.complete(res)));
+    movemm::trace::record_heap_reallocation(heap, memory, res, bytes, 0);
+    return res;
+}
+
+MOVEMM_EXPORT void movemm_heap_free(movemm_heap_t heap, void* ptr)
+{
+    if (!ptr) return;
+
+    auto owner = as_user_heap(heap);
+#if defined(MOVEMM_TRACKING_MODE)
+    if (!owner->owns(ptr))
+    {
+        throw std::runtime_error(
+            "Attempted to free memory that was not allocated by the heap");
+    }
+#endif
+    movemm::trace::record_heap_free(heap, ptr);
+    owner->count(movemm::budget::category_of(ptr),
+        -int64_t(movemm::budget::record_free(ptr)));
+    mi_free(ptr);
+}
+
+MOVEMM_EXPORT void* movemm_heap_aligned_alloc(
+    movemm_heap_t heap, size_t bytes, size_t alignment)
+{
+    if (!movemm::budget::allow_allocation(bytes)) return 0;
+
+    auto owner = as_user_heap(heap);
+    auto target = owner->heap_for(movemm::budget::t_category);
+    auto allocate = [&]
+    {
+        return mi_heap_malloc_aligned(target, bytes, alignment);
+    };
+    auto res = allocate();
+    if (!res) res = movemm::oom::retry(bytes, allocate);
+    owner->count(movemm::budget::category_of(res),
+        int64_t(movemm::budget::record_allocation(res)));
+    movemm::trace::record_heap_allocation(heap, res, bytes, alignment);
+    return res;
+}
+
+MOVEMM_EXPORT void* movemm_heap_aligned_realloc(
+    movemm_heap_t heap, void* memory, size_t bytes, size_t alignment)
+{
+    movemm::budget::reallocation budget(memory);
+    if (!budget.allow(bytes)) return 0;
+
+    auto owner = as_user_heap(heap);
+    auto target = owner->heap_for(budget.category());
+    auto reallocate = [&]
+    {
+        return resize(target, budget.moves(), memory, bytes, alignment);
+    };
+    auto res = reallocate();
+    if (!res && bytes) res = movemm::oom::retry(bytes, reallocate);
+    if (res)
+    {
+        owner->count(budget.old_category(), -int64_t(budget.old_bytes()));
+    }
+    owner->count(movemm::budget::category_of(res),
+        int64_t(budget.complete(res)));
+    movemm::trace::record_heap_reallocation(
+        heap, memory, res, bytes, alignment);
+    return res;
+}
+
+MOVEMM_EXPORT void movemm_heap_collect(movemm_heap_t heap, int force)
+{
+    auto owner = as_user_heap(heap);
+    mi_heap_collect(owner->heap, force != 0);
+    for (auto node = owner->first(); node; node = node->next)
+    {
+        mi_heap_collect(node->heap, force != 0);
+    }
+}
+
+namespace
+{
+    struct heap_visit_context
+    {
+        movemm_heap_visit_cb_t visitor;
+        void* userData;
+    };
+
+    // mimalloc also reports each area before its blocks, with no block
+    bool visit_heap_block(const mi_heap_t*, const mi_heap_area_t*, void* block,
+        size_t blockSize, void* arg)
+    {
+        if (!block) return true;
+
+        auto& context = *static_cast<heap_visit_context*>(arg);
+        return context.visitor(block, blockSize, context.userData) != 0;
+    }
+}  // namespace
+
+MOVEMM_EXPORT int movemm_heap_visit_blocks(
+    movemm_heap_t heap, movemm_heap_visit_cb_t visitor, void* user_data)
+{
+    heap_visit_context context = {visitor, user_data};
+    auto owner = as_user_heap(heap);
+    if (!mi_heap_visit_blocks(owner->heap, true, &visit_heap_block, &context))
+    {
+        return 0;
+    }
+    for (auto node = owner->first(); node; node = node->next)
+    {
+        if (!mi_heap_visit_blocks(
+                node->heap, true, &visit_heap_block, &context))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+MOVEMM_EXPORT size_t movemm_usable_size(void* ptr)
+{
+    return mi_usable_size(ptr);
+}
@@ -0,0 +1,439 @@
+#include <movemm/memory-allocator.h>
+#include "memory-budget.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <mimalloc.h>
+
+#if defined(MOVEMM_UNIX)
+#include <sys/mman.h>
+#elif defined(MOVEMM_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+    constexpr size_t max_categories = MOVEMM_BUDGET_MAX_CATEGORIES;
+    constexpr size_t max_name_length = 31;
+
+    // How far a thread's accumulator may drift before it is merged
+    constexpr int64_t merge_threshold = 64 * 1024;
+
+    struct budget_category
+    {
+        char name[max_name_length + 1];
+
+        // Merged usage.  Threads' unmerged bytes are only added when read.
+        std::atomic<int64_t> usage;
+        std::atomic_size_t softLimit;
+        std::atomic_size_t hardLimit;
+        std::atomic<uint64_t> softLimitExceeded;
+        std::atomic<uint64_t> failedAllocations;
+
+        // Guarded by _categoryLock, so the pair is always read together
+        movemm_budget_limit_cb_t callback;
+        void* userData;
+    };
+
+    // Category 0 is MOVEMM_BUDGET_NONE and never charged
+    std::mutex _categoryLock;
+    budget_category _categories[max_categories];
+    std::atomic<uint32_t> _categoryCount = {1};
+
+    inline bool is_valid(movemm_budget_category_t category)
+    {
+        return category != MOVEMM_BUDGET_NONE &&
+               category < _categoryCount.load(std::memory_order_acquire);
+    }
+
+    void notify(
+        movemm_budget_category_t category, int64_t usage, int64_t limit)
+    {
+        movemm_budget_limit_cb_t callback;
+        void* userData;
+        {
+            std::lock_guard<std::mutex> lock(_categoryLock);
+            callback = _categories[category].callback;
+            userData = _categories[category].userData;
+        }
+        if (callback)
+        {
+            callback(category, size_t(usage), size_t(limit), userData);
+        }
+    }
+
+    // Adds merged bytes to a category, calling its soft limit callback if
+    // they take it over the limit.  Each crossing is seen by exactly one
+    // merge, since they all go through the same fetch_add.
+    void merge(movemm_budget_category_t category, int64_t bytes)
+    {
+        auto& entry = _categories[category];
+        auto previous = entry.usage.fetch_add(bytes, std::memory_order_relaxed);
+        auto limit = int64_t(entry.softLimit.load(std::memory_order_relaxed));
+        if (!limit || previous >= limit || previous + bytes < limit) return;
+
+        entry.softLimitExceeded.fetch_add(1, std::memory_order_relaxed);
+        if (movemm::budget::t_deferDepth)
+        {
+            movemm::budget::t_deferredCategories |= uint64_t(1) << category;
+            return;
+        }
+        notify(category, previous + bytes, limit);
+    }
+
+    // Bytes a thread has charged or credited but not yet merged.  Only the
+    // owning thread writes them; readers add them to the merged usage.
+    struct thread_accumulator
+    {
+        std::atomic<int64_t> pending[max_categories] = {};
+        thread_accumulator* prev = nullptr;
+        thread_accumulator* next = nullptr;
+    };
+
+    // Every thread that has charged anything, so reads can sum them
+    std::mutex _registryLock;
+    thread_accumulator* _accumulators = nullptr;
+
+    thread_local bool t_exited = false;
+
+    // Accumulators are created on a thread's first charge and merged when it
+    // exits.  Charges made by other thread_local destructors after that are
+    // merged straight away.
+    struct thread_accumulator_owner
+    {
+        thread_accumulator* accumulator = nullptr;
+
+        inline ~thread_accumulator_owner()
+        {
+            t_exited = true;
+            if (!accumulator) return;
+
+            int64_t pending[max_categories];
+            {
+                std::lock_guard<std::mutex> registry(_registryLock);
+                for (size_t i = 0; i < max_categories; ++i)
+                {
+                    pending[i] =
+                        accumulator->pending[i].load(std::memory_order_relaxed);
+                }
+
+                auto next = accumulator->next;
+                if (accumulator->prev) accumulator->prev->next = next;
+                if (next) next->prev = accumulator->prev;
+                if (_accumulators == accumulator) _accumulators = next;
+            }
+            accumulator->~thread_accumulator();
+            mi_free(accumulator);
+            accumulator = nullptr;
+
+            // Merged outside of the registry lock, since a soft limit
+            // callback may read the statistics
+            for (size_t i = 1; i < max_categories; ++i)
+            {
+                if (pending[i]) merge(movemm_budget_category_t(i), pending[i]);
+            }
+        }
+    };
+
+    thread_local thread_accumulator_owner t_accumulatorOwner;
+
+    thread_accumulator* accumulator_for_thread()
+    {
+        if (t_exited) return nullptr;
+        if (t_accumulatorOwner.accumulator)
+        {
+            return t_accumulatorOwner.accumulator;
+        }
+
+        // Straight from mimalloc so budgets never charge themselves
+        auto memory = mi_malloc(sizeof(thread_accumulator));
+        if (!memory) return nullptr;
+        auto accumulator = new (memory) thread_accumulator();
+
+        std::lock_guard<std::mutex> registry(_registryLock);
+        accumulator->next = _accumulators;
+        if (_accumulators) _accumulators->prev = accumulator;
+        _accumulators = accumulator;
+        t_accumulatorOwner.accumulator = accumulator;
+        return accumulator;
+    }
+
+    // Reserved without committing anything the first time a category is
+    // used, then handed to mimalloc a category at a time as exclusive
+    // arenas, so only that category's heaps allocate from each range
+    constexpr size_t category_region_bytes =
+        size_t(1) << movemm::budget::category_region_shift;
+    constexpr size_t region_bytes = max_categories * category_region_bytes;
+
+    // mimalloc wants its arenas aligned to its segment size
+    constexpr size_t region_alignment = 64 * 1024 * 1024;
+
+    enum arena_state : int
+    {
+        arena_unset,
+        arena_ready,
+        arena_failed
+    };
+
+    std::mutex _regionLock;
+    bool _regionFailed = false;
+    std::atomic<int> _arenaStates[max_categories] = {};
+    mi_arena_id_t _arenas[max_categories] = {};
+
+#if defined(MOVEMM_UNIX)
+    void* reserve_address_space(size_t bytes)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_NORESERVE)
+        flags |= MAP_NORESERVE;
+#endif
+        auto ptr = mmap(0, bytes, PROT_NONE, flags, -1, 0);
+        return ptr != MAP_FAILED ? ptr : 0;
+    }
+#elif defined(MOVEMM_WINDOWS)
+    void* reserve_address_space(size_t bytes)
+    {
+        return VirtualAlloc(0, bytes, MEM_RESERVE, PAGE_NOACCESS);
+    }
+#endif
+
+    // Called under _regionLock.  The reservation is never released, since
+    // charged memory may be freed right up until the process exits.
+    bool reserve_region()
+    {
+        if (movemm::budget::g_regionEnd.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+        if (_regionFailed) return false;
+
+        auto ptr = reserve_address_space(region_bytes + region_alignment);
+        if (!ptr)
+        {
+            _regionFailed = true;
+            return false;
+        }
+
+        auto start = (reinterpret_cast<uintptr_t>(ptr) + region_alignment - 1) &
+                     ~uintptr_t(region_alignment - 1);
+        movemm::budget::g_regionStart.store(start, std::memory_order_relaxed);
+        movemm::budget::g_regionEnd.store(
+            start + region_bytes, std::memory_order_release);
+        return true;
+    }
+
+    // Called under _regionLock
+    bool add_arena(movemm_budget_category_t category)
+    {
+        if (!reserve_region()) return false;
+
+        auto start = movemm::budget::g_regionStart.load(
+                         std::memory_order_relaxed) +
+                     category * category_region_bytes;
+        return mi_manage_os_memory_ex(reinterpret_cast<void*>(start),
+            category_region_bytes, false, false, true, -1, true,
+            &_arenas[category]);
+    }
+
+    bool arena_for(movemm_budget_category_t category, mi_arena_id_t& out)
+    {
+        auto& state = _arenaStates[category];
+        auto current = state.load(std::memory_order_acquire);
+        if (current == arena_unset)
+        {
+            std::lock_guard<std::mutex> lock(_regionLock);
+            current = state.load(std::memory_order_relaxed);
+            if (current == arena_unset)
+            {
+                current = add_arena(category) ? arena_ready : arena_failed;
+                state.store(current, std::memory_order_release);
+            }
+        }
+
+        if (current != arena_ready) return false;
+        out = _arenas[category];
+        return true;
+    }
+
+    thread_local mi_heap_t* t_heaps[max_categories] = {};
+}  // namespace
+
+namespace movemm
+{
+    namespace budget
+    {
+        movemm_budget_category_t validate(movemm_budget_category_t category)
+        {
+            return is_valid(category) ? category : MOVEMM_BUDGET_NONE;
+        }
+
+        void add(movemm_budget_category_t category, int64_t bytes)
+        {
+            auto accumulator = accumulator_for_thread();
+            if (!accumulator)
+            {
+                merge(category, bytes);
+                return;
+            }
+
+            // Emptied before merging, since the soft limit callback may
+            // allocate and come back here
+            auto& pending = accumulator->pending[category];
+            auto value = pending.load(std::memory_order_relaxed) + bytes;
+            if (value >= merge_threshold || value <= -merge_threshold)
+            {
+                pending.store(0, std::memory_order_relaxed);
+                merge(category, value);
+                return;
+            }
+            pending.store(value, std::memory_order_relaxed);
+        }
+
+        // Reports the usage as it is now, which may have moved on since the
+        // limit was crossed
+        void deliver_deferred()
+        {
+            while (t_deferredCategories)
+            {
+                movemm_budget_category_t category = 0;
+                while (!(t_deferredCategories & (uint64_t(1) << category)))
+                {
+                    ++category;
+                }
+                t_deferredCategories &= ~(uint64_t(1) << category);
+
+                auto& entry = _categories[category];
+                notify(category, entry.usage.load(std::memory_order_relaxed),
+                    int64_t(entry.softLimit.load(std::memory_order_relaxed)));
+            }
+        }
+
+        bool fits(movemm_budget_category_t category, size_t bytes)
+        {
+            auto& entry = _categories[category];
+            auto limit = entry.hardLimit.load(std::memory_order_relaxed);
+            if (!limit) return true;
+
+            auto usage = entry.usage.load(std::memory_order_relaxed);
+            if (auto accumulator = accumulator_for_thread())
+            {
+                usage += accumulator->pending[category].load(
+                    std::memory_order_relaxed);
+            }
+            if (usage < 0) usage = 0;
+
+            if (bytes <= limit && size_t(usage) <= limit - bytes) return true;
+
+            entry.failedAllocations.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // mimalloc deletes the thread's heaps when it exits.  Their pages
+        // stay in the category's arena, where only its heaps can reuse them.
+        mi_heap_t* thread_heap(movemm_budget_category_t category)
+        {
+            auto& heap = t_heaps[category];
+            if (!heap) heap = new_heap(category);
+            return heap;
+        }
+
+        mi_heap_t* new_heap(movemm_budget_category_t category)
+        {
+            mi_arena_id_t arena;
+            return arena_for(category, arena) ? mi_heap_new_in_arena(arena)
+                                              : 0;
+        }
+    }  // namespace budget
+}  // namespace movemm
+
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_register(
+    const char* name)
+{
+    std::lock_guard<std::mutex> lock(_categoryLock);
+    auto count = _categoryCount.load(std::memory_order_relaxed);
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        if (!strncmp(_categories[i].name, name, max_name_length))
+        {
+            return i;
+        }
+    }
+    if (count == max_categories) return MOVEMM_BUDGET_NONE;
+
+    strncpy(_categories[count].name, name, max_name_length);
+    _categoryCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+MOVEMM_EXPORT const char* movemm_budget_get_name(
+    movemm_budget_category_t category)
+{
+    return is_valid(category) ? _categories[category].name : 0;
+}
+
+// Anything that isn't a registered category leaves the thread uncharged
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_set_thread_category(
+    movemm_budget_category_t category)
+{
+    auto previous = movemm::budget::t_category;
+    movemm::budget::t_category = movemm::budget::validate(category);
+    return previous;
+}
+
+MOVEMM_EXPORT movemm_budget_category_t movemm_budget_get_thread_category()
+{
+    return movemm::budget::t_category;
+}
+
+MOVEMM_EXPORT void movemm_budget_set_limits(
+    movemm_budget_category_t category, size_t soft_limit, size_t hard_limit)
+{
+    if (!is_valid(category)) return;
+
+    auto& entry = _categories[category];
+    entry.softLimit.store(soft_limit, std::memory_order_relaxed);
+    entry.hardLimit.store(hard_limit, std::memory_order_relaxed);
+}
+
+MOVEMM_EXPORT void movemm_budget_set_soft_limit_callback(
+    movemm_budget_category_t category, movemm_budget_limit_cb_t callback,
+    void* user_data)
+{
+    if (!is_valid(category)) return;
+
+    std::lock_guard<std::mutex> lock(_categoryLock);
+    _categories[category].callback = callback;
+    _categories[category].userData = user_data;
+}
+
+MOVEMM_EXPORT void movemm_budget_get_statistics(
+    movemm_budget_category_t category, movemm_budget_statistics_t* statistics)
+{
+    *statistics = {};
+    if (!is_valid(category)) return;
+
+    auto& entry = _categories[category];
+    int64_t usage;
+    {
+        std::lock_guard<std::mutex> registry(_registryLock);
+        usage = entry.usage.load(std::memory_order_relaxed);
+        for (auto accumulator = _accumulators; accumulator;
+             accumulator = accumulator->next)
+        {
+            usage +=
+                accumulator->pending[category].load(std::memory_order_relaxed);
+        }
+    }
+
+    statistics->usage = usage > 0 ? size_t(usage) : 0;
+    statistics->soft_limit = entry.softLimit.load(std::memory_order_relaxed);
+    statistics->hard_limit = entry.hardLimit.load(std::memory_order_relaxed);
+    statistics->soft_limit_exceeded =
+        entry.softLimitExceeded.load(std::memory_order_relaxed);
+    statistics->failed_allocations =
+        entry.failedAllocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mimalloc.h>
+#include <movemm/memory-allocator.h>
+
+// Allocation hooks for memory budgets.  Like the profiler's, these are inlined
+// into the allocation functions: allocating costs one thread_local check
+// while the thread has no budget scope.  Charged allocations come from heaps
+// in a range of address space reserved for their category, so a free finds
+// the category from the pointer alone, without a lookup or a lock.
+namespace movemm
+{
+    namespace budget
+    {
+        // The category allocations on this thread are charged to
+        inline thread_local movemm_budget_category_t t_category =
+            MOVEMM_BUDGET_NONE;
+
+        // Every category's range, one after the other, set once the first
+        // category is used.  Empty until then.
+        inline std::atomic<uintptr_t> g_regionStart = {0};
+        inline std::atomic<uintptr_t> g_regionEnd = {0};
+
+        // Each category's share of the address space, which also caps how
+        // much it can have charged at once
+        constexpr size_t category_region_shift = sizeof(void*) == 8 ? 33 : 24;
+
+        // Soft limit callbacks are held back while this is set, and the
+        // categories that went over their limit are marked in the mask
+        inline thread_local uint32_t t_deferDepth = 0;
+        inline thread_local uint64_t t_deferredCategories = 0;
+
+        static_assert(MOVEMM_BUDGET_MAX_CATEGORIES <= 64,
+            "Deferred categories must fit a mask");
+
+        void deliver_deferred();
+
+        // The category if it is registered, otherwise none
+        movemm_budget_category_t validate(movemm_budget_category_t category);
+
+        // Adds to the calling thread's accumulator for the category
+        void add(movemm_budget_category_t category, int64_t bytes);
+
+        // Whether allocating `bytes` more keeps the category under its hard
+        // limit.  Counts a failed allocation when it doesn't.
+        bool fits(movemm_budget_category_t category, size_t bytes);
+
+        // The calling thread's heap for the category, created on first use.
+        // Null if the category's range couldn't be set up, in which case its
+        // allocations go uncharged.
+        mi_heap_t* thread_heap(movemm_budget_category_t category);
+
+        // A new heap in the category's range, or null
+        mi_heap_t* new_heap(movemm_budget_category_t category);
+
+        inline movemm_budget_category_t category_of(const void* ptr)
+        {
+            auto start = g_regionStart.load(std::memory_order_relaxed);
+            auto offset = reinterpret_cast<uintptr_t>(ptr) - start;
+            if (offset >= g_regionEnd.load(std::memory_order_relaxed) - start)
+            {
+                return MOVEMM_BUDGET_NONE;
+            }
+            return movemm_budget_category_t(offset >> category_region_shift);
+        }
+
+        inline bool allow_allocation(size_t bytes)
+        {
+            return !t_category || fits(t_category, bytes);
+        }
+
+        // The heap the thread's allocations come from, or null for
+        // mimalloc's default
+        inline mi_heap_t* allocation_heap()
+        {
+            return t_category ? thread_heap(t_category) : 0;
+        }
+
+        // Both return the bytes charged or credited
+        inline size_t record_allocation(void* ptr)
+        {
+            if (!t_category) return 0;
+            auto category = category_of(ptr);
+            if (!category) return 0;
+
+            auto bytes = mi_usable_size(ptr);
+            add(category, int64_t(bytes));
+            return bytes;
+        }
+
+        // Blocks from a single heap with a single size all share a range
+        // and a usable size
+        inline void record_allocation_batch(void* const* ptrs, size_t count)
+        {
+            if (!t_category || !count) return;
+            auto category = category_of(ptrs[0]);
+            if (!category) return;
+
+            add(category, int64_t(mi_usable_size(ptrs[0]) * count));
+        }
+
+        inline size_t record_free(void* ptr)
+        {
+            auto category = category_of(ptr);
+            if (!category) return 0;
+
+            auto bytes = mi_usable_size(ptr);
+            add(category, -int64_t(bytes));
+            return bytes;
+        }
+
+        // A resized block stays in its category, or moves into the scope's
+        // if it had none.  mimalloc resizes in place where it can, so a block
+        // changing category has to be copied to a heap in the new one's
+        // range instead.
+        class reallocation
+        {
+        public:
+            inline explicit reallocation(void* memory)
+                : _old(category_of(memory)),
+                  _category(_old ? _old : t_category),
+                  _oldBytes(_old ? mi_usable_size(memory) : 0)
+            {
+            }
+
+            inline movemm_budget_category_t category() const
+            {
+                return _category;
+            }
+
+            inline movemm_budget_category_t old_category() const
+            {
+                return _old;
+            }
+
+            inline size_t old_bytes() const
+            {
+                return _oldBytes;
+            }
+
+            inline bool moves() const
+            {
+                return _category != _old;
+            }
+
+            inline bool allow(size_t bytes)
+            {
+                return !_category || bytes <= _oldBytes ||
+                       fits(_category, bytes - _oldBytes);
+            }
+
+            // Returns the bytes charged for the new block
+            inline size_t complete(void* res)
+            {
+                if (!res) return 0;
+                if (_old) add(_old, -int64_t(_oldBytes));
+
+                auto category = category_of(res);
+                if (!category) return 0;
+
+                auto bytes = mi_usable_size(res);
+                add(category, int64_t(bytes));
+                return bytes;
+            }
+
+            reallocation(const reallocation&) = delete;
+            reallocation& operator=(const reallocation&) = delete;
+
+        private:
+            movemm_budget_category_t _old;
+            movemm_budget_category_t _category;
+            size_t _oldBytes;
+        };
+
+        // Swaps the thread's category for the lifetime of the scope
+        class category_scope
+        {
+        public:
+            inline explicit category_scope(movemm_budget_category_t category)
+                : _previous(t_category)
+            {
+                t_category = validate(category);
+            }
+
+            inline ~category_scope()
+            {
+                t_category = _previous;
+            }
+
+            category_scope(const category_scope&) = delete;
+            category_scope& operator=(const category_scope&) = delete;
+
+        private:
+            movemm_budget_category_t _previous;
+        };
+
+        // Set while the tagged heap is inside one of its own functions.  The
+        // thread's category is moved out of t_category, so the bookkeeping the
+        // tagged heap allocates through movemm_alloc isn't charged, and its
+        // pages are charged to this instead.  Soft limit callbacks are held
+        // back until the outermost scope ends, since the tagged heap may
+        // hold its locks and the callback may allocate from it.
+        inline thread_local movemm_budget_category_t t_internalCategory =
+            MOVEMM_BUDGET_NONE;
+
+        class internal_scope
+        {
+        public:
+            inline internal_scope()
+                : _category(t_category), _internalCategory(t_internalCategory)
+            {
+                if (_category) t_internalCategory = _category;
+                t_category = MOVEMM_BUDGET_NONE;
+                ++t_deferDepth;
+            }
+
+            inline ~internal_scope()
+            {
+                t_category = _category;
+                t_internalCategory = _internalCategory;
+                if (!--t_deferDepth && t_deferredCategories)
+                {
+                    deliver_deferred();
+                }
+            }
+
+            internal_scope(const internal_scope&) = delete;
+            internal_scope& operator=(const internal_scope&) = delete;
+
+        private:
+            movemm_budget_category_t _category;
+            movemm_budget_category_t _internalCategory;
+        };
+
+        // Gives the category back while the tagged heap calls back into the
+        // caller, such as when it runs destructors
+        class external_scope
+        {
+        public:
+            inline external_scope() : _category(t_category)
+            {
+                t_category = t_internalCategory;
+            }
+
+            inline ~external_scope()
+            {
+                t_category = _category;
+            }
+
+            external_scope(const external_scope&) = delete;
+            external_scope& operator=(const external_scope&) = delete;
+
+        private:
+            movemm_budget_category_t _category;
+        };
+    }  // namespace budget
+}  // namespace movemm
@@ -0,0 +1,158 @@
+#include <movemm/memory-allocator.h>
+#include "memory-pressure.hpp"
+#include "trace-recorder.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+
+#include <mimalloc.h>
+
+namespace
+{
+    // Guards the callbacks so each is always read with its user data.  They
+    // are copied out and called without it.
+    std::mutex _handlerLock;
+    movemm_pressure_cb_t _pressureCallback = 0;
+    void* _pressureUserData = 0;
+    movemm_oom_handler_t _oomHandler = 0;
+    void* _oomUserData = 0;
+
+    // Set while the handlers run on this thread, so that their own failed
+    // allocations return null rather than calling them again
+    thread_local bool t_relieving = false;
+
+    struct relieving_scope
+    {
+        relieving_scope()
+        {
+            t_relieving = true;
+        }
+
+        ~relieving_scope()
+        {
+            t_relieving = false;
+        }
+    };
+
+    void release_cached_memory(bool critical)
+    {
+        movemm_tagged_heap_release_pooled_pages();
+        mi_collect(critical);
+    }
+
+    void call_pressure_callback(movemm_memory_pressure_t level, size_t bytes)
+    {
+        movemm_pressure_cb_t callback;
+        void* userData;
+        {
+            std::lock_guard<std::mutex> lock(_handlerLock);
+            callback = _pressureCallback;
+            userData = _pressureUserData;
+        }
+        if (callback) callback(level, bytes, userData);
+    }
+
+    // Handed out by bumping _emergencyUsed, which never goes past the end
+    std::mutex _emergencyLock;
+    std::atomic<char*> _emergencyReserve = {0};
+    size_t _emergencyBytes = 0;
+    std::atomic_size_t _emergencyUsed = {0};
+
+    constexpr size_t emergency_alignment = alignof(std::max_align_t);
+}  // namespace
+
+namespace movemm
+{
+    namespace oom
+    {
+        bool relieve(size_t bytes, uint32_t attempt)
+        {
+            if (t_relieving) return false;
+            relieving_scope relieving;
+
+            // The tagged heap retries from inside its trace scope, and what
+            // the handlers allocate is theirs
+            movemm::trace::external_scope external;
+
+            if (attempt == 0)
+            {
+                release_cached_memory(true);
+                call_pressure_callback(MOVEMM_MEMORY_PRESSURE_CRITICAL, bytes);
+                return true;
+            }
+
+            movemm_oom_handler_t handler;
+            void* userData;
+            {
+                std::lock_guard<std::mutex> lock(_handlerLock);
+                handler = _oomHandler;
+                userData = _oomUserData;
+            }
+            return handler && handler(bytes, attempt - 1, userData) != 0;
+        }
+    }  // namespace oom
+}  // namespace movemm
+
+MOVEMM_EXPORT void movemm_set_pressure_callback(
+    movemm_pressure_cb_t callback, void* user_data)
+{
+    std::lock_guard<std::mutex> lock(_handlerLock);
+    _pressureCallback = callback;
+    _pressureUserData = user_data;
+}
+
+MOVEMM_EXPORT void movemm_set_oom_handler(
+    movemm_oom_handler_t handler, void* user_data)
+{
+    std::lock_guard<std::mutex> lock(_handlerLock);
+    _oomHandler = handler;
+    _oomUserData = user_data;
+}
+
+MOVEMM_EXPORT void movemm_signal_memory_pressure(
+    movemm_memory_pressure_t level)
+{
+    release_cached_memory(level == MOVEMM_MEMORY_PRESSURE_CRITICAL);
+    call_pressure_callback(level, 0);
+}
+
+// The region is written to up front, so its pages are committed before
+// anything runs out
+MOVEMM_EXPORT int movemm_reserve_emergency_memory(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_emergencyLock);
+    if (_emergencyReserve.load(std::memory_order_relaxed) || !bytes) return 0;
+
+    auto reserve =
+        static_cast<char*>(mi_malloc_aligned(bytes, emergency_alignment));
+    if (!reserve) return 0;
+    memset(reserve, 0, bytes);
+
+    _emergencyBytes = bytes;
+    _emergencyReserve.store(reserve, std::memory_order_release);
+    return 1;
+}
+
+MOVEMM_EXPORT void* movemm_emergency_alloc(size_t bytes)
+{
+    auto reserve = _emergencyReserve.load(std::memory_order_acquire);
+    if (!reserve) return 0;
+
+    auto rounded =
+        (bytes + emergency_alignment - 1) & ~(emergency_alignment - 1);
+    auto used = _emergencyUsed.load(std::memory_order_relaxed);
+    do
+    {
+        if (rounded < bytes || rounded > _emergencyBytes - used) return 0;
+    } while (!_emergencyUsed.compare_exchange_weak(
+        used, used + rounded, std::memory_order_relaxed));
+    return reserve + used;
+}
+
+MOVEMM_EXPORT size_t movemm_get_emergency_memory_remaining()
+{
+    if (!_emergencyReserve.load(std::memory_order_acquire)) return 0;
+    return _emergencyBytes - _emergencyUsed.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Out of memory handling for the allocation functions.  The first attempt is
+// made inline as before, so a successful allocation pays a single null check.
+namespace movemm
+{
+    namespace oom
+    {
+        // Set while an allocation is made with locks held that the handlers
+        // may need.  Failures return null straight away and are only flagged,
+        // for the caller to handle once the locks are released.
+        inline thread_local uint32_t t_deferDepth = 0;
+        inline thread_local bool t_deferredFailure = false;
+
+        // Defers failures for the lifetime of the scope.  The enclosing
+        // scope's flag is put back when it ends, even if the allocation
+        // inside throws.
+        class defer_scope
+        {
+        public:
+            inline defer_scope() : _outer(t_deferredFailure)
+            {
+                t_deferredFailure = false;
+                ++t_deferDepth;
+            }
+
+            inline ~defer_scope()
+            {
+                --t_deferDepth;
+                t_deferredFailure = _outer;
+            }
+
+            // Whether an allocation failed inside the scope
+            inline bool failed() const
+            {
+                return t_deferredFailure;
+            }
+
+            defer_scope(const defer_scope&) = delete;
+            defer_scope& operator=(const defer_scope&) = delete;
+
+        private:
+            bool _outer;
+        };
+
+        // Frees what it can for an allocation of `bytes` that has failed
+        // `attempt` times, and returns whether it is worth trying again
+        bool relieve(size_t bytes, uint32_t attempt);
+
+        template <typename Fn>
+        inline void* retry(size_t bytes, Fn&& allocate)
+        {
+            if (t_deferDepth)
+            {
+                t_deferredFailure = true;
+                return 0;
+            }
+
+            for (uint32_t attempt = 0; relieve(bytes, attempt); ++attempt)
+            {
+                if (auto res = allocate()) return res;
+            }
+            return 0;
+        }
+
+        // Allocates with `allocate`, which may take locks, and handles any
+        // failure inside it after it has returned.  A null result with no
+        // failure behind it, such as a budget's hard limit, isn't retried.
+        template <typename Fn>
+        inline void* retry_unlocked(size_t bytes, Fn&& allocate)
+        {
+            for (uint32_t attempt = 0;; ++attempt)
+            {
+                void* res;
+                bool deferred;
+                {
+                    defer_scope scope;
+                    res = allocate();
+                    deferred = scope.failed();
+                }
+                if (res || !deferred) return res;
+
+                // Still inside someone else's locks, so the failure is theirs
+                if (t_deferDepth)
+                {
+                    t_deferredFailure = true;
+                    return res;
+                }
+                if (!relieve(bytes, attempt)) return res;
+            }
+        }
+    }  // namespace oom
+}  // namespace movemm
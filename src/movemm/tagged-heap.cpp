@@ -1,12 +1,27 @@
 #include <movemm/memory-allocator.h>
 
+#include <atomic>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <stdexcept>
 #include <unordered_map>
 #include <vector>
 
 #include <movemm/stl_allocator.hpp>
+#include "heap-profiler.hpp"
+#include "memory-budget.hpp"
+#include "memory-pressure.hpp"
+#include "trace-recorder.hpp"
+
+#if defined(MOVEMM_UNIX)
+#include <sys/mman.h>
+#elif defined(MOVEMM_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 template <typename T>
 using vec = std::vector<T, movemm::stl_allocator<T>>;
@@ -25,202 +40,1445 @@ struct registered_tagged_heap_destructor
     {
     }
 
-    ~registered_tagged_heap_destructor()
-    {
-        destructor(ptr);
-    }
-
     void* ptr;
     movemm_destructor_cb_t destructor;
 };
 
+constexpr size_t tagged_heap_page_size = MOVEMM_TAGGED_HEAP_PAGE_SIZE;
+constexpr size_t tagged_heap_default_alignment =
+    MOVEMM_TAGGED_HEAP_DEFAULT_ALIGNMENT;
+
+constexpr bool is_valid_alignment(size_t alignment)
+{
+    return alignment && !(alignment & (alignment - 1));
+}
+
+enum class tagged_heap_page_backing : uint8_t
+{
+    // Allocated through movemm_alloc with the page header inline
+    heap,
+
+    // 2MB aligned anonymous mapping advised with MADV_HUGEPAGE
+    transparent_huge_pages,
+
+    // Explicit huge pages (MAP_HUGETLB or MEM_LARGE_PAGES)
+    huge_pages,
+};
+
 struct tagged_heap_page
 {
-    void* allocate(size_t bytes)
+    // Bump allocates `bytes` from the page, aligning the returned address (not
+    // the size) to `alignment`, which must be a power of two.  Returns 0 if
+    // the allocation would run past the end of the page.
+    void* allocate(size_t bytes, size_t alignment)
     {
+        auto base = reinterpret_cast<uintptr_t>(buffer);
+        auto offset = nextOffset.load(std::memory_order_relaxed);
+        auto start = (base + offset + alignment - 1) & ~(alignment - 1);
+        auto end = base + capacity;
+
         // Don't allow it to allocate beyond the page boundary
-        if (nextOffset + bytes >= allocationSize) return 0;
+        if (start > end || bytes > end - start) return 0;
+
+        nextOffset.store(start + bytes - base, std::memory_order_relaxed);
+        return reinterpret_cast<void*>(start);
+    }
+
+    // Grows or shrinks the page's most recent allocation.  Returns false if
+    // ptr isn't the most recent allocation or the page can't fit new bytes.
+    bool resize(void* ptr, size_t oldBytes, size_t newBytes)
+    {
+        auto base = reinterpret_cast<uintptr_t>(buffer);
+        auto start = reinterpret_cast<uintptr_t>(ptr);
+        auto offset = nextOffset.load(std::memory_order_relaxed);
+        if (start < base || start - base + oldBytes != offset) return false;
+        if (newBytes > capacity - (start - base)) return false;
 
-        auto ptr = buffer + nextOffset;
+        nextOffset.store(start + newBytes - base, std::memory_order_relaxed);
+        return true;
+    }
 
-        // Always 8 byte aligned
-        auto mod = bytes % 8;
-        nextOffset += mod ? 8 - mod : 0;
+    void reset(size_t offset = 0)
+    {
+        nextOffset.store(offset, std::memory_order_relaxed);
+    }
 
-        return ptr;
+    size_t used() const
+    {
+        return nextOffset.load(std::memory_order_relaxed);
     }
 
-    size_t nextOffset;
+    // Heap backed pages keep this header at the front of the page.  Huge page
+    // backed pages keep it out of line so that the whole mapping is usable.
+    char* buffer;
+
+    // Only the owning thread moves this, but statistics read it from others
+    std::atomic_size_t nextOffset;
+
+    // Usable bytes at buffer
+    size_t capacity;
+
+    // Bytes reserved for the page, including an inline header
     size_t allocationSize;
-    char buffer[];
+
+    tagged_heap_page_backing backing;
+
+    // Charged with the whole allocationSize while a tag holds the page
+    movemm_budget_category_t budgetCategory;
 };
 
-constexpr size_t tagged_heap_page_size = 2 * 1024 * 1024;
-constexpr size_t compute_required_page_size_for_alloc(size_t alloc)
+struct alignas(tagged_heap_default_alignment) tagged_heap_inline_page
+    : tagged_heap_page
 {
-    // We store the tagged_heap_page at the head of the page, so we need to
-    // ensure that it fits.
-    return (((sizeof(tagged_heap_page) + alloc) / tagged_heap_page_size) + 1) *
+};
+
+// Far beyond anything a page can be acquired for, and small enough that the
+// page size can be worked out without overflowing
+constexpr size_t tagged_heap_max_allocation = SIZE_MAX / 4;
+
+// Returns 0 for allocations too large for any page
+constexpr size_t compute_required_page_size_for_alloc(
+    size_t alloc, size_t alignment)
+{
+    if (alloc > tagged_heap_max_allocation ||
+        alignment > tagged_heap_max_allocation)
+    {
+        return 0;
+    }
+
+    // Heap backed pages store the tagged_heap_page at the head of the page, so
+    // we need to ensure that it fits along with the worst case alignment
+    // padding.  The buffer itself is always aligned to the default alignment.
+    auto padding = alignment > tagged_heap_default_alignment
+                       ? alignment - tagged_heap_default_alignment
+                       : 0;
+    auto required = sizeof(tagged_heap_inline_page) + padding + alloc;
+    return ((required + tagged_heap_page_size - 1) / tagged_heap_page_size) *
            tagged_heap_page_size;
 }
 
-// Each temp page is 1MB
-struct tagged_heap_tag_storage
-{
-    ~tagged_heap_tag_storage()
+static_assert(compute_required_page_size_for_alloc(SIZE_MAX, 1) == 0,
+    "An allocation that can't fit any page needs no page");
+static_assert(compute_required_page_size_for_alloc(0, 1) ==
+                  tagged_heap_page_size,
+    "An empty allocation needs a single page");
+static_assert(compute_required_page_size_for_alloc(
+                  tagged_heap_page_size - sizeof(tagged_heap_inline_page),
+                  tagged_heap_default_alignment) == tagged_heap_page_size,
+    "An allocation that exactly fills a page needs a single page");
+static_assert(compute_required_page_size_for_alloc(
+                  tagged_heap_page_size - sizeof(tagged_heap_inline_page) + 1,
+                  tagged_heap_default_alignment) == 2 * tagged_heap_page_size,
+    "An allocation one byte larger than a page needs two pages");
+
+// Reserves and releases the memory behind tagged heap pages.  By default pages
+// come from movemm_alloc.  When huge pages are enabled they are mapped
+// directly from the OS on a huge page boundary, trying explicit huge pages
+// first, then transparent huge pages, and finally falling back to the heap.
+// Each kind of failure is remembered so we don't keep paying for syscalls that
+// can't succeed.
+class tagged_heap_page_source
+{
+public:
+    tagged_heap_page* create(size_t allocSize)
+    {
+        tagged_heap_page* page = 0;
+        if (_hugePagesEnabled.load(std::memory_order_relaxed))
+        {
+            page = create_huge(allocSize);
+            if (!page)
+            {
+                _hugePageFallbacks.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        if (!page)
+        {
+            auto ptr = movemm_alloc(allocSize);
+            if (!ptr) return 0;
+            auto inlinePage = new (ptr) tagged_heap_inline_page();
+            inlinePage->buffer = reinterpret_cast<char*>(inlinePage + 1);
+            inlinePage->capacity =
+                allocSize - sizeof(tagged_heap_inline_page);
+            inlinePage->backing = tagged_heap_page_backing::heap;
+            page = inlinePage;
+        }
+
+        page->reset();
+        page->allocationSize = allocSize;
+        _livePages[size_t(page->backing)].fetch_add(
+            1, std::memory_order_relaxed);
+        return page;
+    }
+
+    void destroy(tagged_heap_page* page)
+    {
+        _livePages[size_t(page->backing)].fetch_sub(
+            1, std::memory_order_relaxed);
+        if (page->backing == tagged_heap_page_backing::heap)
+        {
+            movemm_free(page);
+            return;
+        }
+
+        unmap(page->buffer, page->allocationSize);
+        movemm_free(page);
+    }
+
+    void set_huge_pages_enabled(bool enabled)
+    {
+        _hugePagesEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool huge_pages_enabled() const
+    {
+        return _hugePagesEnabled.load(std::memory_order_relaxed);
+    }
+
+    void get_stats(movemm_tagged_heap_backing_stats_t* stats) const
+    {
+        stats->heap_pages =
+            _livePages[size_t(tagged_heap_page_backing::heap)].load(
+                std::memory_order_relaxed);
+        stats->transparent_huge_pages =
+            _livePages[size_t(
+                           tagged_heap_page_backing::transparent_huge_pages)]
+                .load(std::memory_order_relaxed);
+        stats->huge_pages =
+            _livePages[size_t(tagged_heap_page_backing::huge_pages)].load(
+                std::memory_order_relaxed);
+        stats->huge_page_fallbacks =
+            _hugePageFallbacks.load(std::memory_order_relaxed);
+    }
+
+private:
+    tagged_heap_page* create_huge(size_t allocSize)
+    {
+        auto backing = tagged_heap_page_backing::huge_pages;
+        void* buffer = 0;
+
+        if (!_hugeTlbUnavailable.load(std::memory_order_relaxed))
+        {
+            buffer = map_explicit_huge_pages(allocSize);
+            if (!buffer)
+            {
+                _hugeTlbUnavailable.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        if (!buffer && !_thpUnavailable.load(std::memory_order_relaxed))
+        {
+            backing = tagged_heap_page_backing::transparent_huge_pages;
+            buffer = map_transparent_huge_pages(allocSize);
+            if (!buffer)
+            {
+                _thpUnavailable.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        if (!buffer) return 0;
+
+        auto header = movemm_alloc(sizeof(tagged_heap_page));
+        if (!header)
+        {
+            unmap(buffer, allocSize);
+            return 0;
+        }
+        auto page = new (header) tagged_heap_page();
+        page->buffer = static_cast<char*>(buffer);
+        page->capacity = allocSize;
+        page->backing = backing;
+        return page;
+    }
+
+#if defined(MOVEMM_UNIX)
+    static void* map_explicit_huge_pages(size_t bytes)
+    {
+#if defined(MAP_HUGETLB)
+        auto ptr = mmap(0, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) return ptr;
+#endif
+        return 0;
+    }
+
+    static void* map_transparent_huge_pages(size_t bytes)
+    {
+#if defined(MADV_HUGEPAGE)
+        // Over-reserve so we can trim the mapping down to a huge page boundary
+        auto reserved = bytes + tagged_heap_page_size;
+        auto ptr = mmap(0, reserved, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) return 0;
+
+        auto raw = reinterpret_cast<uintptr_t>(ptr);
+        auto aligned = (raw + tagged_heap_page_size - 1) &
+                       ~(uintptr_t(tagged_heap_page_size) - 1);
+        auto head = aligned - raw;
+        auto tail = reserved - head - bytes;
+        if (head) munmap(ptr, head);
+        if (tail) munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+
+        auto res = reinterpret_cast<void*>(aligned);
+        if (madvise(res, bytes, MADV_HUGEPAGE) == 0) return res;
+
+        munmap(res, bytes);
+#endif
+        return 0;
+    }
+
+    static void unmap(void* ptr, size_t bytes)
+    {
+        munmap(ptr, bytes);
+    }
+#elif defined(MOVEMM_WINDOWS)
+    static void* map_explicit_huge_pages(size_t bytes)
+    {
+        // Requires SeLockMemoryPrivilege; fails cleanly without it
+        auto largePage = GetLargePageMinimum();
+        if (!largePage || bytes % largePage) return 0;
+        return VirtualAlloc(0, bytes,
+            MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+
+    static void* map_transparent_huge_pages(size_t)
+    {
+        // Windows has no transparent huge pages
+        return 0;
+    }
+
+    static void unmap(void* ptr, size_t)
+    {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+#endif
+
+private:
+    std::atomic_bool _hugePagesEnabled = {false};
+    std::atomic_bool _hugeTlbUnavailable = {false};
+    std::atomic_bool _thpUnavailable = {false};
+    std::atomic_size_t _hugePageFallbacks = {0};
+    std::atomic_size_t _livePages[3] = {};
+};
+
+static tagged_heap_page_source& _page_source()
+{
+    static tagged_heap_page_source s_PageSource;
+    return s_PageSource;
+}
+
+// Pages released by freed tags are parked here instead of being handed back to
+// mimalloc, so that the next frame picks them up already faulted in.  The pool
+// is a bounded MPMC ring (Vyukov), which means neither side takes a lock and a
+// page is never dereferenced by the pool itself, so trimming can free pages
+// while other threads are pushing and popping.  Only standard sized pages are
+// pooled; oversized pages always go straight back to the allocator.
+class tagged_heap_page_pool
+{
+public:
+    // Hard upper bound on the number of pages the ring can hold (2GB).  The
+    // configurable limit is clamped to this.
+    static constexpr size_t capacity = 1024;
+    static constexpr size_t default_limit = 64 * 1024 * 1024;
+
+    tagged_heap_page_pool()
+        : _limit(default_limit / tagged_heap_page_size),
+          _size(0),
+          _enqueuePos(0),
+          _dequeuePos(0)
+    {
+        // Make sure the page source outlives the pool, since the pool releases
+        // its pages to it on destruction.
+        _page_source();
+
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+            _cells[i].page = 0;
+        }
+    }
+
+    ~tagged_heap_page_pool()
+    {
+        trim(0);
+    }
+
+public:
+    tagged_heap_page* acquire(size_t allocSize)
+    {
+        tagged_heap_page* page = 0;
+        if (allocSize == tagged_heap_page_size)
+        {
+            page = pop();
+        }
+
+        if (page)
+        {
+            page->reset();
+            return page;
+        }
+        return _page_source().create(allocSize);
+    }
+
+    void release(tagged_heap_page* page)
+    {
+        if (page->allocationSize == tagged_heap_page_size)
+        {
+            // Reserve a slot against the high-water mark before pushing so the
+            // pool can never hold more than the limit.
+            auto limit = _limit.load(std::memory_order_relaxed);
+            if (_size.fetch_add(1, std::memory_order_relaxed) < limit &&
+                push(page))
+            {
+                return;
+            }
+            _size.fetch_sub(1, std::memory_order_relaxed);
+        }
+        _page_source().destroy(page);
+    }
+
+    // Frees pooled pages until no more than `pages` remain
+    void trim(size_t pages)
+    {
+        while (_size.load(std::memory_order_relaxed) > pages)
+        {
+            auto page = pop();
+            if (!page) break;
+            _page_source().destroy(page);
+        }
+    }
+
+    void set_limit(size_t bytes)
+    {
+        auto pages = bytes / tagged_heap_page_size;
+        if (pages > capacity) pages = capacity;
+        _limit.store(pages, std::memory_order_relaxed);
+        trim(pages);
+    }
+
+    size_t limit() const
+    {
+        return _limit.load(std::memory_order_relaxed) * tagged_heap_page_size;
+    }
+
+    size_t pooled_pages() const
+    {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    size_t pooled_storage() const
+    {
+        return pooled_pages() * tagged_heap_page_size;
+    }
+
+private:
+    bool push(tagged_heap_page* page)
+    {
+        auto pos = _enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = _cells[pos & (capacity - 1)];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (_enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.page = page;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Full
+                return false;
+            }
+            else
+            {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    tagged_heap_page* pop()
+    {
+        auto pos = _dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = _cells[pos & (capacity - 1)];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (_dequeuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    auto page = cell.page;
+                    cell.sequence.store(
+                        pos + capacity, std::memory_order_release);
+                    _size.fetch_sub(1, std::memory_order_relaxed);
+                    return page;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Empty
+                return 0;
+            }
+            else
+            {
+                pos = _dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    static_assert((capacity & (capacity - 1)) == 0,
+        "tagged_heap_page_pool capacity must be a power of two");
+
+    struct cell
+    {
+        std::atomic_size_t sequence;
+        tagged_heap_page* page;
+    };
+
+    cell _cells[capacity];
+    std::atomic_size_t _limit;
+    std::atomic_size_t _size;
+    alignas(64) std::atomic_size_t _enqueuePos;
+    alignas(64) std::atomic_size_t _dequeuePos;
+};
+
+static tagged_heap_page_pool& _page_pool()
+{
+    static tagged_heap_page_pool s_PagePool;
+    return s_PagePool;
+}
+
+// Cumulative counters for a single thread.  Only the owning thread writes
+// them, so an update is a relaxed load and store rather than a locked
+// read-modify-write, and readers sum every thread's shard.
+struct tagged_heap_counters
+{
+    static inline void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value,
+            std::memory_order_relaxed);
+    }
+
+    void accumulate(movemm_tagged_heap_statistics_t& stats) const
+    {
+        stats.allocations += allocations.load(std::memory_order_relaxed);
+        stats.allocated_bytes +=
+            allocatedBytes.load(std::memory_order_relaxed);
+        stats.destructors_registered +=
+            destructorsRegistered.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> allocations = {0};
+    std::atomic<uint64_t> allocatedBytes = {0};
+    std::atomic<uint64_t> destructorsRegistered = {0};
+};
+
+// Destructor lists may run on any thread, so this one is shared.  It is only
+// bumped once per list.
+static std::atomic<uint64_t>& _destructors_run()
+{
+    static std::atomic<uint64_t> s_DestructorsRun = {0};
+    return s_DestructorsRun;
+}
+
+using tagged_heap_destructor_list = vec<registered_tagged_heap_destructor>;
+
+// Runs destructors in reverse registration order and empties the list
+inline void run_tagged_heap_destructors(tagged_heap_destructor_list& list)
+{
+    if (list.empty()) return;
+
+    // Destructors are the caller's code, so what they allocate and free is
+    // traced and charged as theirs
+    movemm::trace::external_scope external;
+    movemm::budget::external_scope budget;
+    for (auto it = list.rbegin(); it != list.rend(); ++it)
+    {
+        it->destructor(it->ptr);
+    }
+    _destructors_run().fetch_add(list.size(), std::memory_order_relaxed);
+    list.clear();
+}
+
+// Identifies a storage's current contents for markers.  Zero is never used.
+inline uint64_t next_tagged_heap_storage_id()
+{
+    static std::atomic<uint64_t> s_NextId = {1};
+    return s_NextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+// A single thread's pages and destructors for a single tag.  Each temp page
+// is 2MB.
+struct tagged_heap_tag_storage
+{
+    tagged_heap_tag_storage() = default;
+    tagged_heap_tag_storage(const tagged_heap_tag_storage&) = delete;
+
+    tagged_heap_tag_storage(tagged_heap_tag_storage&& rhs)
+        : _pages(std::move(rhs._pages)),
+          _nextPage(rhs._nextPage),
+          _takenPages(rhs._takenPages),
+          _destructors(std::move(rhs._destructors)),
+          _id(rhs._id)
+    {
+        rhs._pages.clear();
+        rhs._nextPage = 0;
+        rhs._takenPages = 0;
+        rhs._destructors.clear();
+        rhs._id = 0;
+    }
+
+    ~tagged_heap_tag_storage()
+    {
+        // Anything still registered must be destroyed before the memory it
+        // lives in goes away
+        run_tagged_heap_destructors(_destructors);
+
+        auto& pool = _page_pool();
+        for (auto& it : _pages)
+        {
+            if (it->budgetCategory)
+            {
+                movemm::budget::add(
+                    it->budgetCategory, -int64_t(it->allocationSize));
+                it->budgetCategory = MOVEMM_BUDGET_NONE;
+            }
+            pool.release(it);
+        }
+    }
+
+    tagged_heap_tag_storage& operator=(const tagged_heap_tag_storage&) =
+        delete;
+    tagged_heap_tag_storage& operator=(tagged_heap_tag_storage&&) = delete;
+
+    // Bumps from the current page without touching the page list.  Returns 0
+    // when the current page is full or there isn't one yet, in which case the
+    // caller must go through allocate() with the owning TLS locked.
+    inline void* try_allocate(size_t bytes, size_t alignment)
+    {
+        if (_nextPage < _takenPages)
+        {
+            return _pages[_nextPage]->allocate(bytes, alignment);
+        }
+        return 0;
+    }
+
+    // Rewinds the storage to its first page while keeping every page.  Pages
+    // past _nextPage are treated as empty and reset as allocation reaches them.
+    // The kept pages are credited here and charged again as allocation
+    // reaches them, to whichever category takes them then.
+    void reset()
+    {
+        for (auto page : _pages)
+        {
+            if (page->budgetCategory)
+            {
+                movemm::budget::add(
+                    page->budgetCategory, -int64_t(page->allocationSize));
+                page->budgetCategory = MOVEMM_BUDGET_NONE;
+            }
+        }
+        _nextPage = 0;
+        _takenPages = 0;
+        if (!_pages.empty()) _pages[0]->reset();
+
+        // Markers taken before the reset no longer describe these pages
+        _id = next_tagged_heap_storage_id();
+    }
+
+    movemm_tagged_heap_marker_t get_marker() const
+    {
+        movemm_tagged_heap_marker_t res;
+        res.storage = _id;
+        res.page = _nextPage;
+        res.offset = current_offset();
+        res.destructors = _destructors.size();
+        return res;
+    }
+
+    // A marker can only be rewound to if it was taken from this storage since
+    // its last reset and nothing has already rewound past it.
+    bool can_rewind(const movemm_tagged_heap_marker_t& marker) const
+    {
+        if (marker.storage != _id || marker.destructors > _destructors.size())
+        {
+            return false;
+        }
+        return marker.page < _nextPage ||
+               (marker.page == _nextPage && marker.offset <= current_offset());
+    }
+
+    bool has_destructors_after(const movemm_tagged_heap_marker_t& marker) const
+    {
+        return _destructors.size() > marker.destructors;
+    }
+
+    tagged_heap_destructor_list take_destructors_after(
+        const movemm_tagged_heap_marker_t& marker)
+    {
+        auto first = _destructors.begin() + marker.destructors;
+        tagged_heap_destructor_list res(first, _destructors.end());
+        _destructors.erase(first, _destructors.end());
+        return res;
+    }
+
+    // Pages past the marker's are kept and reset lazily, as with reset()
+    void rewind(const movemm_tagged_heap_marker_t& marker)
+    {
+        _nextPage = marker.page;
+        if (_nextPage < _pages.size())
+        {
+            _pages[_nextPage]->reset(marker.offset);
+        }
+    }
+
+    // Only the current page can be resized in place, since that is the only
+    // one the next allocation could come from.
+    inline bool try_resize(void* ptr, size_t oldBytes, size_t newBytes)
+    {
+        return _nextPage < _takenPages &&
+               _pages[_nextPage]->resize(ptr, oldBytes, newBytes);
+    }
+
+    // Returns 0 if the allocation is too large for any page, or a new page
+    // would take the thread's budget category over its hard limit
+    inline void* allocate(size_t bytes, size_t alignment)
+    {
+        // Oversized requests fail before any page is taken
+        auto allocSize = compute_required_page_size_for_alloc(bytes, alignment);
+        if (!allocSize) return 0;
+
+        void* res = 0;
+
+        while (!res)
+        {
+            // Pages aren't charged to anything until a tag takes them, and
+            // are then charged as a whole
+            if (_nextPage >= _takenPages)
+            {
+                auto category = movemm::budget::t_internalCategory;
+                tagged_heap_page* page;
+                if (_nextPage < _pages.size())
+                {
+                    // A page kept from before the last reset
+                    page = _pages[_nextPage];
+                    if (category && !movemm::budget::fits(
+                                        category, page->allocationSize))
+                    {
+                        return 0;
+                    }
+                    page->reset();
+                }
+                else
+                {
+                    // The next page is the smallest multiple of the page size
+                    // that can contain the allocation
+                    if (category && !movemm::budget::fits(category, allocSize))
+                    {
+                        return 0;
+                    }
+
+                    // Grab the next page, preferring one from the pool
+                    page = _page_pool().acquire(allocSize);
+                    if (!page) return 0;
+                    _pages.push_back(page);
+                }
+
+                auto pageBytes = int64_t(page->allocationSize);
+                page->budgetCategory = category;
+                if (category) movemm::budget::add(category, pageBytes);
+                _takenPages = _nextPage + 1;
+            }
+
+            // Attempt to allocate from the latest page
+            auto& tgPage = _pages[_nextPage];
+            res = tgPage->allocate(bytes, alignment);
+
+            // If we failed to allocate, move to the next page
+            if (!res && ++_nextPage < _takenPages)
+            {
+                _pages[_nextPage]->reset();
+            }
+        }
+        return res;
+    }
+
+    // Every page before _nextPage has been moved past, so whatever is left at
+    // its end is lost until the storage is reset or freed
+    void get_statistics(movemm_tagged_heap_tag_statistics_t& stats) const
+    {
+        for (size_t i = 0; i < _pages.size(); ++i)
+        {
+            auto page = _pages[i];
+            stats.pages += 1;
+            stats.bytes_reserved += page->allocationSize;
+            if (i < _nextPage)
+            {
+                stats.bytes_used += page->used();
+                stats.bytes_wasted += page->capacity - page->used();
+            }
+            else if (i == _nextPage)
+            {
+                stats.bytes_used += page->used();
+            }
+        }
+    }
+
+    size_t total_allocated()
+    {
+        size_t res = 0;
+        for (auto& it : _pages)
+        {
+            if (it) res += it->allocationSize;
+        }
+        return res;
+    }
+
+    inline void add_destructor(void* ptr, movemm_destructor_cb_t destructor)
+    {
+        _destructors.push_back(
+            registered_tagged_heap_destructor(ptr, destructor));
+    }
+
+    bool has_destructors() const
+    {
+        return !_destructors.empty();
+    }
+
+    tagged_heap_destructor_list take_destructors()
+    {
+        tagged_heap_destructor_list res;
+        res.swap(_destructors);
+        return res;
+    }
+
+private:
+    size_t current_offset() const
+    {
+        return _nextPage < _pages.size() ? _pages[_nextPage]->used() : 0;
+    }
+
+private:
+    vec<tagged_heap_page*> _pages;
+    size_t _nextPage = 0;
+
+    // Pages charged since the last reset.  Every page before this one has
+    // been reached by allocation.
+    size_t _takenPages = 0;
+    tagged_heap_destructor_list _destructors;
+    uint64_t _id = next_tagged_heap_storage_id();
+};
+
+// Everything a single free releases.  It is gathered while the relevant locks
+// are held and released after they have been dropped, so destructors are free
+// to allocate from or free other tags.  Each thread's destructor list is run
+// as one job, which keeps reverse registration order within a thread while
+// letting separate threads' lists run in parallel.
+struct tagged_heap_free_batch
+{
+    void run(movemm_dispatch_cb_t dispatch, void* userData)
+    {
+        if (dispatch && destructors.size() > 1)
+        {
+            dispatch(userData, &run_job, this, destructors.size());
+        }
+        else
+        {
+            for (size_t i = 0; i < destructors.size(); ++i)
+            {
+                run_job(this, i);
+            }
+        }
+
+        // Only now can the pages go back to the pool
+        storage.clear();
+    }
+
+    static void run_job(void* batch, size_t index)
+    {
+        auto& self = *static_cast<tagged_heap_free_batch*>(batch);
+        run_tagged_heap_destructors(self.destructors[index]);
+    }
+
+    vec<tagged_heap_destructor_list> destructors;
+    vec<tagged_heap_tag_storage> storage;
+};
+
+inline bool is_ring_tag(movemm_heap_tag_t tag)
+{
+    return (tag.tag & MOVEMM_TAGGED_HEAP_RING_TAG_BIT) != 0;
+}
+
+inline uint64_t ring_tag_frame(movemm_heap_tag_t tag)
+{
+    return tag.tag & ~MOVEMM_TAGGED_HEAP_RING_TAG_BIT;
+}
+
+// Ring tags map frames onto a fixed number of in-flight slots and must be
+// freed strictly in frame order.  That means freeing a frame is a single
+// compare-exchange on the oldest live frame: each thread keeps its own pages
+// per slot and rewinds them the next time it allocates in that slot, so the
+// free never has to visit another thread or look anything up.
+class tagged_heap_tls;
+
+class tagged_heap_ring
+{
+public:
+    static constexpr uint32_t max_slots = 16;
+    static constexpr uint32_t default_slots = 4;
+
+    void configure(uint32_t slots, uint64_t firstFrame)
+    {
+        if (slots == 0 || slots > max_slots)
+        {
+            throw std::runtime_error(
+                "Tagged heap ring slot count must be between 1 and 16");
+        }
+        if (_used.load(std::memory_order_relaxed))
+        {
+            throw std::runtime_error(
+                "The tagged heap ring cannot be reconfigured after it has "
+                "been used");
+        }
+        _slots = slots;
+        _oldestFrame.store(firstFrame, std::memory_order_relaxed);
+    }
+
+    uint32_t slot(uint64_t frame) const
+    {
+        return uint32_t(frame % _slots);
+    }
+
+    uint64_t oldest_frame() const
+    {
+        return _oldestFrame.load(std::memory_order_relaxed);
+    }
+
+    bool is_live(uint64_t frame) const
+    {
+        auto oldest = _oldestFrame.load(std::memory_order_acquire);
+        return frame >= oldest && frame - oldest < _slots;
+    }
+
+    // Called on the slow path whenever a thread (re)caches a ring tag
+    void validate(uint64_t frame)
+    {
+        _used.store(true, std::memory_order_relaxed);
+        if (!is_live(frame))
+        {
+            throw std::runtime_error(
+                "Allocated from a ring tag that has already been freed or "
+                "is more than the configured number of slots ahead of the "
+                "oldest live frame");
+        }
+    }
+
+    void validate_release(uint64_t frame) const
+    {
+        if (oldest_frame() != frame)
+        {
+            throw std::runtime_error(
+                "Ring tags must be freed in frame order");
+        }
+    }
+
+    void release(uint64_t frame)
+    {
+        auto expected = frame;
+        if (!_oldestFrame.compare_exchange_strong(
+                expected, frame + 1, std::memory_order_acq_rel))
+        {
+            throw std::runtime_error(
+                "Ring tags must be freed in frame order");
+        }
+    }
+
+    // Threads that registered destructors in a slot's current frame.  This is
+    // touched at most once per thread per frame, so a lock per slot is fine.
+    void register_thread(uint32_t slot, tagged_heap_tls* tls)
+    {
+        std::unique_lock<std::mutex> lock(_slotMutex[slot]);
+        _slotThreads[slot].push_back(tls);
+    }
+
+    void deregister_thread(tagged_heap_tls* tls)
+    {
+        for (uint32_t slot = 0; slot < max_slots; ++slot)
+        {
+            std::unique_lock<std::mutex> lock(_slotMutex[slot]);
+            auto& threads = _slotThreads[slot];
+            for (auto it = threads.begin(); it != threads.end();)
+            {
+                it = *it == tls ? threads.erase(it) : it + 1;
+            }
+        }
+    }
+
+    // Calls fn for every registered thread of the slot and clears the list.
+    // The slot stays locked throughout so no thread can exit underneath it.
+    template <typename Fn>
+    void take_threads(uint32_t slot, Fn&& fn)
+    {
+        std::unique_lock<std::mutex> lock(_slotMutex[slot]);
+        for (auto tls : _slotThreads[slot])
+        {
+            fn(tls);
+        }
+        _slotThreads[slot].clear();
+    }
+
+private:
+    std::mutex _slotMutex[max_slots];
+    vec<tagged_heap_tls*> _slotThreads[max_slots];
+    uint32_t _slots = default_slots;
+    std::atomic_bool _used = {false};
+    std::atomic<uint64_t> _oldestFrame = {0};
+};
+
+namespace std
+{
+    template <>
+    struct hash<movemm_heap_tag_t>
+    {
+        typedef movemm_heap_tag_t argument_type;
+        typedef std::size_t result_type;
+
+        inline result_type operator()(const argument_type& a) const noexcept
+        {
+            return result_type(a.tag);
+        }
+    };
+
+    template <>
+    struct equal_to<movemm_heap_tag_t>
+    {
+        constexpr bool operator()(
+            const movemm_heap_tag_t& a, const movemm_heap_tag_t& b) const
+        {
+            return a.tag == b.tag;
+        }
+    };
+}  // namespace std
+
+class tagged_heap_tls
+{
+public:
+    tagged_heap_tls(tagged_heap_global& parent);
+    ~tagged_heap_tls();
+
+public:
+    // Only the owning thread allocates, so the common case of allocating
+    // again from the same tag is a pointer bump through the cached storage
+    // with no lock.  The mutex only guards the tag map and page lists against
+    // free_tag and the storage queries, which may run on other threads.
+    inline void* allocate(
+        movemm_heap_tag_t tag, size_t bytes, size_t alignment)
+    {
+        tagged_heap_counters::add(_counters.allocations, 1);
+        tagged_heap_counters::add(_counters.allocatedBytes, bytes);
+
+        if (auto storage = find_cached(tag))
+        {
+            auto res = storage->try_allocate(bytes, alignment);
+            if (res)
+            {
+                return res;
+            }
+        }
+        return allocate_slow(tag, bytes, alignment);
+    }
+
+    // The counters and the cached storage are looked up once for the whole
+    // batch.  Whatever doesn't fit the cached page is allocated under a
+    // single lock.  Returns how many were allocated before the first failure.
+    inline size_t allocate_batch(movemm_heap_tag_t tag, size_t bytes,
+        size_t alignment, size_t count, void** ptrs)
+    {
+        tagged_heap_counters::add(_counters.allocations, count);
+        tagged_heap_counters::add(_counters.allocatedBytes, bytes * count);
+
+        size_t allocated = 0;
+        if (auto storage = find_cached(tag))
+        {
+            for (; allocated < count; ++allocated)
+            {
+                auto res = storage->try_allocate(bytes, alignment);
+                if (!res) break;
+                ptrs[allocated] = res;
+            }
+        }
+
+        if (allocated < count)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto& storage = get_and_cache_unsafe(tag);
+            for (; allocated < count; ++allocated)
+            {
+                auto res = storage.allocate(bytes, alignment);
+                if (!res) break;
+                ptrs[allocated] = res;
+            }
+        }
+        return allocated;
+    }
+
+    // Resizes in place when ptr is the last allocation on this thread's
+    // current page for the tag.  Otherwise growing copies into a new
+    // allocation and shrinking leaves the allocation where it is.
+    inline void* reallocate(movemm_heap_tag_t tag, void* ptr, size_t oldBytes,
+        size_t newBytes, size_t alignment)
+    {
+        if (!ptr)
+        {
+            return allocate(tag, newBytes, alignment);
+        }
+
+        auto storage = find_cached(tag);
+        if (storage ? storage->try_resize(ptr, oldBytes, newBytes)
+                    : resize_slow(tag, ptr, oldBytes, newBytes))
+        {
+            return ptr;
+        }
+
+        if (newBytes <= oldBytes)
+        {
+            return ptr;
+        }
+
+        auto res = allocate(tag, newBytes, alignment);
+        if (res) memcpy(res, ptr, oldBytes);
+        return res;
+    }
+
+    // Destructors are recorded against this thread's storage for the tag, so
+    // registering one never takes the global mutex.  The first ring tag
+    // destructor on this thread in a frame also has to tell the ring about
+    // this thread.
+    inline void register_destructor(
+        movemm_heap_tag_t tag, void* ptr, movemm_destructor_cb_t destructor)
     {
-        for (auto& it : _pages)
+        tagged_heap_counters::add(_counters.destructorsRegistered, 1);
+
+        auto storage = find_cached(tag);
+        if (storage && (!is_ring_tag(tag) || storage->has_destructors()))
         {
-            movemm_free(it);
+            storage->add_destructor(ptr, destructor);
+            return;
         }
+        register_destructor_slow(tag, ptr, destructor);
     }
 
-    inline void* allocate(size_t bytes)
+    movemm_tagged_heap_marker_t get_marker(movemm_heap_tag_t tag)
     {
-        void* res = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        return get_and_cache_unsafe(tag).get_marker();
+    }
 
-        while (!res)
+    // Destructors registered after the marker run outside of the lock, since
+    // they may allocate or register more destructors in the same tag.  Those
+    // are past the marker too, so we go around again until none are left.
+    void rewind(
+        movemm_heap_tag_t tag, const movemm_tagged_heap_marker_t& marker)
+    {
+        for (;;)
         {
-            // If all of our pages are full, we need to allocate a new one
-            if (_nextPage >= _pages.size())
+            tagged_heap_destructor_list destructors;
             {
-                // Compute the size of the next page.  This is the smallest
-                // multiple of the page size that can contain the allocation.
-                auto allocSize = compute_required_page_size_for_alloc(bytes);
-
-                // Allocate the next page
-                auto ptr = reinterpret_cast<tagged_heap_page*>(
-                    movemm_alloc(allocSize));
-
-                // Initialize the page
-                auto pg = new (ptr) tagged_heap_page();
-                pg->nextOffset = 0;
-                pg->allocationSize = allocSize;
-                _pages.push_back(ptr);
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto storage = find_storage_unsafe(tag);
+                if (!storage || !storage->can_rewind(marker))
+                {
+                    return;
+                }
+                if (!storage->has_destructors_after(marker))
+                {
+                    storage->rewind(marker);
+                    return;
+                }
+                destructors = storage->take_destructors_after(marker);
             }
+            run_tagged_heap_destructors(destructors);
+        }
+    }
 
-            // Attempt to allocate from the latest page
-            auto& tgPage = _pages[_nextPage];
-            res = tgPage->allocate(bytes);
+    // Moves this thread's storage for the tag into the batch
+    void detach_tag(movemm_heap_tag_t tag, tagged_heap_free_batch& batch)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto it = _tagStorage.find(tag);
+        if (it != _tagStorage.end())
+        {
+            // Invalidate the owner's cached storage before it is destroyed.
+            // The owner re-validates against the generation on every
+            // allocation and falls back to the locked path when it changes.
+            _generation.fetch_add(1, std::memory_order_relaxed);
 
-            // If we failed to allocate, move to the next page
-            if (!res) ++_nextPage;
+            if (it->second.has_destructors())
+            {
+                batch.destructors.push_back(it->second.take_destructors());
+            }
+            batch.storage.push_back(std::move(it->second));
+            _tagStorage.erase(it);
         }
-        return res;
     }
 
-    size_t total_allocated()
+    // Ring pages stay with the thread, so only the destructors are taken
+    void detach_ring_destructors(
+        uint64_t frame, tagged_heap_free_batch& batch)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto& slot = _ringSlots[_ring->slot(frame)];
+        if (slot.frame == frame + 1 && slot.storage.has_destructors())
+        {
+            batch.destructors.push_back(slot.storage.take_destructors());
+        }
+    }
+
+    size_t total_cache_size()
     {
+        std::unique_lock<std::mutex> lock(_mutex);
         size_t res = 0;
-        for (auto& it : _pages)
+        for (auto& storage : _tagStorage)
         {
-            if (it) res += it->allocationSize;
+            res += storage.second.total_allocated();
+        }
+
+        // Ring slots keep their pages between frames
+        for (auto& slot : _ringSlots)
+        {
+            res += slot.storage.total_allocated();
         }
         return res;
     }
 
-private:
-    vec<tagged_heap_page*> _pages;
-    size_t _nextPage;
-};
-
-namespace std
-{
-    template <>
-    struct hash<movemm_heap_tag_t>
+    const tagged_heap_counters& counters() const
     {
-        typedef movemm_heap_tag_t argument_type;
-        typedef std::size_t result_type;
+        return _counters;
+    }
 
-        inline result_type operator()(const argument_type& a) const noexcept
+    void get_statistics(movemm_tagged_heap_tag_statistics_t& stats)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (auto& storage : _tagStorage)
         {
-            return result_type(a.tag);
+            storage.second.get_statistics(stats);
         }
-    };
+        for (auto& slot : _ringSlots)
+        {
+            slot.storage.get_statistics(stats);
+        }
+    }
 
-    template <>
-    struct equal_to<movemm_heap_tag_t>
+    void get_tag_statistics(
+        movemm_heap_tag_t tag, movemm_tagged_heap_tag_statistics_t& stats)
     {
-        constexpr bool operator()(
-            const movemm_heap_tag_t& a, const movemm_heap_tag_t& b) const
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (is_ring_tag(tag) && !_ring->is_live(ring_tag_frame(tag)))
         {
-            return a.tag == b.tag;
+            return;
         }
-    };
-}  // namespace std
+        if (auto storage = find_storage_unsafe(tag))
+        {
+            storage->get_statistics(stats);
+        }
+    }
 
-struct registered_tagged_heap_destructor_set
-{
-    ~registered_tagged_heap_destructor_set()
+    size_t tag_cache_size(movemm_heap_tag_t tag)
     {
-        // Destruy elements back-to-front
-        while (!_vec.empty())
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (is_ring_tag(tag))
+        {
+            auto frame = ring_tag_frame(tag);
+            auto& slot = _ringSlots[_ring->slot(frame)];
+            if (slot.frame == frame + 1 && _ring->is_live(frame))
+            {
+                return slot.storage.total_allocated();
+            }
+            return 0;
+        }
+
+        if (_tagStorage.count(tag))
         {
-            _vec.pop_back();
+            return _tagStorage[tag].total_allocated();
         }
+        return 0;
     }
 
-    vec<registered_tagged_heap_destructor> _vec;
-};
+private:
+    inline tagged_heap_tag_storage* find_cached(movemm_heap_tag_t tag)
+    {
+        if (_cachedGeneration !=
+                _generation.load(std::memory_order_relaxed) ||
+            _cachedOldestFrame != _ring->oldest_frame())
+        {
+            return 0;
+        }
 
-class tagged_heap_tls
-{
-public:
-    tagged_heap_tls(tagged_heap_global& parent);
-    ~tagged_heap_tls();
+        for (auto& entry : _cache)
+        {
+            if (entry.storage && entry.tag.tag == tag.tag)
+            {
+                return entry.storage;
+            }
+        }
+        return 0;
+    }
 
-public:
-    void* allocate(movemm_heap_tag_t tag, size_t bytes)
+    void* allocate_slow(movemm_heap_tag_t tag, size_t bytes, size_t alignment)
     {
         std::unique_lock<std::mutex> lock(_mutex);
-        auto& storage = get_or_create_unsafe(tag);
-        return storage.allocate(bytes);
+        return get_and_cache_unsafe(tag).allocate(bytes, alignment);
     }
 
-    void free_tag(movemm_heap_tag_t tag)
+    bool resize_slow(
+        movemm_heap_tag_t tag, void* ptr, size_t oldBytes, size_t newBytes)
     {
         std::unique_lock<std::mutex> lock(_mutex);
-        if (_tagStorage.count(tag))
+        return get_and_cache_unsafe(tag).try_resize(ptr, oldBytes, newBytes);
+    }
+
+    void register_destructor_slow(
+        movemm_heap_tag_t tag, void* ptr, movemm_destructor_cb_t destructor)
+    {
+        bool registerWithRing = false;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto& storage = get_and_cache_unsafe(tag);
+            if (is_ring_tag(tag))
+            {
+                auto& slot = _ringSlots[_ring->slot(ring_tag_frame(tag))];
+                registerWithRing = slot.registeredFrame != slot.frame;
+                slot.registeredFrame = slot.frame;
+            }
+            storage.add_destructor(ptr, destructor);
+        }
+
+        // Taken outside of our own lock, since freeing a ring tag locks the
+        // slot before it locks the registered threads
+        if (registerWithRing)
         {
-            _tagStorage.erase(tag);
+            _ring->register_thread(_ring->slot(ring_tag_frame(tag)), this);
         }
     }
 
-    size_t total_cache_size()
+    tagged_heap_tag_storage& get_and_cache_unsafe(movemm_heap_tag_t tag)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        size_t res = 0;
-        for (auto& storage : _tagStorage)
+        // Anything cached before the last free_tag may be dangling, and ring
+        // tags must be revalidated once the ring has moved on
+        auto generation = _generation.load(std::memory_order_relaxed);
+        auto oldestFrame = _ring->oldest_frame();
+        if (_cachedGeneration != generation ||
+            _cachedOldestFrame != oldestFrame)
         {
-            res += storage.second.total_allocated();
+            for (auto& entry : _cache)
+            {
+                entry = {};
+            }
+            _cachedGeneration = generation;
+            _cachedOldestFrame = oldestFrame;
         }
-        return res;
+
+        auto& storage = is_ring_tag(tag) ? get_ring_storage_unsafe(tag)
+                                         : get_or_create_unsafe(tag);
+
+        cache_entry* slot = 0;
+        for (auto& entry : _cache)
+        {
+            if (entry.storage == &storage) slot = &entry;
+        }
+        if (!slot)
+        {
+            slot = &_cache[_cacheVictim++ % cache_entries];
+            slot->tag = tag;
+            slot->storage = &storage;
+        }
+        return storage;
     }
 
-    size_t tag_cache_size(movemm_heap_tag_t tag)
+    // Rewinds this thread's pages for the frame's slot when the slot last
+    // held an older frame, which the ring guarantees has been freed.
+    tagged_heap_tag_storage& get_ring_storage_unsafe(movemm_heap_tag_t tag)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        if (_tagStorage.count(tag))
+        auto frame = ring_tag_frame(tag);
+        _ring->validate(frame);
+
+        auto& slot = _ringSlots[_ring->slot(frame)];
+        if (slot.frame != frame + 1)
         {
-            return _tagStorage[tag].total_allocated();
+            for (auto& entry : _cache)
+            {
+                if (entry.storage == &slot.storage) entry = {};
+            }
+            slot.storage.reset();
+            slot.frame = frame + 1;
         }
-        return 0;
+        return slot.storage;
     }
 
-private:
     inline tagged_heap_tag_storage& get_or_create_unsafe(movemm_heap_tag_t tag)
     {
-        if (!_tagStorage.count(tag))
+        return _tagStorage[tag];
+    }
+
+    // Looks up existing storage without creating or validating anything
+    tagged_heap_tag_storage* find_storage_unsafe(movemm_heap_tag_t tag)
+    {
+        if (is_ring_tag(tag))
         {
-            _tagStorage.insert({tag, {}});
+            auto frame = ring_tag_frame(tag);
+            auto& slot = _ringSlots[_ring->slot(frame)];
+            return slot.frame == frame + 1 ? &slot.storage : 0;
         }
-        return _tagStorage.at(tag);
+
+        auto it = _tagStorage.find(tag);
+        return it != _tagStorage.end() ? &it->second : 0;
     }
 
 private:
     umap<movemm_heap_tag_t, tagged_heap_tag_storage> _tagStorage;
     std::mutex _mutex;
     tagged_heap_global* _parent;
+    tagged_heap_ring* _ring;
+
+    struct ring_slot
+    {
+        // Frame + 1 that currently owns the slot's pages, 0 if never used
+        uint64_t frame = 0;
+
+        // Frame + 1 in which this thread last registered with the ring
+        uint64_t registeredFrame = 0;
+
+        tagged_heap_tag_storage storage;
+    };
+
+    ring_slot _ringSlots[tagged_heap_ring::max_slots];
+
+    // Owner-only cache of the last few tags allocated from on this thread
+    struct cache_entry
+    {
+        movemm_heap_tag_t tag;
+        tagged_heap_tag_storage* storage;
+    };
+
+    static constexpr size_t cache_entries = 4;
+    cache_entry _cache[cache_entries] = {};
+    size_t _cacheVictim = 0;
+    uint64_t _cachedGeneration = 0;
+    uint64_t _cachedOldestFrame = 0;
+
+    // Bumped by free_tag whenever it destroys storage owned by this thread
+    std::atomic<uint64_t> _generation = {0};
+
+    tagged_heap_counters _counters;
 };
 
 class tagged_heap_global
@@ -232,6 +1490,11 @@ public:
     void register_tls(tagged_heap_tls* tls);
     void deregister_tls(tagged_heap_tls* tls);
 
+    tagged_heap_ring& ring()
+    {
+        return _ring;
+    }
+
     size_t get_current_storage()
     {
         std::unique_lock<std::mutex> lock(_mutex);
@@ -254,46 +1517,99 @@ public:
         return res;
     }
 
-public:
-    void register_destructor(
-        movemm_heap_tag_t tag, void* ptr, movemm_destructor_cb_t destructor)
+    void get_statistics(movemm_tagged_heap_statistics_t& stats)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        if (!_destructor_sets.count(tag))
+        movemm_tagged_heap_tag_statistics_t pages = {};
         {
-            _destructor_sets.insert({tag, {}});
+            std::unique_lock<std::mutex> lock(_mutex);
+            stats = _retired;
+            for (auto& it : _threadLocal)
+            {
+                it->get_statistics(pages);
+                it->counters().accumulate(stats);
+            }
         }
 
-        auto& destructors = _destructor_sets[tag];
-        destructors._vec.push_back(
-            registered_tagged_heap_destructor(ptr, destructor));
+        stats.pages_live = pages.pages;
+        stats.pages_pooled = _page_pool().pooled_pages();
+        stats.bytes_reserved = pages.bytes_reserved;
+        stats.bytes_used = pages.bytes_used;
+        stats.bytes_wasted = pages.bytes_wasted;
+
+        // Read last, so it can only lag behind the registrations
+        auto run = _destructors_run().load(std::memory_order_relaxed);
+        stats.destructors_run = run;
+        stats.destructors_pending =
+            stats.destructors_registered > run
+                ? size_t(stats.destructors_registered - run)
+                : 0;
     }
 
-    void free_tag(movemm_heap_tag_t tag)
+    void get_tag_statistics(
+        movemm_heap_tag_t tag, movemm_tagged_heap_tag_statistics_t& stats)
     {
+        stats = {};
         std::unique_lock<std::mutex> lock(_mutex);
-        if (_destructor_sets.count(tag))
+        for (auto& it : _threadLocal)
         {
-            // Destroys elements in reverse insertion order due to the type's
-            // destructor
-            _destructor_sets.erase(tag);
+            it->get_tag_statistics(tag, stats);
+        }
+    }
+
+public:
+    void free_tag(movemm_heap_tag_t tag, movemm_dispatch_cb_t dispatch,
+        void* userData)
+    {
+        tagged_heap_free_batch batch;
+        if (is_ring_tag(tag))
+        {
+            free_ring_tag(tag, batch, dispatch, userData);
+            return;
         }
 
-        // Clears out any thread local caches
-        for (auto& it : _threadLocal)
         {
-            it->free_tag(tag);
+            // Clears out any thread local caches
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto& it : _threadLocal)
+            {
+                it->detach_tag(tag, batch);
+            }
         }
+        batch.run(dispatch, userData);
+    }
+
+private:
+    // Ring frames never sweep the thread local caches; only threads that
+    // registered destructors in the frame are visited, and their pages are
+    // rewound by their owners.  The frame is released last so that no thread
+    // can start reusing the slot while its destructors are still running.
+    void free_ring_tag(movemm_heap_tag_t tag, tagged_heap_free_batch& batch,
+        movemm_dispatch_cb_t dispatch, void* userData)
+    {
+        auto frame = ring_tag_frame(tag);
+        _ring.validate_release(frame);
+
+        _ring.take_threads(_ring.slot(frame),
+            [&](tagged_heap_tls* tls)
+            {
+                tls->detach_ring_destructors(frame, batch);
+            });
+        batch.run(dispatch, userData);
+
+        _ring.release(frame);
     }
 
 private:
     std::mutex _mutex;
+    tagged_heap_ring _ring;
     vec<tagged_heap_tls*> _threadLocal;
-    umap<movemm_heap_tag_t, registered_tagged_heap_destructor_set>
-        _destructor_sets;
+
+    // Counters of threads that have exited
+    movemm_tagged_heap_statistics_t _retired = {};
 };
 
-tagged_heap_tls::tagged_heap_tls(tagged_heap_global& parent) : _parent(&parent)
+tagged_heap_tls::tagged_heap_tls(tagged_heap_global& parent)
+    : _parent(&parent), _ring(&parent.ring())
 {
     parent.register_tls(this);
 }
@@ -302,6 +1618,7 @@ tagged_heap_tls::~tagged_heap_tls()
 {
     if (_parent)
     {
+        _ring->deregister_thread(this);
         _parent->deregister_tls(this);
     }
 }
@@ -323,6 +1640,7 @@ void tagged_heap_global::deregister_tls(tagged_heap_tls* tls)
     {
         if (*it == tls)
         {
+            tls->counters().accumulate(_retired);
             _threadLocal.erase(it);
             return;
         }
@@ -352,18 +1670,171 @@ thread_local temp_tls_container tls_container;
 MOVEMM_EXPORT void* movemm_tagged_heap_alloc(
     movemm_heap_tag_t tag, size_t bytes)
 {
-    return tls_container.tls.allocate(tag, bytes);
+    movemm::trace::internal_scope internal;
+    auto res = movemm::oom::retry_unlocked(bytes,
+        [&]
+        {
+            movemm::budget::internal_scope budget;
+            return tls_container.tls.allocate(
+                tag, bytes, tagged_heap_default_alignment);
+        });
+    movemm::profiler::record_tagged_allocation(res, bytes);
+    movemm::trace::record_tagged_allocation(tag.tag, res, bytes, 0);
+    return res;
+}
+
+MOVEMM_EXPORT void* movemm_tagged_heap_aligned_alloc(
+    movemm_heap_tag_t tag, size_t bytes, size_t alignment)
+{
+    movemm::trace::internal_scope internal;
+    if (!is_valid_alignment(alignment)) return 0;
+    if (alignment < tagged_heap_default_alignment)
+    {
+        alignment = tagged_heap_default_alignment;
+    }
+    auto res = movemm::oom::retry_unlocked(bytes,
+        [&]
+        {
+            movemm::budget::internal_scope budget;
+            return tls_container.tls.allocate(tag, bytes, alignment);
+        });
+    movemm::profiler::record_tagged_allocation(res, bytes);
+    movemm::trace::record_tagged_allocation(tag.tag, res, bytes, alignment);
+    return res;
+}
+
+MOVEMM_EXPORT size_t movemm_tagged_heap_alloc_batch(
+    movemm_heap_tag_t tag, size_t bytes, size_t count, void** ptrs)
+{
+    movemm::trace::internal_scope internal;
+    size_t allocated = 0;
+    movemm::oom::retry_unlocked(bytes,
+        [&]() -> void*
+        {
+            movemm::budget::internal_scope budget;
+            allocated += tls_container.tls.allocate_batch(tag, bytes,
+                tagged_heap_default_alignment, count - allocated,
+                ptrs + allocated);
+            return allocated == count ? ptrs : nullptr;
+        });
+    for (size_t i = 0; i < allocated; ++i)
+    {
+        movemm::profiler::record_tagged_allocation(ptrs[i], bytes);
+        movemm::trace::record_tagged_allocation(tag.tag, ptrs[i], bytes, 0);
+    }
+    return allocated;
+}
+
+MOVEMM_EXPORT size_t movemm_tagged_heap_aligned_alloc_batch(
+    movemm_heap_tag_t tag, size_t bytes, size_t alignment, size_t count,
+    void** ptrs)
+{
+    movemm::trace::internal_scope internal;
+    if (!is_valid_alignment(alignment)) return 0;
+    if (alignment < tagged_heap_default_alignment)
+    {
+        alignment = tagged_heap_default_alignment;
+    }
+    size_t allocated = 0;
+    movemm::oom::retry_unlocked(bytes,
+        [&]() -> void*
+        {
+            movemm::budget::internal_scope budget;
+            allocated += tls_container.tls.allocate_batch(
+                tag, bytes, alignment, count - allocated, ptrs + allocated);
+            return allocated == count ? ptrs : nullptr;
+        });
+    for (size_t i = 0; i < allocated; ++i)
+    {
+        movemm::profiler::record_tagged_allocation(ptrs[i], bytes);
+        movemm::trace::record_tagged_allocation(
+            tag.tag, ptrs[i], bytes, alignment);
+    }
+    return allocated;
+}
+
+MOVEMM_EXPORT void* movemm_tagged_heap_realloc(
+    movemm_heap_tag_t tag, void* ptr, size_t old_bytes, size_t new_bytes)
+{
+    movemm::trace::internal_scope internal;
+    auto res = movemm::oom::retry_unlocked(new_bytes,
+        [&]
+        {
+            movemm::budget::internal_scope budget;
+            return tls_container.tls.reallocate(tag, ptr, old_bytes,
+                new_bytes, tagged_heap_default_alignment);
+        });
+    movemm::trace::record_tagged_reallocation(tag.tag, ptr, res, new_bytes, 0);
+    return res;
+}
+
+MOVEMM_EXPORT void* movemm_tagged_heap_aligned_realloc(movemm_heap_tag_t tag,
+    void* ptr, size_t old_bytes, size_t new_bytes, size_t alignment)
+{
+    movemm::trace::internal_scope internal;
+    if (!is_valid_alignment(alignment)) return 0;
+    if (alignment < tagged_heap_default_alignment)
+    {
+        alignment = tagged_heap_default_alignment;
+    }
+    auto res = movemm::oom::retry_unlocked(new_bytes,
+        [&]
+        {
+            movemm::budget::internal_scope budget;
+            return tls_container.tls.reallocate(
+                tag, ptr, old_bytes, new_bytes, alignment);
+        });
+    movemm::trace::record_tagged_reallocation(
+        tag.tag, ptr, res, new_bytes, alignment);
+    return res;
 }
 
 MOVEMM_EXPORT void movemm_register_tagged_heap_destructor(
     movemm_heap_tag_t tag, void* ptr, movemm_destructor_cb_t destructor)
 {
-    _temp_heap().register_destructor(tag, ptr, destructor);
+    movemm::trace::internal_scope internal;
+    movemm::budget::internal_scope budget;
+    tls_container.tls.register_destructor(tag, ptr, destructor);
+}
+
+MOVEMM_EXPORT movemm_tagged_heap_marker_t movemm_tagged_heap_get_marker(
+    movemm_heap_tag_t tag)
+{
+    movemm::trace::internal_scope internal;
+    movemm::budget::internal_scope budget;
+    auto marker = tls_container.tls.get_marker(tag);
+    movemm::trace::record_tagged_marker(
+        tag.tag, marker.storage, marker.page, marker.offset);
+    return marker;
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_rewind(
+    movemm_heap_tag_t tag, movemm_tagged_heap_marker_t marker)
+{
+    movemm::trace::internal_scope internal;
+    movemm::budget::internal_scope budget;
+    tls_container.tls.rewind(tag, marker);
+
+    // After the destructors, whose allocations in the tag are rewound too
+    movemm::trace::record_tagged_rewind(
+        tag.tag, marker.storage, marker.page, marker.offset);
 }
 
 MOVEMM_EXPORT void movemm_tagged_heap_free(movemm_heap_tag_t tag)
 {
-    return _temp_heap().free_tag(tag);
+    movemm::trace::internal_scope internal;
+    movemm::budget::internal_scope budget;
+    movemm::trace::record_tagged_free(tag.tag);
+    _temp_heap().free_tag(tag, 0, 0);
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_free_parallel(movemm_heap_tag_t tag,
+    movemm_dispatch_cb_t dispatch, void* user_data)
+{
+    movemm::trace::internal_scope internal;
+    movemm::budget::internal_scope budget;
+    movemm::trace::record_tagged_free(tag.tag);
+    _temp_heap().free_tag(tag, dispatch, user_data);
 }
 
 MOVEMM_EXPORT size_t movemm_tagged_heap_get_current_storage()
@@ -375,4 +1846,65 @@ MOVEMM_EXPORT size_t movemm_tagged_heap_get_current_tag_storage(
     movemm_heap_tag_t tag)
 {
     return _temp_heap().get_current_tag_storage(tag);
-}
\ No newline at end of file
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_get_statistics(
+    movemm_tagged_heap_statistics_t* statistics)
+{
+    _temp_heap().get_statistics(*statistics);
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_get_tag_statistics(
+    movemm_heap_tag_t tag, movemm_tagged_heap_tag_statistics_t* statistics)
+{
+    _temp_heap().get_tag_statistics(tag, *statistics);
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_set_page_pool_limit(size_t bytes)
+{
+    movemm::trace::internal_scope internal;
+    _page_pool().set_limit(bytes);
+}
+
+MOVEMM_EXPORT size_t movemm_tagged_heap_get_page_pool_limit()
+{
+    return _page_pool().limit();
+}
+
+MOVEMM_EXPORT size_t movemm_tagged_heap_get_pooled_storage()
+{
+    return _page_pool().pooled_storage();
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_release_pooled_pages()
+{
+    movemm::trace::internal_scope internal;
+    _page_pool().trim(0);
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_set_huge_pages_enabled(int enabled)
+{
+    _page_source().set_huge_pages_enabled(enabled != 0);
+}
+
+MOVEMM_EXPORT int movemm_tagged_heap_get_huge_pages_enabled()
+{
+    return _page_source().huge_pages_enabled();
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_get_backing_stats(
+    movemm_tagged_heap_backing_stats_t* stats)
+{
+    _page_source().get_stats(stats);
+}
+
+MOVEMM_EXPORT void movemm_tagged_heap_configure_ring(
+    uint32_t slots, uint64_t first_frame)
+{
+    _temp_heap().ring().configure(slots, first_frame);
+}
+
+MOVEMM_EXPORT movemm_heap_tag_t movemm_tagged_heap_ring_tag(uint64_t frame)
+{
+    return {frame | MOVEMM_TAGGED_HEAP_RING_TAG_BIT};
+}
@@ -0,0 +1,419 @@
+#include <movemm/memory-allocator.h>
+#include "trace-recorder.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <mimalloc.h>
+
+#if defined(MOVEMM_UNIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#elif defined(MOVEMM_WINDOWS)
+#include <windows.h>
+#endif
+
+namespace
+{
+    constexpr size_t events_per_chunk = MOVEMM_TRACE_EVENTS_PER_CHUNK;
+    constexpr uint64_t time_mask = 0xffffffffffffull;
+
+    // Events a thread has recorded but not yet copied to the file.  Only the
+    // owning thread adds to it, but stopping a trace flushes every thread's
+    // buffer, so both hold `busy` while they touch it.  Buffers left over
+    // from an earlier trace are recognised by their generation and emptied.
+    struct thread_buffer
+    {
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+        uint64_t generation = 0;
+        uint32_t thread = 0;
+        uint32_t count = 0;
+        thread_buffer* prev = nullptr;
+        thread_buffer* next = nullptr;
+        movemm_trace_event_t events[events_per_chunk];
+
+        inline void lock()
+        {
+            while (busy.test_and_set(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        inline void unlock()
+        {
+            busy.clear(std::memory_order_release);
+        }
+    };
+
+    // The running trace.  Only start and stop change it, under the session
+    // lock.  Writers announce themselves in _activeWriters before checking
+    // that the trace is still running, so stop can wait for them to leave
+    // the mapping before unmapping it.
+    struct trace_session
+    {
+        char* mapping = nullptr;
+        size_t mappingBytes = 0;
+        uint64_t chunkCount = 0;
+        std::atomic<uint64_t> nextChunk = {0};
+
+        // steady_clock nanoseconds that timestamps are measured from
+        std::atomic<int64_t> start = {0};
+#if defined(MOVEMM_UNIX)
+        int file = -1;
+#elif defined(MOVEMM_WINDOWS)
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE fileMapping = 0;
+#endif
+    };
+
+    std::mutex _sessionLock;
+    trace_session _session;
+    std::atomic<uint64_t> _generation = {0};
+    std::atomic<uint32_t> _activeWriters = {0};
+
+    // Every thread that has recorded an event, so stop can flush them
+    std::mutex _registryLock;
+    thread_buffer* _buffers = nullptr;
+    std::atomic<uint32_t> _nextThread = {0};
+
+    inline int64_t now_nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    bool map_file(trace_session& session, const char* path, size_t bytes)
+    {
+#if defined(MOVEMM_UNIX)
+        session.file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (session.file < 0) return false;
+        if (ftruncate(session.file, off_t(bytes)) == 0)
+        {
+            auto ptr = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                session.file, 0);
+            if (ptr != MAP_FAILED)
+            {
+                session.mapping = static_cast<char*>(ptr);
+                return true;
+            }
+        }
+        close(session.file);
+        session.file = -1;
+        return false;
+#elif defined(MOVEMM_WINDOWS)
+        session.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+        if (session.file == INVALID_HANDLE_VALUE) return false;
+        session.fileMapping = CreateFileMappingA(session.file, 0,
+            PAGE_READWRITE, DWORD(uint64_t(bytes) >> 32), DWORD(bytes), 0);
+        if (session.fileMapping)
+        {
+            auto ptr = MapViewOfFile(
+                session.fileMapping, FILE_MAP_WRITE, 0, 0, bytes);
+            if (ptr)
+            {
+                session.mapping = static_cast<char*>(ptr);
+                return true;
+            }
+            CloseHandle(session.fileMapping);
+            session.fileMapping = 0;
+        }
+        CloseHandle(session.file);
+        session.file = INVALID_HANDLE_VALUE;
+        return false;
+#else
+        return false;
+#endif
+    }
+
+    void unmap_file(trace_session& session)
+    {
+#if defined(MOVEMM_UNIX)
+        munmap(session.mapping, session.mappingBytes);
+        close(session.file);
+        session.file = -1;
+#elif defined(MOVEMM_WINDOWS)
+        UnmapViewOfFile(session.mapping);
+        CloseHandle(session.fileMapping);
+        CloseHandle(session.file);
+        session.fileMapping = 0;
+        session.file = INVALID_HANDLE_VALUE;
+#endif
+        session.mapping = nullptr;
+    }
+
+    // Copies the buffer into the next chunk of the ring.  The sequence is
+    // written last, so a chunk only shows up in the file once it's complete.
+    void write_chunk(thread_buffer& buffer)
+    {
+        auto sequence =
+            _session.nextChunk.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto slot = (sequence - 1) % _session.chunkCount;
+        auto chunk =
+            _session.mapping + (slot + 1) * size_t(MOVEMM_TRACE_CHUNK_BYTES);
+
+        movemm_trace_chunk_header_t header = {0, buffer.thread, buffer.count};
+        memcpy(chunk, &header, sizeof(header));
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(chunk + sizeof(header), buffer.events,
+            buffer.count * sizeof(movemm_trace_event_t));
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(chunk, &sequence, sizeof(sequence));
+    }
+
+    // Called with the buffer locked
+    void flush_buffer(thread_buffer& buffer)
+    {
+        if (!buffer.count) return;
+
+        _activeWriters.fetch_add(1, std::memory_order_seq_cst);
+        if (movemm::trace::g_tracing.load(std::memory_order_seq_cst) &&
+            buffer.generation == _generation.load(std::memory_order_acquire))
+        {
+            write_chunk(buffer);
+        }
+        _activeWriters.fetch_sub(1, std::memory_order_release);
+        buffer.count = 0;
+    }
+
+    thread_local bool t_exited = false;
+
+    // Buffers are created on a thread's first event and flushed when it
+    // exits.  Events recorded by other thread_local destructors after that
+    // are dropped.
+    struct thread_buffer_owner
+    {
+        thread_buffer* buffer = nullptr;
+
+        inline ~thread_buffer_owner()
+        {
+            t_exited = true;
+            if (!buffer) return;
+
+            std::lock_guard<std::mutex> registry(_registryLock);
+            buffer->lock();
+            flush_buffer(*buffer);
+            buffer->unlock();
+
+            if (buffer->prev) buffer->prev->next = buffer->next;
+            if (buffer->next) buffer->next->prev = buffer->prev;
+            if (_buffers == buffer) _buffers = buffer->next;
+            buffer->~thread_buffer();
+            mi_free(buffer);
+            buffer = nullptr;
+        }
+    };
+
+    thread_local thread_buffer_owner t_bufferOwner;
+
+    thread_buffer* thread_buffer_for_thread()
+    {
+        if (t_exited) return nullptr;
+        if (t_bufferOwner.buffer) return t_bufferOwner.buffer;
+
+        // Straight from mimalloc so the recorder never records itself
+        auto memory = mi_malloc(sizeof(thread_buffer));
+        if (!memory) return nullptr;
+        auto buffer = new (memory) thread_buffer();
+        buffer->thread = _nextThread.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> registry(_registryLock);
+        buffer->next = _buffers;
+        if (_buffers) _buffers->prev = buffer;
+        _buffers = buffer;
+        t_bufferOwner.buffer = buffer;
+        return buffer;
+    }
+
+    inline uint64_t event_header(
+        movemm_trace_event_type_t type, size_t alignment)
+    {
+        uint64_t alignmentShift = 0;
+        while (alignment > 1)
+        {
+            alignment >>= 1;
+            ++alignmentShift;
+        }
+
+        auto elapsed =
+            now_nanoseconds() - _session.start.load(std::memory_order_relaxed);
+        return (uint64_t(type) << 56) | (alignmentShift << 48) |
+               (uint64_t(elapsed) & time_mask);
+    }
+
+    // Empties the buffer if it is left over from an earlier trace
+    inline void lock_buffer(thread_buffer& buffer)
+    {
+        buffer.lock();
+        auto generation = _generation.load(std::memory_order_acquire);
+        if (buffer.generation != generation)
+        {
+            buffer.generation = generation;
+            buffer.count = 0;
+        }
+    }
+
+    // The most pointers a batch event and its packed pointers can hold while
+    // fitting in a single chunk
+    constexpr size_t max_batch_pointers = 1 + (events_per_chunk - 1) * 4;
+
+    void record_event(movemm_trace_event_type_t type, uint64_t ptr,
+        uint64_t size, uint64_t extra, size_t alignment)
+    {
+        auto buffer = thread_buffer_for_thread();
+        if (!buffer) return;
+
+        auto header = event_header(type, alignment);
+        lock_buffer(*buffer);
+
+        auto& event = buffer->events[buffer->count++];
+        event.header = header;
+        event.ptr = ptr;
+        event.size = size;
+        event.extra = extra;
+
+        if (buffer->count == events_per_chunk)
+        {
+            flush_buffer(*buffer);
+        }
+        buffer->unlock();
+    }
+}  // namespace
+
+namespace movemm
+{
+    namespace trace
+    {
+        void record(movemm_trace_event_type_t type, const void* ptr,
+            size_t size, uint64_t extra, size_t alignment)
+        {
+            record_event(
+                type, reinterpret_cast<uintptr_t>(ptr), size, extra, alignment);
+        }
+
+        void record_marker(movemm_trace_event_type_t type, uint64_t tag,
+            uint64_t storage, size_t page, size_t offset)
+        {
+            record_event(type, storage,
+                MOVEMM_TRACE_MARKER_POSITION(page, offset), tag, 0);
+        }
+
+        // A batch too big for one chunk is split into several batch events
+        void record_batch(void* const* ptrs, size_t count, size_t size)
+        {
+            auto buffer = thread_buffer_for_thread();
+            if (!buffer) return;
+
+            auto header = event_header(MOVEMM_TRACE_ALLOC_BATCH, 0);
+            lock_buffer(*buffer);
+            while (count)
+            {
+                auto pointers =
+                    count < max_batch_pointers ? count : max_batch_pointers;
+                auto events = 1 + MOVEMM_TRACE_BATCH_EVENTS(pointers);
+                if (buffer->count + events > events_per_chunk)
+                {
+                    flush_buffer(*buffer);
+                }
+
+                auto& event = buffer->events[buffer->count];
+                event.header = header;
+                event.ptr = reinterpret_cast<uintptr_t>(ptrs[0]);
+                event.size = size;
+                event.extra = pointers;
+
+                auto packed =
+                    reinterpret_cast<char*>(&buffer->events[buffer->count + 1]);
+                memset(packed, 0, (events - 1) * sizeof(movemm_trace_event_t));
+                for (size_t i = 1; i < pointers; ++i)
+                {
+                    uint64_t ptr = reinterpret_cast<uintptr_t>(ptrs[i]);
+                    memcpy(packed + (i - 1) * sizeof(ptr), &ptr, sizeof(ptr));
+                }
+
+                buffer->count += uint32_t(events);
+                if (buffer->count == events_per_chunk)
+                {
+                    flush_buffer(*buffer);
+                }
+                ptrs += pointers;
+                count -= pointers;
+            }
+            buffer->unlock();
+        }
+    }  // namespace trace
+}  // namespace movemm
+
+MOVEMM_EXPORT int movemm_trace_start(const char* path, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_sessionLock);
+    if (movemm::trace::g_tracing.load(std::memory_order_relaxed)) return 0;
+
+    // The header takes the first chunk, and the ring needs at least one more
+    auto chunks = bytes / MOVEMM_TRACE_CHUNK_BYTES;
+    if (chunks < 2) return 0;
+
+    _session.mappingBytes = chunks * MOVEMM_TRACE_CHUNK_BYTES;
+    if (!map_file(_session, path, _session.mappingBytes)) return 0;
+
+    _session.chunkCount = chunks - 1;
+    _session.nextChunk.store(0, std::memory_order_relaxed);
+    _session.start.store(now_nanoseconds(), std::memory_order_relaxed);
+
+    movemm_trace_file_header_t header = {MOVEMM_TRACE_MAGIC,
+        MOVEMM_TRACE_VERSION, MOVEMM_TRACE_CHUNK_BYTES, _session.chunkCount};
+    memcpy(_session.mapping, &header, sizeof(header));
+
+    _generation.fetch_add(1, std::memory_order_release);
+    movemm::trace::g_tracing.store(true, std::memory_order_seq_cst);
+    return 1;
+}
+
+MOVEMM_EXPORT void movemm_trace_stop()
+{
+    std::lock_guard<std::mutex> lock(_sessionLock);
+    if (!movemm::trace::g_tracing.load(std::memory_order_relaxed)) return;
+
+    // Once the flag is down no new writer will touch the mapping, so the
+    // remaining events can be copied out and the file closed
+    movemm::trace::g_tracing.store(false, std::memory_order_seq_cst);
+    while (_activeWriters.load(std::memory_order_seq_cst) != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> registry(_registryLock);
+        auto generation = _generation.load(std::memory_order_relaxed);
+        for (auto buffer = _buffers; buffer; buffer = buffer->next)
+        {
+            buffer->lock();
+            if (buffer->generation == generation && buffer->count)
+            {
+                write_chunk(*buffer);
+            }
+            buffer->count = 0;
+            buffer->unlock();
+        }
+    }
+
+    unmap_file(_session);
+}
+
+MOVEMM_EXPORT void movemm_trace_flush()
+{
+    if (!movemm::trace::g_tracing.load(std::memory_order_relaxed)) return;
+
+    auto buffer = thread_buffer_for_thread();
+    if (!buffer) return;
+
+    buffer->lock();
+    flush_buffer(*buffer);
+    buffer->unlock();
+}
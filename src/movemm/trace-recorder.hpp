@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <movemm/memory-trace.h>
+
+// Allocation hooks for the trace recorder.  Like the profiler's, these are
+// inlined into the allocation functions and cost a single branch while no
+// trace is running.
+namespace movemm
+{
+    namespace trace
+    {
+        inline std::atomic_bool g_tracing = {false};
+
+        // Set while the tagged heap is inside one of its own functions, so
+        // the pages and bookkeeping it allocates through movemm_alloc aren't
+        // replayed on top of the tagged allocations themselves
+        inline thread_local uint32_t t_internalDepth = 0;
+
+        class internal_scope
+        {
+        public:
+            inline internal_scope()
+                : _active(g_tracing.load(std::memory_order_relaxed))
+            {
+                if (_active) ++t_internalDepth;
+            }
+
+            inline ~internal_scope()
+            {
+                if (_active) --t_internalDepth;
+            }
+
+            internal_scope(const internal_scope&) = delete;
+            internal_scope& operator=(const internal_scope&) = delete;
+
+        private:
+            bool _active;
+        };
+
+        // Lifts an internal_scope while the tagged heap calls back into
+        // the caller, such as when it runs destructors
+        class external_scope
+        {
+        public:
+            inline external_scope() : _depth(t_internalDepth)
+            {
+                t_internalDepth = 0;
+            }
+
+            inline ~external_scope()
+            {
+                t_internalDepth = _depth;
+            }
+
+            external_scope(const external_scope&) = delete;
+            external_scope& operator=(const external_scope&) = delete;
+
+        private:
+            uint32_t _depth;
+        };
+
+        inline bool is_tracing_external()
+        {
+            return g_tracing.load(std::memory_order_relaxed) &&
+                   !t_internalDepth;
+        }
+
+        void record(movemm_trace_event_type_t type, const void* ptr,
+            size_t size, uint64_t extra, size_t alignment);
+        void record_batch(void* const* ptrs, size_t count, size_t size);
+        void record_marker(movemm_trace_event_type_t type, uint64_t tag,
+            uint64_t storage, size_t page, size_t offset);
+
+        inline void record_allocation(void* ptr, size_t bytes, size_t alignment)
+        {
+            if (is_tracing_external() && ptr)
+            {
+                record(MOVEMM_TRACE_ALLOC, ptr, bytes, 0, alignment);
+            }
+        }
+
+        inline void record_allocation_batch(
+            void* const* ptrs, size_t count, size_t bytes)
+        {
+            if (is_tracing_external() && count)
+            {
+                record_batch(ptrs, count, bytes);
+            }
+        }
+
+        // A reallocation from null is recorded as a plain allocation
+        inline void record_reallocation(
+            void* old, void* ptr, size_t bytes, size_t alignment)
+        {
+            if (is_tracing_external() && ptr)
+            {
+                record(old ? MOVEMM_TRACE_REALLOC : MOVEMM_TRACE_ALLOC, ptr,
+                    bytes, reinterpret_cast<uintptr_t>(old), alignment);
+            }
+        }
+
+        inline void record_free(void* ptr)
+        {
+            if (is_tracing_external() && ptr)
+            {
+                record(MOVEMM_TRACE_FREE, ptr, 0, 0, 0);
+            }
+        }
+
+        inline void record_heap_allocation(
+            void* heap, void* ptr, size_t bytes, size_t alignment)
+        {
+            if (is_tracing_external() && ptr)
+            {
+                record(MOVEMM_TRACE_HEAP_ALLOC, ptr, bytes,
+                    reinterpret_cast<uintptr_t>(heap), alignment);
+            }
+        }
+
+        inline void record_heap_reallocation(
+            void* heap, void* old, void* ptr, size_t bytes, size_t alignment)
+        {
+            if (!old)
+            {
+                record_heap_allocation(heap, ptr, bytes, alignment);
+            }
+            else if (is_tracing_external() && ptr)
+            {
+                record(MOVEMM_TRACE_HEAP_REALLOC, ptr, bytes,
+                    reinterpret_cast<uintptr_t>(old), alignment);
+            }
+        }
+
+        inline void record_heap_free(void* heap, void* ptr)
+        {
+            if (is_tracing_external() && ptr)
+            {
+                record(MOVEMM_TRACE_HEAP_FREE, ptr, 0,
+                    reinterpret_cast<uintptr_t>(heap), 0);
+            }
+        }
+
+        inline void record_heap_destroy(void* heap)
+        {
+            if (is_tracing_external())
+            {
+                record(MOVEMM_TRACE_HEAP_DESTROY, 0, 0,
+                    reinterpret_cast<uintptr_t>(heap), 0);
+            }
+        }
+
+        inline void record_tagged_allocation(
+            uint64_t tag, void* ptr, size_t bytes, size_t alignment)
+        {
+            if (g_tracing.load(std::memory_order_relaxed) && ptr)
+            {
+                record(MOVEMM_TRACE_TAGGED_ALLOC, ptr, bytes, tag, alignment);
+            }
+        }
+
+        inline void record_tagged_reallocation(uint64_t tag, void* old,
+            void* ptr, size_t bytes, size_t alignment)
+        {
+            if (!old)
+            {
+                record_tagged_allocation(tag, ptr, bytes, alignment);
+            }
+            else if (g_tracing.load(std::memory_order_relaxed) && ptr)
+            {
+                record(MOVEMM_TRACE_TAGGED_REALLOC, ptr, bytes,
+                    reinterpret_cast<uintptr_t>(old), alignment);
+            }
+        }
+
+        inline void record_tagged_free(uint64_t tag)
+        {
+            if (g_tracing.load(std::memory_order_relaxed))
+            {
+                record(MOVEMM_TRACE_TAGGED_FREE, 0, 0, tag, 0);
+            }
+        }
+
+        // Taking a marker and rewinding to it record the same storage and
+        // position, which is how the replay pairs them up
+        inline void record_tagged_marker(
+            uint64_t tag, uint64_t storage, size_t page, size_t offset)
+        {
+            if (g_tracing.load(std::memory_order_relaxed))
+            {
+                record_marker(
+                    MOVEMM_TRACE_TAGGED_MARKER, tag, storage, page, offset);
+            }
+        }
+
+        inline void record_tagged_rewind(
+            uint64_t tag, uint64_t storage, size_t page, size_t offset)
+        {
+            if (g_tracing.load(std::memory_order_relaxed))
+            {
+                record_marker(
+                    MOVEMM_TRACE_TAGGED_REWIND, tag, storage, page, offset);
+            }
+        }
+    }  // namespace trace
+}  // namespace movemm
@@ -1,63 +1,558 @@
-// #include <cstddef>
-// #include <cstring>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
 
-// #include <catch2/catch_all.hpp>
+#include <catch2/catch_all.hpp>
 
-// #include <movemm/memory-allocator.h>
-// #include <string.h>
+#include <movemm/memory-allocator.h>
+#include <movemm/stl_allocator.hpp>
+#include <string.h>
+#include <thread>
+#include <vector>
 
-// SCENARIO("Testing the C allocator API")
-// {
-//     GIVEN("An empty stack array of pointers")
-//     {
-//         void* generated[100];
-//         memset(generated, 0, sizeof(generated));
+SCENARIO("Testing the C allocator API")
+{
+    GIVEN("An empty stack array of pointers")
+    {
+        void* generated[100];
+        memset(generated, 0, sizeof(generated));
 
-//         movemm_statistics_t start_stats;
-//         movemm_get_statistics(&start_stats);
+        movemm_statistics_t start_stats;
+        movemm_get_statistics(&start_stats);
 
-//         INFO("Total memory mapped = " << start_stats.mapped);
+        INFO("Total memory committed = " << start_stats.committed);
 
-//         WHEN("100 allocations are made")
-//         {
-//             for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]);
-//                  ++i)
-//             {
-//                 generated[i] = movemm_alloc(1024 * 1024);
-//             }
-
-//             THEN("All allocations should be valid")
-//             {
-//                 for (size_t i = 0; i < sizeof(generated) /
-//                 sizeof(generated[0]);
-//                      ++i)
-//                 {
-//                     REQUIRE(generated[i] != 0);
-//                 }
-//             }
-
-//             AND_THEN(
-//                 "The amount of mapped memory should be higher than it was at
-//                 " "the start")
-//             {
-//                 movemm_statistics_t cur_stats;
-//                 movemm_get_statistics(&cur_stats);
-
-//                 REQUIRE(cur_stats.mapped > start_stats.mapped);
-//             }
-
-//             AND_WHEN("All of the allocations are freed")
-//             {
-//                 for (size_t i = 0; i < sizeof(generated) /
-//                 sizeof(generated[0]);
-//                      ++i)
-//                 {
-//                     REQUIRE_NOTHROW(movemm_free(generated[i]));
-//                 }
-//             }
-//         }
-//     }
-// }
+        WHEN("100 allocations are made")
+        {
+            for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]);
+                 ++i)
+            {
+                generated[i] = movemm_alloc(1024 * 1024);
+            }
+
+            THEN("All allocations should be valid")
+            {
+                for (size_t i = 0;
+                     i < sizeof(generated) / sizeof(generated[0]); ++i)
+                {
+                    REQUIRE(generated[i] != 0);
+                }
+            }
+
+            AND_THEN(
+                "The amount of committed memory should be higher than it was "
+                "at the start")
+            {
+                movemm_statistics_t cur_stats;
+                movemm_get_statistics(&cur_stats);
+
+                REQUIRE(cur_stats.committed > start_stats.committed);
+                REQUIRE(cur_stats.peak_committed >= cur_stats.committed);
+            }
+
+            for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]);
+                 ++i)
+            {
+                REQUIRE_NOTHROW(movemm_free(generated[i]));
+            }
+        }
+    }
+}
+
+SCENARIO("Testing allocation tracking")
+{
+#if defined(MOVEMM_TRACKING_MODE)
+    GIVEN("An aligned allocation")
+    {
+        auto ptr = movemm_aligned_alloc(100, 64);
+
+        THEN("Its size, alignment, callsite and thread are recorded")
+        {
+            movemm_tracked_allocation_t record;
+            REQUIRE(movemm_get_tracked_allocation(ptr, &record));
+            REQUIRE(record.ptr == ptr);
+            REQUIRE(record.size == 100);
+            REQUIRE(record.alignment == 64);
+            REQUIRE(record.callsite != nullptr);
+            REQUIRE(record.thread != 0);
+        }
+
+        THEN("Freeing it with the wrong alignment throws and keeps it")
+        {
+            REQUIRE_THROWS(movemm_aligned_free(ptr, 32));
+            REQUIRE_THROWS(movemm_aligned_free_sized(ptr, 100, 32));
+            REQUIRE(movemm_get_tracked_allocation(ptr, nullptr));
+        }
+
+        THEN("Freeing it with the wrong size throws and keeps it")
+        {
+            REQUIRE_THROWS(movemm_aligned_free_sized(ptr, 64, 64));
+            REQUIRE(movemm_get_tracked_allocation(ptr, nullptr));
+        }
+
+        THEN("Reallocating it keeps it tracked under its new address")
+        {
+            ptr = movemm_aligned_realloc(ptr, 4096, 64);
+            movemm_tracked_allocation_t record;
+            REQUIRE(movemm_get_tracked_allocation(ptr, &record));
+            REQUIRE(record.size == 4096);
+        }
+
+        movemm_aligned_free(ptr, 64);
+        REQUIRE(!movemm_get_tracked_allocation(ptr, nullptr));
+    }
+
+    GIVEN("An unaligned allocation")
+    {
+        auto ptr = movemm_alloc(48);
+
+        THEN("Freeing it with the wrong size throws and keeps it")
+        {
+            REQUIRE_THROWS(movemm_free_sized(ptr, 32));
+            REQUIRE(movemm_get_tracked_allocation(ptr, nullptr));
+        }
+
+        movemm_free_sized(ptr, 48);
+        REQUIRE(!movemm_get_tracked_allocation(ptr, nullptr));
+    }
+
+    GIVEN("Memory that wasn't allocated by movemm")
+    {
+        int local = 0;
+
+        THEN("Freeing it throws")
+        {
+            REQUIRE_THROWS(movemm_free(&local));
+            REQUIRE_THROWS(movemm_free_sized(&local, sizeof(local)));
+            REQUIRE_THROWS(movemm_aligned_free(&local, 16));
+            REQUIRE_THROWS(movemm_realloc(&local, 16));
+        }
+    }
+
+    GIVEN("Several threads allocating and freeing at once")
+    {
+        constexpr int threadCount = 4;
+        constexpr int perThread = 10000;
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back(
+                []
+                {
+                    std::vector<void*> ptrs;
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        ptrs.push_back(movemm_alloc(16 + i % 64));
+                    }
+                    for (auto ptr : ptrs)
+                    {
+                        movemm_free(ptr);
+                    }
+                });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        THEN("Every allocation has been released from the table")
+        {
+            struct counter
+            {
+                static void visit(
+                    const movemm_tracked_allocation_t* allocation,
+                    void* userData)
+                {
+                    auto& live = *static_cast<size_t*>(userData);
+                    live += allocation->size >= 16 && allocation->size < 80;
+                }
+            };
+
+            auto ptr = movemm_alloc(1);
+            size_t live = 0;
+            REQUIRE(movemm_visit_tracked_allocations(
+                        &counter::visit, &live) >= 1);
+            REQUIRE(live < size_t(threadCount * perThread));
+            movemm_free(ptr);
+        }
+    }
+#else
+    GIVEN("A build without tracking mode")
+    {
+        auto ptr = movemm_alloc(16);
+
+        THEN("Nothing is tracked")
+        {
+            REQUIRE(!movemm_get_tracked_allocation(ptr, nullptr));
+        }
+        movemm_free(ptr);
+    }
+#endif
+}
+
+SCENARIO("Testing batched allocation")
+{
+    GIVEN("A batch of blocks")
+    {
+        void* ptrs[256];
+        REQUIRE(movemm::alloc_batch(48, 256, ptrs) == 256);
+
+        THEN("Every block is distinct and usable")
+        {
+            for (size_t i = 0; i < 256; ++i)
+            {
+                memset(ptrs[i], int(i), 48);
+            }
+            for (size_t i = 0; i < 256; ++i)
+            {
+                REQUIRE(static_cast<unsigned char*>(ptrs[i])[47] ==
+                        (unsigned char)i);
+            }
+#if defined(MOVEMM_TRACKING_MODE)
+            movemm_tracked_allocation_t record;
+            REQUIRE(movemm_get_tracked_allocation(ptrs[100], &record));
+            REQUIRE(record.size == 48);
+#endif
+        }
+
+#if defined(MOVEMM_TRACKING_MODE)
+        THEN("Freeing it with a pointer movemm doesn't know throws")
+        {
+            int local = 0;
+            void* mixed[3] = {ptrs[0], &local, ptrs[1]};
+            REQUIRE_THROWS(movemm_free_batch(mixed, 3));
+            REQUIRE(movemm_get_tracked_allocation(ptrs[0], nullptr));
+            REQUIRE(movemm_get_tracked_allocation(ptrs[1], nullptr));
+        }
+#endif
+
+        // Nulls in a batch are skipped
+        movemm_free(ptrs[10]);
+        ptrs[10] = nullptr;
+        movemm::free_batch(ptrs, 256);
+#if defined(MOVEMM_TRACKING_MODE)
+        REQUIRE(!movemm_get_tracked_allocation(ptrs[0], nullptr));
+        REQUIRE(!movemm_get_tracked_allocation(ptrs[255], nullptr));
+#endif
+    }
+}
+
+SCENARIO("Testing sized frees")
+{
+    GIVEN("Objects and arrays whose sizes are known")
+    {
+        struct object
+        {
+            int64_t values[5];
+        };
+
+        auto ptr = movemm::mmnew<object>();
+        auto aligned = movemm_aligned_alloc(200, 128);
+        std::vector<int, movemm::stl_allocator<int>> values;
+        for (int i = 0; i < 1000; ++i)
+        {
+            values.push_back(i);
+        }
+
+        THEN("They are freed with their sizes")
+        {
+            movemm::mmdelete(ptr);
+            movemm_aligned_free_sized(aligned, 200, 128);
+            values = {};
+            values.shrink_to_fit();
+            REQUIRE(values.capacity() == 0);
+#if defined(MOVEMM_TRACKING_MODE)
+            REQUIRE(!movemm_get_tracked_allocation(ptr, nullptr));
+            REQUIRE(!movemm_get_tracked_allocation(aligned, nullptr));
+#endif
+        }
+    }
+
+    GIVEN("A null pointer")
+    {
+        THEN("Freeing it does nothing")
+        {
+            movemm_free_sized(nullptr, 16);
+            movemm_aligned_free_sized(nullptr, 16, 64);
+        }
+    }
+}
+
+#if defined(MOVEMM_GLOBAL_NEW_DELETE)
+SCENARIO("Testing the global operator new and delete replacement")
+{
+    GIVEN("Objects created with every form of new")
+    {
+        struct alignas(128) aligned_object
+        {
+            char data[200];
+        };
+
+        auto value = new int64_t(5);
+        auto values = new int64_t[100];
+        auto aligned = new aligned_object();
+        auto alignedArray = new aligned_object[4];
+        auto nothrow = new (std::nothrow) int64_t(6);
+        auto alignedNothrow = new (std::nothrow) aligned_object();
+
+        THEN("They come from movemm")
+        {
+            REQUIRE(movemm_usable_size(value) >= sizeof(int64_t));
+            REQUIRE(movemm_usable_size(values) >= 100 * sizeof(int64_t));
+            REQUIRE(movemm_usable_size(nothrow) >= sizeof(int64_t));
+            REQUIRE(reinterpret_cast<uintptr_t>(aligned) % 128 == 0);
+            REQUIRE(reinterpret_cast<uintptr_t>(alignedArray) % 128 == 0);
+            REQUIRE(reinterpret_cast<uintptr_t>(alignedNothrow) % 128 == 0);
+#if defined(MOVEMM_TRACKING_MODE)
+            movemm_tracked_allocation_t record;
+            REQUIRE(movemm_get_tracked_allocation(value, &record));
+            REQUIRE(record.size == sizeof(int64_t));
+            REQUIRE(movemm_get_tracked_allocation(aligned, &record));
+            REQUIRE(record.alignment == 128);
+#endif
+        }
+
+        delete value;
+        delete[] values;
+        delete aligned;
+        delete[] alignedArray;
+        delete nothrow;
+        delete alignedNothrow;
+
+#if defined(MOVEMM_TRACKING_MODE)
+        REQUIRE(!movemm_get_tracked_allocation(value, nullptr));
+        REQUIRE(!movemm_get_tracked_allocation(aligned, nullptr));
+#endif
+    }
+
+    GIVEN("A new_handler that frees memory")
+    {
+        static void* reserve;
+        static int calls;
+        reserve = movemm_alloc(1024);
+        calls = 0;
+        auto previous = std::set_new_handler(
+            []
+            {
+                ++calls;
+                movemm_free(reserve);
+                reserve = nullptr;
+                std::set_new_handler(nullptr);
+            });
+
+        THEN("An impossible allocation runs it and then throws")
+        {
+            REQUIRE_THROWS_AS(
+                operator new(size_t(-1) / 2), std::bad_alloc);
+            REQUIRE(calls == 1);
+            REQUIRE(operator new(size_t(-1) / 2, std::nothrow) == nullptr);
+        }
+
+        std::set_new_handler(previous);
+        movemm_free(reserve);
+    }
+}
+#endif
+
+// Reads the header totals of a heap profile written by movemm_profile_dump
+struct profile_header
+{
+    long long liveCount = -1, liveBytes = -1, allocCount = -1, allocBytes = -1;
+    std::string period;
+    bool mappedLibraries = false;
+};
+
+static profile_header read_profile(const std::string& path)
+{
+    profile_header res;
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    char period[64] = {};
+    sscanf(line.c_str(), "heap profile: %lld: %lld [%lld: %lld] @ %63s",
+        &res.liveCount, &res.liveBytes, &res.allocCount, &res.allocBytes,
+        period);
+    res.period = period;
+    while (std::getline(file, line))
+    {
+        res.mappedLibraries |= line == "MAPPED_LIBRARIES:";
+    }
+    return res;
+}
+
+SCENARIO("Testing the sampling heap profiler")
+{
+    auto path =
+        (std::filesystem::temp_directory_path() / "movemm_profile_test.heap")
+            .string();
+
+    GIVEN("Sampling enabled with a small period")
+    {
+        movemm_profile_set_sample_period(1024);
+        REQUIRE(movemm_profile_get_sample_period() == 1024);
+
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 100; ++i)
+        {
+            ptrs.push_back(movemm_alloc(64 * 1024));
+        }
+
+        WHEN("A profile is dumped")
+        {
+            REQUIRE(movemm_profile_dump(path.c_str()));
+            auto profile = read_profile(path);
+
+            THEN("It is a heap_v2 profile that includes the allocations")
+            {
+                REQUIRE(profile.period == "heap_v2/1024");
+                REQUIRE(profile.liveCount >= 100);
+                REQUIRE(profile.liveBytes >= 100 * 64 * 1024);
+                REQUIRE(profile.allocBytes >= profile.liveBytes);
+#if defined(__linux__)
+                REQUIRE(profile.mappedLibraries);
+#endif
+            }
+
+            AND_WHEN("The allocations are freed")
+            {
+                for (auto ptr : ptrs)
+                {
+                    movemm_free(ptr);
+                }
+                ptrs.clear();
+
+                REQUIRE(movemm_profile_dump(path.c_str()));
+                auto after = read_profile(path);
+
+                THEN("They are no longer live but still counted as allocated")
+                {
+                    REQUIRE(after.liveBytes <=
+                            profile.liveBytes - 100 * 64 * 1024);
+                    REQUIRE(after.allocBytes >= profile.allocBytes);
+                }
+            }
+        }
+
+        WHEN("An allocation fails to grow")
+        {
+            auto grown = movemm_realloc(ptrs[0], size_t(1) << 60);
+            REQUIRE(movemm_profile_dump(path.c_str()));
+            auto profile = read_profile(path);
+
+            THEN("It is still live")
+            {
+                REQUIRE(grown == nullptr);
+                REQUIRE(profile.liveCount >= 100);
+                REQUIRE(profile.liveBytes >= 100 * 64 * 1024);
+            }
+        }
+
+        for (auto ptr : ptrs)
+        {
+            movemm_free(ptr);
+        }
+        movemm_profile_set_sample_period(0);
+        std::filesystem::remove(path);
+    }
+}
+
+SCENARIO("Testing heaps")
+{
+    GIVEN("A heap with a few allocations")
+    {
+        auto heap = movemm_create_heap();
+        auto small = movemm_heap_alloc(heap, 24);
+        auto zeroed = static_cast<int*>(movemm_heap_calloc(heap, 16, 4));
+        auto aligned = movemm_heap_aligned_alloc(heap, 100, 256);
+
+        THEN("They are usable, zeroed and aligned as asked")
+        {
+            REQUIRE(movemm_usable_size(small) >= 24);
+            for (int i = 0; i < 16; ++i)
+            {
+                REQUIRE(zeroed[i] == 0);
+            }
+            REQUIRE(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+        }
+
+        WHEN("They are reallocated")
+        {
+            memset(small, 7, 24);
+            small = movemm_heap_realloc(heap, small, 4096);
+            aligned = movemm_heap_aligned_realloc(heap, aligned, 4096, 256);
+
+            THEN("Their contents and alignment are kept")
+            {
+                REQUIRE(movemm_usable_size(small) >= 4096);
+                REQUIRE(static_cast<char*>(small)[23] == 7);
+                REQUIRE(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+            }
+        }
+
+        WHEN("Their blocks are visited")
+        {
+            struct visitor
+            {
+                static int visit(void* ptr, size_t bytes, void* userData)
+                {
+                    static_cast<std::vector<void*>*>(userData)->push_back(ptr);
+                    return 1;
+                }
+
+                static int stop(void*, size_t, void*)
+                {
+                    return 0;
+                }
+            };
+
+            std::vector<void*> visited;
+            REQUIRE(movemm_heap_visit_blocks(heap, &visitor::visit, &visited));
+
+            THEN("Every live allocation is seen")
+            {
+                REQUIRE(visited.size() == 3);
+                for (auto ptr : {small, (void*)zeroed, aligned})
+                {
+                    REQUIRE(std::find(visited.begin(), visited.end(), ptr) !=
+                            visited.end());
+                }
+                REQUIRE(!movemm_heap_visit_blocks(heap, &visitor::stop, 0));
+            }
+        }
+
+        WHEN("One of them is freed on another thread")
+        {
+            std::thread(
+                [&]
+                {
+                    movemm_heap_free(heap, small);
+                })
+                .join();
+            movemm_heap_collect(heap, 1);
+
+            THEN("The others are still visited")
+            {
+                size_t count = 0;
+                movemm_heap_visit_blocks(
+                    heap,
+                    [](void*, size_t, void* userData)
+                    {
+                        ++*static_cast<size_t*>(userData);
+                        return 1;
+                    },
+                    &count);
+                REQUIRE(count == 2);
+            }
+        }
+
+        movemm_destroy_heap(heap);
+    }
+}
 
 // SCENARIO("Testing stack allocations")
 // {
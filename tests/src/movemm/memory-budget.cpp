@@ -0,0 +1,394 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/memory-allocator.h>
+
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    size_t usage_of(movemm_budget_category_t category)
+    {
+        movemm_budget_statistics_t stats;
+        movemm_budget_get_statistics(category, &stats);
+        return stats.usage;
+    }
+
+    struct soft_limit_calls
+    {
+        movemm_budget_category_t category = MOVEMM_BUDGET_NONE;
+        size_t usage = 0;
+        size_t limit = 0;
+        int count = 0;
+        void* allocated = 0;
+    };
+
+    // Allocates from a tagged heap and movemm_alloc to show the callback
+    // may, even when the tagged heap is what went over the limit
+    void on_soft_limit(movemm_budget_category_t category, size_t usage,
+        size_t limit, void* user_data)
+    {
+        auto& calls = *static_cast<soft_limit_calls*>(user_data);
+        calls.category = category;
+        calls.usage = usage;
+        calls.limit = limit;
+        calls.count += 1;
+        movemm_tagged_heap_alloc({412}, 16);
+        calls.allocated = movemm_alloc(16);
+    }
+}  // namespace
+
+SCENARIO("Testing memory budget categories")
+{
+    GIVEN("Registered categories")
+    {
+        auto audio = movemm_budget_register("test-audio");
+        auto rendering = movemm_budget_register("test-rendering");
+
+        THEN("Each name has its own category")
+        {
+            REQUIRE(audio != MOVEMM_BUDGET_NONE);
+            REQUIRE(rendering != MOVEMM_BUDGET_NONE);
+            REQUIRE(audio != rendering);
+            REQUIRE(movemm_budget_register("test-audio") == audio);
+            REQUIRE(strcmp(movemm_budget_get_name(audio), "test-audio") == 0);
+            REQUIRE(movemm_budget_get_name(MOVEMM_BUDGET_NONE) == 0);
+        }
+
+        THEN("Scopes nest and restore the thread's category")
+        {
+            REQUIRE(movemm_budget_get_thread_category() == MOVEMM_BUDGET_NONE);
+            movemm_budget_category_t inner;
+            movemm_budget_category_t outer;
+            {
+                movemm::budget_scope audioScope(audio);
+                {
+                    movemm::budget_scope renderingScope(rendering);
+                    inner = movemm_budget_get_thread_category();
+                }
+                outer = movemm_budget_get_thread_category();
+            }
+            REQUIRE(inner == rendering);
+            REQUIRE(outer == audio);
+            REQUIRE(movemm_budget_get_thread_category() == MOVEMM_BUDGET_NONE);
+        }
+
+        THEN("Unregistered categories leave the thread uncharged")
+        {
+            movemm_budget_set_thread_category(MOVEMM_BUDGET_MAX_CATEGORIES);
+            auto category = movemm_budget_get_thread_category();
+            movemm_budget_set_thread_category(MOVEMM_BUDGET_NONE);
+            REQUIRE(category == MOVEMM_BUDGET_NONE);
+        }
+    }
+}
+
+SCENARIO("Testing memory budget accounting")
+{
+    GIVEN("A category")
+    {
+        auto category = movemm_budget_register("test-accounting");
+        auto before = usage_of(category);
+
+        WHEN("Memory is allocated in its scope")
+        {
+            void* ptr;
+            void* aligned;
+            void* batch[4];
+            size_t batched;
+            {
+                movemm::budget_scope scope(category);
+                ptr = movemm_alloc(1000);
+                aligned = movemm_aligned_alloc(256, 64);
+                batched = movemm_alloc_batch(32, 4, batch);
+            }
+            auto expected = movemm_usable_size(ptr) +
+                            movemm_usable_size(aligned) +
+                            4 * movemm_usable_size(batch[0]);
+
+            THEN("It is charged its usable size until freed")
+            {
+                REQUIRE(batched == 4);
+                REQUIRE(usage_of(category) == before + expected);
+
+                movemm_free(ptr);
+                movemm_aligned_free(aligned, 64);
+                movemm_free_batch(batch, 4);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("Memory is allocated into the category explicitly")
+        {
+            auto ptr = movemm_budget_alloc(category, 500);
+            auto aligned = movemm_budget_aligned_alloc(category, 128, 128);
+            auto charged = usage_of(category);
+            auto expected =
+                movemm_usable_size(ptr) + movemm_usable_size(aligned);
+            movemm_free(ptr);
+            movemm_aligned_free(aligned, 128);
+
+            THEN("It is charged while the thread's category is unchanged")
+            {
+                REQUIRE(movemm_budget_get_thread_category() ==
+                        MOVEMM_BUDGET_NONE);
+                REQUIRE(reinterpret_cast<uintptr_t>(aligned) % 128 == 0);
+                REQUIRE(charged == before + expected);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("A charged allocation is reallocated outside of the scope")
+        {
+            void* ptr;
+            {
+                movemm::budget_scope scope(category);
+                ptr = movemm_alloc(100);
+            }
+            ptr = movemm_realloc(ptr, 100000);
+            auto charged = usage_of(category);
+            auto expected = movemm_usable_size(ptr);
+            movemm_free(ptr);
+
+            THEN("It stays in its category")
+            {
+                REQUIRE(charged == before + expected);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("An uncharged allocation is reallocated in the scope")
+        {
+            auto ptr = static_cast<char*>(movemm_alloc(64));
+            memset(ptr, 0x5a, 64);
+            {
+                movemm::budget_scope scope(category);
+                ptr = static_cast<char*>(movemm_realloc(ptr, 128));
+            }
+            auto charged = usage_of(category);
+            auto expected = movemm_usable_size(ptr);
+            auto kept = ptr[0] == 0x5a && ptr[63] == 0x5a;
+            movemm_free(ptr);
+
+            THEN("It moves into the category with its contents")
+            {
+                REQUIRE(kept);
+                REQUIRE(charged == before + expected);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("Memory is freed on another thread")
+        {
+            void* ptrs[64];
+            {
+                movemm::budget_scope scope(category);
+                for (auto& ptr : ptrs)
+                {
+                    ptr = movemm_alloc(4096);
+                }
+            }
+            auto charged = usage_of(category);
+
+            std::thread worker(
+                [&]
+                {
+                    for (auto& ptr : ptrs)
+                    {
+                        movemm_free(ptr);
+                    }
+                });
+            worker.join();
+
+            THEN("The category is credited")
+            {
+                REQUIRE(charged >= before + 64 * 4096);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("Memory is allocated from a heap in its scope")
+        {
+            auto heap = movemm_create_heap();
+            void* ptr;
+            void* freed;
+            {
+                movemm::budget_scope scope(category);
+                ptr = movemm_heap_alloc(heap, 2000);
+                freed = movemm_heap_calloc(heap, 10, 10);
+                ptr = movemm_heap_realloc(heap, ptr, 3000);
+            }
+            auto uncharged = movemm_heap_alloc(heap, 100);
+            auto charged = usage_of(category);
+            auto remaining = movemm_usable_size(ptr);
+            auto expected = remaining + movemm_usable_size(freed);
+
+            size_t visited = 0;
+            movemm_heap_visit_blocks(
+                heap,
+                [](void*, size_t, void* user_data)
+                {
+                    ++*static_cast<size_t*>(user_data);
+                    return 1;
+                },
+                &visited);
+
+            movemm_heap_free(heap, freed);
+            auto afterFree = usage_of(category);
+            movemm_destroy_heap(heap);
+
+            THEN("Freeing or destroying the heap credits the category")
+            {
+                REQUIRE(uncharged != nullptr);
+                REQUIRE(visited == 3);
+                REQUIRE(charged == before + expected);
+                REQUIRE(afterFree == before + remaining);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+
+        WHEN("A tagged heap is allocated from in its scope")
+        {
+            movemm_heap_tag_t tag = {410};
+            {
+                movemm::budget_scope scope(category);
+                for (int i = 0; i < 100; ++i)
+                {
+                    movemm_tagged_heap_alloc(tag, 1024);
+                }
+            }
+            auto charged = usage_of(category);
+            movemm_tagged_heap_free(tag);
+
+            THEN("It is charged a page at a time until the tag is freed")
+            {
+                REQUIRE(charged >= before + MOVEMM_TAGGED_HEAP_PAGE_SIZE);
+                REQUIRE(charged < before + 2 * MOVEMM_TAGGED_HEAP_PAGE_SIZE);
+                REQUIRE(usage_of(category) == before);
+            }
+        }
+    }
+}
+
+SCENARIO("Testing memory budget limits")
+{
+    GIVEN("A category with a hard limit")
+    {
+        auto category = movemm_budget_register("test-hard-limit");
+        movemm_budget_set_limits(category, 0, 1024 * 1024);
+
+        WHEN("Allocations would go over it")
+        {
+            movemm_budget_statistics_t before;
+            movemm_budget_get_statistics(category, &before);
+
+            void* small;
+            void* large;
+            void* aligned;
+            void* tagged;
+            void* grown;
+            void* batch[32];
+            size_t batched;
+            auto heap = movemm_create_heap();
+            void* overflowing;
+            {
+                movemm::budget_scope scope(category);
+                small = movemm_alloc(1024);
+                large = movemm_alloc(2 * 1024 * 1024);
+                aligned = movemm_aligned_alloc(2 * 1024 * 1024, 64);
+                tagged = movemm_tagged_heap_alloc({411}, 16);
+                grown = movemm_realloc(small, 2 * 1024 * 1024);
+                batched = movemm_alloc_batch(64 * 1024, 32, batch);
+
+                // Wraps around to 4 bytes, and fails before being charged
+                overflowing = movemm_heap_calloc(heap, SIZE_MAX / 4 + 2, 4);
+            }
+            movemm_destroy_heap(heap);
+            auto explicitly = movemm_budget_alloc(category, 2 * 1024 * 1024);
+
+            movemm_budget_statistics_t after;
+            movemm_budget_get_statistics(category, &after);
+            auto expected = before.usage + movemm_usable_size(small);
+            movemm_free(small);
+            movemm_tagged_heap_free({411});
+
+            THEN("They fail and are counted")
+            {
+                REQUIRE(small != nullptr);
+                REQUIRE(large == nullptr);
+                REQUIRE(aligned == nullptr);
+                REQUIRE(tagged == nullptr);
+                REQUIRE(grown == nullptr);
+                REQUIRE(explicitly == nullptr);
+                REQUIRE(batched == 0);
+                REQUIRE(overflowing == nullptr);
+                REQUIRE(after.hard_limit == 1024 * 1024);
+                REQUIRE(after.failed_allocations ==
+                        before.failed_allocations + 6);
+                REQUIRE(after.usage == expected);
+            }
+        }
+
+        movemm_budget_set_limits(category, 0, 0);
+    }
+
+    GIVEN("A category with a soft limit and a callback")
+    {
+        auto category = movemm_budget_register("test-soft-limit");
+        movemm_budget_set_limits(category, 256 * 1024, 0);
+
+        soft_limit_calls calls;
+        movemm_budget_set_soft_limit_callback(category, &on_soft_limit, &calls);
+
+        WHEN("Allocations go over it")
+        {
+            void* ptrs[8];
+            {
+                movemm::budget_scope scope(category);
+                for (auto& ptr : ptrs)
+                {
+                    ptr = movemm_alloc(64 * 1024);
+                }
+            }
+
+            THEN("The callback is called once, on the allocating thread")
+            {
+                REQUIRE(calls.count == 1);
+                REQUIRE(calls.category == category);
+                REQUIRE(calls.limit == 256 * 1024);
+                REQUIRE(calls.usage >= 256 * 1024);
+                REQUIRE(calls.allocated != nullptr);
+
+                movemm_budget_statistics_t stats;
+                movemm_budget_get_statistics(category, &stats);
+                REQUIRE(stats.soft_limit_exceeded >= 1);
+            }
+
+            for (auto& ptr : ptrs)
+            {
+                movemm_free(ptr);
+            }
+            movemm_free(calls.allocated);
+        }
+
+        WHEN("A tagged heap goes over it")
+        {
+            {
+                movemm::budget_scope scope(category);
+                movemm_tagged_heap_alloc({413}, 16);
+            }
+
+            THEN("The callback can allocate from the tagged heap")
+            {
+                REQUIRE(calls.count == 1);
+                REQUIRE(calls.allocated != nullptr);
+            }
+            movemm_free(calls.allocated);
+            movemm_tagged_heap_free({413});
+        }
+
+        movemm_tagged_heap_free({412});
+        movemm_budget_set_soft_limit_callback(category, 0, 0);
+        movemm_budget_set_limits(category, 0, 0);
+    }
+}
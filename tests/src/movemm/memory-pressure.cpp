@@ -0,0 +1,232 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/memory-allocator.h>
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    // Far more than can ever be allocated, but small enough that the tagged
+    // heap can still work out a page size for it
+    constexpr size_t impossible_bytes = size_t(1) << 60;
+
+    struct pressure_calls
+    {
+        std::vector<movemm_memory_pressure_t> levels;
+        std::vector<size_t> bytes;
+    };
+
+    void on_pressure(movemm_memory_pressure_t level, size_t bytes, void* data)
+    {
+        auto& calls = *static_cast<pressure_calls*>(data);
+        calls.levels.push_back(level);
+        calls.bytes.push_back(bytes);
+    }
+
+    struct oom_calls
+    {
+        std::vector<uint32_t> attempts;
+        size_t bytes = 0;
+        uint32_t retries = 0;
+        void* nested = 0;
+    };
+
+    // Asks for a few retries, and allocates the same amount itself to show
+    // that it isn't called again from inside
+    int on_oom(size_t bytes, uint32_t attempt, void* data)
+    {
+        auto& calls = *static_cast<oom_calls*>(data);
+        calls.attempts.push_back(attempt);
+        calls.bytes = bytes;
+        calls.nested = movemm_alloc(bytes);
+        return attempt < calls.retries;
+    }
+}  // namespace
+
+SCENARIO("Testing memory pressure callbacks")
+{
+    GIVEN("A pressure callback")
+    {
+        pressure_calls calls;
+        movemm_set_pressure_callback(&on_pressure, &calls);
+
+        WHEN("Pressure is signalled")
+        {
+            movemm_signal_memory_pressure(MOVEMM_MEMORY_PRESSURE_MODERATE);
+            movemm_signal_memory_pressure(MOVEMM_MEMORY_PRESSURE_CRITICAL);
+
+            THEN("It is called with each level and no allocation size")
+            {
+                REQUIRE(calls.levels.size() == 2);
+                REQUIRE(calls.levels[0] == MOVEMM_MEMORY_PRESSURE_MODERATE);
+                REQUIRE(calls.levels[1] == MOVEMM_MEMORY_PRESSURE_CRITICAL);
+                REQUIRE(calls.bytes[0] == 0);
+                REQUIRE(calls.bytes[1] == 0);
+            }
+        }
+
+        WHEN("An allocation fails")
+        {
+            auto ptr = movemm_alloc(impossible_bytes);
+
+            THEN("It is called once at the critical level before failing")
+            {
+                REQUIRE(ptr == nullptr);
+                REQUIRE(calls.levels.size() == 1);
+                REQUIRE(calls.levels[0] == MOVEMM_MEMORY_PRESSURE_CRITICAL);
+                REQUIRE(calls.bytes[0] == impossible_bytes);
+            }
+        }
+
+        movemm_set_pressure_callback(0, 0);
+    }
+}
+
+SCENARIO("Testing the out of memory handler")
+{
+    GIVEN("A handler that asks for two retries")
+    {
+        pressure_calls pressure;
+        movemm_set_pressure_callback(&on_pressure, &pressure);
+
+        oom_calls calls;
+        calls.retries = 2;
+        movemm_set_oom_handler(&on_oom, &calls);
+
+        WHEN("An allocation fails")
+        {
+            auto ptr = movemm_alloc(impossible_bytes);
+
+            THEN("It is called until it gives up, after the pressure callback")
+            {
+                REQUIRE(ptr == nullptr);
+                REQUIRE(pressure.levels.size() == 1);
+                REQUIRE(calls.attempts == std::vector<uint32_t>{0, 1, 2});
+                REQUIRE(calls.bytes == impossible_bytes);
+                REQUIRE(calls.nested == nullptr);
+            }
+        }
+
+        WHEN("Other allocation functions fail")
+        {
+            auto small = movemm_alloc(16);
+            auto grown = movemm_realloc(small, impossible_bytes);
+            auto aligned = movemm_aligned_alloc(impossible_bytes, 64);
+            void* batch[2];
+            auto batched = movemm_alloc_batch(impossible_bytes, 2, batch);
+            movemm_free(small);
+
+            THEN("Each of them calls it")
+            {
+                REQUIRE(grown == nullptr);
+                REQUIRE(aligned == nullptr);
+                REQUIRE(batched == 0);
+                REQUIRE(calls.attempts.size() == 9);
+                REQUIRE(pressure.levels.size() == 3);
+            }
+        }
+
+        WHEN("A heap allocation fails")
+        {
+            auto heap = movemm_create_heap();
+            auto ptr = movemm_heap_alloc(heap, impossible_bytes);
+            movemm_destroy_heap(heap);
+
+            THEN("It returns null rather than throwing")
+            {
+                REQUIRE(ptr == nullptr);
+                REQUIRE(calls.attempts.size() == 3);
+            }
+        }
+
+        WHEN("A tagged heap allocation fails")
+        {
+            movemm_heap_tag_t tag = {420};
+            auto ptr = movemm_tagged_heap_alloc(tag, impossible_bytes);
+            void* batch[2];
+            auto batched =
+                movemm_tagged_heap_alloc_batch(tag, impossible_bytes, 2, batch);
+            auto small = movemm_tagged_heap_alloc(tag, 16);
+            movemm_tagged_heap_free(tag);
+
+            THEN("It is called once the tagged heap has released its locks")
+            {
+                REQUIRE(ptr == nullptr);
+                REQUIRE(batched == 0);
+                REQUIRE(small != nullptr);
+                REQUIRE(calls.attempts.size() == 6);
+                REQUIRE(pressure.levels.size() == 2);
+            }
+        }
+
+        WHEN("A tagged heap allocation throws")
+        {
+            // Far ahead of any frame the ring could have reached
+            auto tag = movemm_tagged_heap_ring_tag(uint64_t(1) << 40);
+            auto threw = false;
+            try
+            {
+                movemm_tagged_heap_alloc(tag, 16);
+            }
+            catch (const std::runtime_error&)
+            {
+                threw = true;
+            }
+            auto ptr = movemm_alloc(impossible_bytes);
+
+            THEN("Later failures still call it")
+            {
+                REQUIRE(threw);
+                REQUIRE(ptr == nullptr);
+                REQUIRE(calls.attempts.size() == 3);
+            }
+        }
+
+        movemm_set_oom_handler(0, 0);
+        movemm_set_pressure_callback(0, 0);
+    }
+}
+
+SCENARIO("Testing the emergency reserve")
+{
+    // The reserve lasts for the whole process, so it is only set up once
+    GIVEN("A reserve that is allocated from until it runs out")
+    {
+        constexpr size_t reserved = 64 * 1024;
+        auto unreserved = movemm_emergency_alloc(16);
+        auto reservedFirst = movemm_reserve_emergency_memory(reserved);
+        auto reservedAgain = movemm_reserve_emergency_memory(reserved);
+        auto initial = movemm_get_emergency_memory_remaining();
+
+        auto first = static_cast<char*>(movemm_emergency_alloc(1));
+        auto second = static_cast<char*>(movemm_emergency_alloc(100));
+        memset(second, 0xff, 100);
+        auto remaining = movemm_get_emergency_memory_remaining();
+        auto rest = movemm_emergency_alloc(remaining);
+        auto exhausted = movemm_emergency_alloc(1);
+
+        THEN("Only the first reservation counts and allocations never overlap")
+        {
+            REQUIRE(unreserved == nullptr);
+            REQUIRE(reservedFirst == 1);
+            REQUIRE(reservedAgain == 0);
+            REQUIRE(initial == reserved);
+
+            REQUIRE(first != nullptr);
+            REQUIRE(reinterpret_cast<uintptr_t>(first) %
+                        alignof(std::max_align_t) ==
+                    0);
+            REQUIRE(reinterpret_cast<uintptr_t>(second) %
+                        alignof(std::max_align_t) ==
+                    0);
+            REQUIRE(second >= first + 1);
+            REQUIRE(remaining < reserved - 100);
+            REQUIRE(rest != nullptr);
+            REQUIRE(exhausted == nullptr);
+            REQUIRE(movemm_get_emergency_memory_remaining() == 0);
+        }
+    }
+}
@@ -0,0 +1,308 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/memory-allocator.h>
+#include <movemm/memory-trace.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct traced_event
+    {
+        uint32_t thread;
+        movemm_trace_event_t event;
+    };
+
+    struct trace_contents
+    {
+        movemm_trace_file_header_t header = {};
+        std::vector<traced_event> events;
+    };
+
+    // Reads the complete chunks of a trace file in sequence order
+    trace_contents read_trace(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+
+        trace_contents res;
+        if (data.size() < MOVEMM_TRACE_CHUNK_BYTES) return res;
+        memcpy(&res.header, data.data(), sizeof(res.header));
+
+        std::vector<std::pair<uint64_t, const char*>> chunks;
+        for (uint64_t i = 0; i < res.header.chunk_count; ++i)
+        {
+            auto chunk = data.data() + (i + 1) * MOVEMM_TRACE_CHUNK_BYTES;
+            movemm_trace_chunk_header_t chunkHeader;
+            memcpy(&chunkHeader, chunk, sizeof(chunkHeader));
+            if (chunkHeader.sequence)
+            {
+                chunks.emplace_back(chunkHeader.sequence, chunk);
+            }
+        }
+        std::sort(chunks.begin(), chunks.end());
+
+        for (auto& [sequence, chunk] : chunks)
+        {
+            movemm_trace_chunk_header_t chunkHeader;
+            memcpy(&chunkHeader, chunk, sizeof(chunkHeader));
+            for (uint32_t i = 0; i < chunkHeader.count; ++i)
+            {
+                traced_event event = {chunkHeader.thread, {}};
+                memcpy(&event.event,
+                    chunk + sizeof(chunkHeader) +
+                        i * sizeof(movemm_trace_event_t),
+                    sizeof(movemm_trace_event_t));
+                res.events.push_back(event);
+            }
+        }
+        return res;
+    }
+
+    size_t count_events(const trace_contents& trace, uint32_t type)
+    {
+        return std::count_if(trace.events.begin(), trace.events.end(),
+            [type](const traced_event& event)
+            {
+                return MOVEMM_TRACE_EVENT_TYPE(event.event.header) == type;
+            });
+    }
+
+    // With the global operator new replaced, the test's own containers and
+    // threads are traced too, and their addresses may be reused, so general
+    // allocations are only checked for by pointer
+    size_t count_events(
+        const trace_contents& trace, uint32_t type, const void* ptr)
+    {
+        return std::count_if(trace.events.begin(), trace.events.end(),
+            [type, ptr](const traced_event& event)
+            {
+                return MOVEMM_TRACE_EVENT_TYPE(event.event.header) == type &&
+                       event.event.ptr == reinterpret_cast<uintptr_t>(ptr);
+            });
+    }
+}  // namespace
+
+SCENARIO("Testing allocation tracing")
+{
+    auto path =
+        (std::filesystem::temp_directory_path() / "movemm_trace_test.bin")
+            .string();
+
+    GIVEN("A running trace")
+    {
+        REQUIRE(movemm_trace_start(path.c_str(), 1024 * 1024));
+        REQUIRE_FALSE(movemm_trace_start(path.c_str(), 1024 * 1024));
+
+        WHEN("Allocations are made on several threads")
+        {
+            auto first = movemm_alloc(100);
+            auto ptr = movemm_realloc(first, 200);
+            movemm_free(ptr);
+            auto aligned = movemm_aligned_alloc(64, 256);
+            movemm_aligned_free(aligned, 256);
+
+            auto heap = movemm_create_heap();
+            auto heapPtr = movemm_heap_alloc(heap, 32);
+            movemm_heap_free(heap, heapPtr);
+            movemm_destroy_heap(heap);
+
+            movemm_heap_tag_t tag = {400};
+            std::thread worker(
+                [tag]
+                {
+                    for (int i = 0; i < 1000; ++i)
+                    {
+                        movemm_tagged_heap_alloc(tag, 16);
+                    }
+                });
+            worker.join();
+
+            // Frees made by tag destructors are the caller's own
+            auto owned = movemm_alloc(8);
+            movemm_register_tagged_heap_destructor(tag, owned,
+                [](void* ptr)
+                {
+                    movemm_free(ptr);
+                });
+            movemm_tagged_heap_free(tag);
+            movemm_trace_stop();
+
+            auto trace = read_trace(path);
+
+            THEN("Every event is written to the file")
+            {
+                REQUIRE(trace.header.magic == MOVEMM_TRACE_MAGIC);
+                REQUIRE(trace.header.version == MOVEMM_TRACE_VERSION);
+                REQUIRE(trace.header.chunk_bytes == MOVEMM_TRACE_CHUNK_BYTES);
+
+                REQUIRE(count_events(trace, MOVEMM_TRACE_ALLOC, first) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_REALLOC, ptr) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_FREE, ptr) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_ALLOC, aligned) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_FREE, aligned) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_ALLOC, owned) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_FREE, owned) >= 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_HEAP_ALLOC) == 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_HEAP_FREE) == 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_HEAP_DESTROY) == 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_TAGGED_ALLOC) == 1000);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_TAGGED_FREE) == 1);
+            }
+
+            THEN("Events carry their thread, sizes and alignment")
+            {
+                std::set<uint32_t> threads;
+                for (auto& traced : trace.events)
+                {
+                    threads.insert(traced.thread);
+                    auto& event = traced.event;
+                    switch (MOVEMM_TRACE_EVENT_TYPE(event.header))
+                    {
+                    case MOVEMM_TRACE_REALLOC:
+                        if (event.ptr == reinterpret_cast<uintptr_t>(ptr))
+                        {
+                            REQUIRE(event.size == 200);
+                            REQUIRE(event.extra ==
+                                    reinterpret_cast<uintptr_t>(first));
+                        }
+                        break;
+                    case MOVEMM_TRACE_TAGGED_ALLOC:
+                        REQUIRE(event.size == 16);
+                        REQUIRE(event.extra == 400);
+                        break;
+                    case MOVEMM_TRACE_ALLOC:
+                        if (event.ptr == reinterpret_cast<uintptr_t>(aligned))
+                        {
+                            REQUIRE(MOVEMM_TRACE_EVENT_ALIGNMENT(
+                                        event.header) == 256);
+                        }
+                        break;
+                    }
+                }
+                REQUIRE(threads.size() == 2);
+            }
+        }
+
+        WHEN("A batch is allocated")
+        {
+            void* batch[10];
+            auto batched = movemm_alloc_batch(48, 10, batch);
+            movemm_trace_stop();
+            movemm_free_batch(batch, batched);
+
+            auto trace = read_trace(path);
+
+            THEN("It is recorded as one event followed by its pointers")
+            {
+                REQUIRE(batched == 10);
+                REQUIRE(count_events(
+                            trace, MOVEMM_TRACE_ALLOC_BATCH, batch[0]) == 1);
+
+                auto found = std::find_if(trace.events.begin(),
+                    trace.events.end(),
+                    [&](const traced_event& traced)
+                    {
+                        return MOVEMM_TRACE_EVENT_TYPE(traced.event.header) ==
+                                   MOVEMM_TRACE_ALLOC_BATCH &&
+                               traced.event.ptr ==
+                                   reinterpret_cast<uintptr_t>(batch[0]);
+                    });
+                REQUIRE(found->event.size == 48);
+                REQUIRE(found->event.extra == 10);
+                REQUIRE(trace.events.end() - found >
+                        MOVEMM_TRACE_BATCH_EVENTS(10));
+
+                uint64_t packed[4 * MOVEMM_TRACE_BATCH_EVENTS(10)];
+                for (size_t i = 0; i < MOVEMM_TRACE_BATCH_EVENTS(10); ++i)
+                {
+                    memcpy(packed + 4 * i, &found[i + 1].event,
+                        sizeof(movemm_trace_event_t));
+                }
+                for (size_t i = 1; i < 10; ++i)
+                {
+                    REQUIRE(packed[i - 1] ==
+                            reinterpret_cast<uintptr_t>(batch[i]));
+                }
+            }
+        }
+
+        WHEN("A tag is rewound to a marker")
+        {
+            movemm_heap_tag_t tag = {401};
+            movemm_tagged_heap_alloc(tag, 16);
+            auto marker = movemm_tagged_heap_get_marker(tag);
+            movemm_tagged_heap_alloc(tag, 32);
+            movemm_tagged_heap_rewind(tag, marker);
+            movemm_tagged_heap_free(tag);
+            movemm_trace_stop();
+
+            auto trace = read_trace(path);
+
+            THEN("Taking the marker and rewinding to it both name it")
+            {
+                REQUIRE(count_events(trace, MOVEMM_TRACE_TAGGED_MARKER) == 1);
+                REQUIRE(count_events(trace, MOVEMM_TRACE_TAGGED_REWIND) == 1);
+                std::vector<uint32_t> types;
+                for (auto& traced : trace.events)
+                {
+                    auto& event = traced.event;
+                    auto type = MOVEMM_TRACE_EVENT_TYPE(event.header);
+                    if (event.extra != 401) continue;
+                    types.push_back(type);
+                    if (type == MOVEMM_TRACE_TAGGED_MARKER ||
+                        type == MOVEMM_TRACE_TAGGED_REWIND)
+                    {
+                        REQUIRE(event.ptr == marker.storage);
+                        REQUIRE(event.size == MOVEMM_TRACE_MARKER_POSITION(
+                                                  marker.page, marker.offset));
+                    }
+                }
+                REQUIRE(types ==
+                        std::vector<uint32_t>{MOVEMM_TRACE_TAGGED_ALLOC,
+                            MOVEMM_TRACE_TAGGED_MARKER,
+                            MOVEMM_TRACE_TAGGED_ALLOC,
+                            MOVEMM_TRACE_TAGGED_REWIND,
+                            MOVEMM_TRACE_TAGGED_FREE});
+            }
+        }
+
+        WHEN("More events are recorded than the ring holds")
+        {
+            movemm_trace_stop();
+            REQUIRE(movemm_trace_start(
+                path.c_str(), 4 * MOVEMM_TRACE_CHUNK_BYTES));
+            for (size_t i = 0; i < 10 * MOVEMM_TRACE_EVENTS_PER_CHUNK; ++i)
+            {
+                movemm_free(movemm_alloc(16));
+            }
+            movemm_trace_stop();
+
+            THEN("The newest chunks are kept")
+            {
+                auto trace = read_trace(path);
+                REQUIRE(trace.header.chunk_count == 3);
+                REQUIRE(trace.events.size() ==
+                        3 * MOVEMM_TRACE_EVENTS_PER_CHUNK);
+                for (size_t i = 1; i < trace.events.size(); ++i)
+                {
+                    REQUIRE(MOVEMM_TRACE_EVENT_TIME(
+                                trace.events[i - 1].event.header) <=
+                            MOVEMM_TRACE_EVENT_TIME(
+                                trace.events[i].event.header));
+                }
+            }
+        }
+
+        movemm_trace_stop();
+        std::filesystem::remove(path);
+    }
+}
@@ -0,0 +1,109 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/memory_resource.hpp>
+#include "catch2/catch_test_macros.hpp"
+
+#include <new>
+#include <string>
+#include <vector>
+
+SCENARIO("Testing memory resources")
+{
+    GIVEN("A pmr vector on the global movemm resource")
+    {
+        movemm::memory_resource resource;
+        std::pmr::vector<std::pmr::string> vec(&resource);
+        for (int i = 0; i < 100; ++i)
+        {
+            vec.emplace_back(64, 'a');
+        }
+
+        THEN("Its elements share the resource")
+        {
+            REQUIRE(vec.back().get_allocator().resource() == &resource);
+            REQUIRE(resource.is_equal(movemm::memory_resource()));
+        }
+
+        THEN("Over-aligned allocations are aligned")
+        {
+            auto ptr = resource.allocate(100, 256);
+            REQUIRE(reinterpret_cast<uintptr_t>(ptr) % 256 == 0);
+            resource.deallocate(ptr, 100, 256);
+        }
+    }
+
+    GIVEN("A pmr vector on a heap")
+    {
+        auto heap = movemm_create_heap();
+        {
+            movemm::heap_memory_resource resource(heap);
+            std::pmr::vector<int> vec(&resource);
+            vec.resize(1000);
+
+            THEN("Its memory is in the heap")
+            {
+                size_t bytes = 0;
+                movemm_heap_visit_blocks(
+                    heap,
+                    [](void*, size_t size, void* userData)
+                    {
+                        *static_cast<size_t*>(userData) += size;
+                        return 1;
+                    },
+                    &bytes);
+                REQUIRE(bytes >= 1000 * sizeof(int));
+                REQUIRE(!resource.is_equal(movemm::heap_memory_resource(0)));
+            }
+        }
+        movemm_destroy_heap(heap);
+    }
+
+    GIVEN("A pmr vector on a tag")
+    {
+        movemm_heap_tag_t tag = {310};
+        {
+            movemm::tagged_memory_resource resource(tag);
+            std::pmr::vector<int> vec(&resource);
+            for (int i = 0; i < 1000; ++i)
+            {
+                vec.push_back(i);
+            }
+
+            THEN("Its memory is held by the tag")
+            {
+                REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) > 0);
+                REQUIRE(resource.is_equal(movemm::tagged_memory_resource(tag)));
+                REQUIRE(!resource.is_equal(
+                    movemm::tagged_memory_resource({311})));
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("Resources in a category with a hard limit")
+    {
+        auto category = movemm_budget_register("test-resource-limit");
+        movemm_budget_set_limits(category, 0, 1024 * 1024);
+        auto heap = movemm_create_heap();
+        movemm_heap_tag_t tag = {312};
+
+        movemm::memory_resource global;
+        movemm::heap_memory_resource heapResource(heap);
+        movemm::tagged_memory_resource taggedResource(tag);
+
+        THEN("Allocations over it throw std::bad_alloc")
+        {
+            movemm::budget_scope scope(category);
+            auto bytes = 2 * 1024 * 1024;
+            REQUIRE_THROWS_AS(global.allocate(bytes), std::bad_alloc);
+            REQUIRE_THROWS_AS(global.allocate(bytes, 256), std::bad_alloc);
+            REQUIRE_THROWS_AS(heapResource.allocate(bytes), std::bad_alloc);
+            REQUIRE_THROWS_AS(
+                heapResource.allocate(bytes, 256), std::bad_alloc);
+            REQUIRE_THROWS_AS(taggedResource.allocate(bytes), std::bad_alloc);
+        }
+        movemm_tagged_heap_free(tag);
+        movemm_destroy_heap(heap);
+        movemm_budget_set_limits(category, 0, 0);
+    }
+}
@@ -0,0 +1,193 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/object_pool.hpp>
+#include "catch2/catch_test_macros.hpp"
+
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct particle
+    {
+        inline particle(int& count, float x) : count(count), x(x)
+        {
+            ++count;
+        }
+
+        inline ~particle()
+        {
+            --count;
+        }
+
+        int& count;
+        float x;
+    };
+
+    struct alignas(64) aligned_packet
+    {
+        char payload[100];
+    };
+}  // namespace
+
+SCENARIO("Testing object pools")
+{
+    GIVEN("A pool of particles")
+    {
+        int count = 0;
+        movemm::object_pool<particle, 4096> pool;
+
+        WHEN("Enough particles are created to need several slabs")
+        {
+            std::vector<particle*> particles;
+            for (int i = 0; i < 1000; ++i)
+            {
+                particles.push_back(pool.create(count, float(i)));
+            }
+
+            THEN("Each is constructed in its own slot owned by the pool")
+            {
+                REQUIRE(count == 1000);
+                REQUIRE(pool.slab_count() > 1);
+                std::set<particle*> unique(particles.begin(), particles.end());
+                REQUIRE(unique.size() == particles.size());
+                for (int i = 0; i < 1000; ++i)
+                {
+                    REQUIRE(particles[i]->x == float(i));
+                    REQUIRE(decltype(pool)::owner(particles[i]) == &pool);
+                }
+            }
+
+            AND_WHEN("They are destroyed and created again")
+            {
+                auto slabs = pool.slab_count();
+                for (auto ptr : particles)
+                {
+                    pool.destroy(ptr);
+                }
+                REQUIRE(count == 0);
+
+                for (int i = 0; i < 1000; ++i)
+                {
+                    particles[i] = pool.create(count, 0.0f);
+                }
+
+                THEN("The freed slots are reused")
+                {
+                    REQUIRE(pool.slab_count() == slabs);
+                }
+            }
+
+            for (auto ptr : particles)
+            {
+                pool.destroy(ptr);
+            }
+        }
+
+        WHEN("Particles are created through smart pointers")
+        {
+            auto unique = movemm::make_unique(pool, count, 1.0f);
+            static_assert(sizeof(unique) == sizeof(particle*));
+
+            movemm::shared_object_pool<particle, 4096> sharedPool;
+            auto shared =
+                movemm::make_shared<particle>(sharedPool, count, 2.0f);
+            auto copy = shared;
+
+            movemm::shared_object_pool<particle, 4096, movemm::local_refcount>
+                localPool;
+            auto local = movemm::make_shared<particle>(localPool, count, 3.0f);
+            static_assert(std::is_same_v<decltype(local),
+                movemm::local_shared_ptr<particle>>);
+            local.destroy();
+
+            THEN("They are released back to their pools")
+            {
+                REQUIRE(count == 2);
+                REQUIRE(unique->x == 1.0f);
+                REQUIRE(copy->x == 2.0f);
+                REQUIRE(shared.refcount() == 2);
+
+                unique.destroy();
+                shared.destroy();
+                REQUIRE(count == 1);
+                copy.destroy();
+                REQUIRE(count == 0);
+            }
+        }
+    }
+
+    GIVEN("A pool of over-aligned objects backed by a heap")
+    {
+        auto heap = movemm_create_heap();
+        {
+            movemm::object_pool<aligned_packet> pool(heap);
+            std::vector<aligned_packet*> packets;
+            for (int i = 0; i < 100; ++i)
+            {
+                packets.push_back(pool.create());
+            }
+
+            THEN("Every object is aligned")
+            {
+                for (auto ptr : packets)
+                {
+                    REQUIRE(reinterpret_cast<uintptr_t>(ptr) % 64 == 0);
+                }
+            }
+
+            for (auto ptr : packets)
+            {
+                pool.destroy(ptr);
+            }
+        }
+        movemm_destroy_heap(heap);
+    }
+
+    GIVEN("Objects created on one thread and destroyed on others")
+    {
+        movemm::object_pool<int64_t, 4096> pool;
+        constexpr int threadCount = 4;
+        constexpr int perThread = 2000;
+
+        std::vector<int64_t*> values;
+        for (int i = 0; i < threadCount * perThread; ++i)
+        {
+            values.push_back(pool.create(i));
+        }
+        auto slabs = pool.slab_count();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back(
+                [&, t]
+                {
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        pool.destroy(values[t * perThread + i]);
+                    }
+                });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        THEN("Their slots come back through the depot")
+        {
+            for (int i = 0; i < threadCount * perThread; ++i)
+            {
+                values[i] = pool.create(i);
+            }
+            REQUIRE(pool.slab_count() == slabs);
+
+            for (auto ptr : values)
+            {
+                pool.destroy(ptr);
+            }
+        }
+    }
+}
@@ -4,6 +4,11 @@
 #include <movemm/ptr_types.hpp>
 #include "catch2/catch_test_macros.hpp"
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
 SCENARIO("Testing pointer types")
 {
     GIVEN("A unique pointer for an int created with make_unique")
@@ -287,20 +292,20 @@ SCENARIO("Testing pointer types")
                 REQUIRE(ptr->dummy() == 2);
             }
 
-            // AND_WHEN("It is assigned to a shared pointer to the base type")
-            // {
-            //     movemm::shared_ptr<BaseType> base = ptr;
-            //     THEN(
-            //         "The pointer is not null, the refcount is 2, and the
-            //         dummy " "value returns correctly")
-            //     {
-            //         REQUIRE(base);
-            //         REQUIRE(base.valid());
-            //         REQUIRE(base.get());
-            //         REQUIRE(base.refcount() == 2);
-            //         REQUIRE(base->dummy() == 2);
-            //     }
-            // }
+            AND_WHEN("It is assigned to a shared pointer to the base type")
+            {
+                movemm::shared_ptr<BaseType> base = ptr;
+                THEN(
+                    "The pointer is not null, the refcount is 2, and the "
+                    "dummy value returns correctly")
+                {
+                    REQUIRE(base);
+                    REQUIRE(base.valid());
+                    REQUIRE(base.get());
+                    REQUIRE(base.refcount() == 2);
+                    REQUIRE(base->dummy() == 2);
+                }
+            }
         }
 
         AND_GIVEN("A unique pointer to the base type")
@@ -359,4 +364,320 @@ SCENARIO("Testing pointer types")
             }
         }
     }
-}
\ No newline at end of file
+}
+namespace
+{
+    struct counted : public movemm::ref_counted<counted>
+    {
+        inline counted(int& count) : count(count)
+        {
+            ++count;
+        }
+
+        inline ~counted()
+        {
+            --count;
+        }
+
+        int& count;
+    };
+
+    struct node : public movemm::enable_shared_from_this<node>
+    {
+        int value = 7;
+    };
+
+    struct pair_of_ints
+    {
+        int first = 1;
+        int second = 2;
+    };
+}  // namespace
+
+SCENARIO("Testing unique pointer deleters")
+{
+    GIVEN("Unique pointers with stateless deleters")
+    {
+        THEN("They are a single pointer wide")
+        {
+            static_assert(sizeof(movemm::unique_ptr<int>) == sizeof(int*));
+            static_assert(sizeof(movemm::unique_ptr<int[]>) == sizeof(int*));
+            static_assert(sizeof(movemm::unique_ptr<int,
+                              movemm::tagged_delete<int>>) == sizeof(int*));
+        }
+    }
+
+    GIVEN("A unique pointer that has been moved from")
+    {
+        auto ptr = movemm::make_unique<int>(1);
+        movemm::unique_ptr<int> other;
+        other = std::move(ptr);
+
+        THEN("It can create a new object")
+        {
+            REQUIRE(!ptr);
+            ptr.create(2);
+            REQUIRE(*ptr == 2);
+            REQUIRE(*other == 1);
+        }
+    }
+
+    GIVEN("A unique array of objects with destructors")
+    {
+        int count = 0;
+        struct counter
+        {
+            inline counter() : count(0)
+            {
+            }
+
+            inline ~counter()
+            {
+                if (count) --*count;
+            }
+
+            int* count;
+        };
+
+        auto arr = movemm::make_unique<counter[]>(10);
+        for (int i = 0; i < 10; ++i)
+        {
+            REQUIRE(arr[i].count == nullptr);
+            arr[i].count = &count;
+            ++count;
+        }
+
+        THEN("Every element is destroyed with the array")
+        {
+#if defined(MOVEMM_TRACKING_MODE)
+            // The header plus the elements, freed with exactly that size
+            movemm_tracked_allocation_t record;
+            REQUIRE(movemm_get_tracked_allocation(
+                movemm::detail::array_header<counter>::header_of(arr.get()),
+                &record));
+            REQUIRE(record.size ==
+                    movemm::detail::array_header<counter>::size +
+                        10 * sizeof(counter));
+#endif
+            arr.destroy();
+            REQUIRE(count == 0);
+        }
+
+        THEN("A count too large for a size_t of bytes makes a null array")
+        {
+            // The header and elements would wrap around to 0 bytes
+            auto huge =
+                movemm::make_unique<counter[]>(SIZE_MAX / sizeof(counter));
+            REQUIRE(!huge);
+        }
+    }
+
+    GIVEN("A unique pointer into a tagged heap")
+    {
+        movemm_heap_tag_t tag = {160};
+        int count = 0;
+        struct counted_in_tag
+        {
+            inline counted_in_tag(int& count) : count(count)
+            {
+                ++count;
+            }
+
+            inline ~counted_in_tag()
+            {
+                --count;
+            }
+
+            int& count;
+        };
+
+        {
+            auto ptr = movemm::make_tagged_unique<counted_in_tag>(tag, count);
+            REQUIRE(count == 1);
+        }
+
+        THEN("The object is destroyed with the pointer, not the tag")
+        {
+            REQUIRE(count == 0);
+            movemm_tagged_heap_free(tag);
+            REQUIRE(count == 0);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("A unique pointer into a heap")
+    {
+        auto heap = movemm_create_heap();
+        {
+            auto ptr = movemm::make_heap_unique<std::string>(heap, 100, 'x');
+
+            THEN("It remembers its heap")
+            {
+                REQUIRE(ptr->size() == 100);
+                REQUIRE(ptr.get_deleter().heap == heap);
+            }
+        }
+        movemm_destroy_heap(heap);
+    }
+}
+
+SCENARIO("Testing weak and aliased shared pointers")
+{
+    GIVEN("A shared pointer and a weak pointer to it")
+    {
+        auto ptr = movemm::make_shared<int>(5);
+        movemm::weak_ptr<int> weak = ptr;
+
+        THEN("The weak pointer locks while the object is alive")
+        {
+            auto locked = weak.lock();
+            REQUIRE(locked);
+            REQUIRE(*locked == 5);
+            REQUIRE(ptr.refcount() == 2);
+            REQUIRE(!weak.expired());
+        }
+
+        AND_WHEN("The last shared pointer is destroyed")
+        {
+            ptr.destroy();
+            THEN("The weak pointer has expired and no longer locks")
+            {
+                REQUIRE(weak.expired());
+                REQUIRE(!weak.lock());
+            }
+        }
+    }
+
+    GIVEN("An object that can share itself")
+    {
+        auto ptr = movemm::make_shared<node>();
+
+        THEN("shared_from_this shares ownership with the original")
+        {
+            auto self = ptr->shared_from_this();
+            REQUIRE(self == ptr);
+            REQUIRE(ptr.refcount() == 2);
+            REQUIRE(!ptr->weak_from_this().expired());
+        }
+    }
+
+    GIVEN("A shared pointer to a member of a shared object")
+    {
+        auto owner = movemm::make_shared<pair_of_ints>();
+        movemm::shared_ptr<int> second(owner, &owner->second);
+
+        THEN("It keeps the whole object alive")
+        {
+            owner.destroy();
+            REQUIRE(*second == 2);
+            REQUIRE(second.refcount() == 1);
+        }
+    }
+
+    GIVEN("Copies of a shared pointer released on several threads")
+    {
+        int count = 0;
+        {
+            auto ptr = movemm::make_shared<counted>(count);
+            movemm::weak_ptr<counted> weak = ptr;
+            std::atomic_int failedLocks = {0};
+            std::vector<std::thread> threads;
+            for (int i = 0; i < 4; ++i)
+            {
+                threads.emplace_back(
+                    [copy = ptr, weak, &failedLocks]() mutable
+                    {
+                        for (int j = 0; j < 1000; ++j)
+                        {
+                            failedLocks += !weak.lock();
+                        }
+                        copy.destroy();
+                    });
+            }
+            ptr.destroy();
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+
+            THEN("The object is destroyed exactly once")
+            {
+                REQUIRE(failedLocks == 0);
+                REQUIRE(count == 0);
+                REQUIRE(weak.expired());
+            }
+        }
+    }
+}
+
+SCENARIO("Testing local shared pointers")
+{
+    GIVEN("A local shared pointer created the same way as a shared one")
+    {
+        int count = 0;
+        movemm::local_shared_ptr<counted> ptr;
+        ptr.create(count);
+        movemm::local_weak_ptr<counted> weak = ptr;
+
+        THEN("It counts references without atomics")
+        {
+            static_assert(sizeof(ptr) == sizeof(movemm::shared_ptr<counted>));
+            auto copy = ptr;
+            REQUIRE(ptr.refcount() == 2);
+            REQUIRE(weak.lock() == ptr);
+            copy.destroy();
+            REQUIRE(ptr.refcount() == 1);
+        }
+
+        AND_WHEN("The last reference is destroyed")
+        {
+            ptr.destroy();
+            THEN("The object is destroyed and the weak pointer expires")
+            {
+                REQUIRE(count == 0);
+                REQUIRE(weak.expired());
+            }
+        }
+    }
+
+    GIVEN("A local shared pointer from make_local_shared")
+    {
+        auto ptr = movemm::make_local_shared<pair_of_ints>();
+        movemm::local_shared_ptr<int> first(ptr, &ptr->first);
+
+        THEN("It supports aliasing like the atomic version")
+        {
+            REQUIRE(*first == 1);
+            REQUIRE(ptr.refcount() == 2);
+        }
+    }
+}
+
+SCENARIO("Testing intrusive pointers")
+{
+    GIVEN("An intrusive pointer created with make_intrusive")
+    {
+        int count = 0;
+        auto ptr = movemm::make_intrusive<counted>(count);
+
+        THEN("The object holds its own count")
+        {
+            REQUIRE(count == 1);
+            REQUIRE(ptr->refcount() == 1);
+        }
+
+        AND_WHEN("A raw pointer to it is turned back into an owner")
+        {
+            movemm::intrusive_ptr<counted> other(ptr.get());
+            REQUIRE(ptr->refcount() == 2);
+
+            THEN("The object lives until both let go")
+            {
+                ptr.destroy();
+                REQUIRE(count == 1);
+                other.destroy();
+                REQUIRE(count == 0);
+            }
+        }
+    }
+}
@@ -3,6 +3,93 @@
 
 #include <movemm/stl_allocator.hpp>
 
+#include <map>
+#include <vector>
+
 SCENARIO("Testing STL allocator")
 {
-}
\ No newline at end of file
+}
+
+SCENARIO("Testing heap STL allocators")
+{
+    GIVEN("Containers that allocate from a heap")
+    {
+        auto heap = movemm_create_heap();
+        {
+            movemm::heap_stl_allocator<int> allocator(heap);
+            std::vector<int, movemm::heap_stl_allocator<int>> vec(allocator);
+            std::map<int, int, std::less<int>,
+                movemm::heap_stl_allocator<std::pair<const int, int>>>
+                map(allocator);
+
+            for (int i = 0; i < 1000; ++i)
+            {
+                vec.push_back(i);
+                map[i] = i;
+            }
+
+            THEN("Their memory lives in the heap")
+            {
+                size_t blocks = 0;
+                movemm_heap_visit_blocks(
+                    heap,
+                    [](void*, size_t, void* userData)
+                    {
+                        ++*static_cast<size_t*>(userData);
+                        return 1;
+                    },
+                    &blocks);
+                REQUIRE(blocks == 1001);
+                REQUIRE(vec.get_allocator() == allocator);
+                REQUIRE(map.get_allocator() == allocator);
+                REQUIRE(movemm::heap_stl_allocator<int>(0) != allocator);
+            }
+        }
+        movemm_destroy_heap(heap);
+    }
+}
+
+SCENARIO("Testing tagged STL allocators")
+{
+    using traits =
+        std::allocator_traits<movemm::tagged_stl_allocator<int>>;
+    static_assert(traits::propagate_on_container_move_assignment::value);
+    static_assert(!traits::is_always_equal::value);
+    static_assert(std::allocator_traits<movemm::stl_allocator<int>>::
+            is_always_equal::value);
+
+    GIVEN("A vector that allocates from a tag")
+    {
+        movemm_heap_tag_t tag = {300};
+        movemm::tagged_stl_allocator<int> allocator(tag);
+        {
+            std::vector<int, movemm::tagged_stl_allocator<int>> vec(allocator);
+            for (int i = 0; i < 10000; ++i)
+            {
+                vec.push_back(i);
+            }
+
+            THEN("Its memory is held by the tag")
+            {
+                REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) > 0);
+                REQUIRE(vec[9999] == 9999);
+            }
+
+            AND_WHEN("It is move assigned to a vector using another tag")
+            {
+                movemm::tagged_stl_allocator<int> other({301});
+                std::vector<int, movemm::tagged_stl_allocator<int>> moved(
+                    other);
+                auto data = vec.data();
+                moved = std::move(vec);
+
+                THEN("The tag moves with the memory")
+                {
+                    REQUIRE(moved.data() == data);
+                    REQUIRE(moved.get_allocator() == allocator);
+                }
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+}
@@ -2,6 +2,12 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <movemm/memory-allocator.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 SCENARIO("Testing tagged heap")
 {
@@ -34,4 +40,979 @@ SCENARIO("Testing tagged heap")
                     tagSizePreAlloc);
         }
     }
-}
\ No newline at end of file
+}
+SCENARIO("Testing the tagged heap page pool")
+{
+    GIVEN("A tag that has been allocated from and freed")
+    {
+        movemm_heap_tag_t tag = {101};
+        size_t originalLimit = movemm_tagged_heap_get_page_pool_limit();
+        movemm_tagged_heap_set_page_pool_limit(64 * 1024 * 1024);
+
+        REQUIRE(movemm_tagged_heap_alloc(tag, 512) != 0);
+        size_t pooledPreFree = movemm_tagged_heap_get_pooled_storage();
+        REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+
+        THEN("The page is returned to the pool rather than released")
+        {
+            REQUIRE(movemm_tagged_heap_get_pooled_storage() > pooledPreFree);
+        }
+
+        AND_WHEN("The tag is allocated from again")
+        {
+            size_t pooledPreAlloc = movemm_tagged_heap_get_pooled_storage();
+            REQUIRE(movemm_tagged_heap_alloc(tag, 512) != 0);
+
+            THEN("The page is taken from the pool")
+            {
+                REQUIRE(movemm_tagged_heap_get_pooled_storage() <
+                        pooledPreAlloc);
+            }
+
+            REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+        }
+
+        AND_WHEN("The pool limit is lowered to zero")
+        {
+            movemm_tagged_heap_set_page_pool_limit(0);
+
+            THEN("All idle pages are released and none are kept afterwards")
+            {
+                REQUIRE(movemm_tagged_heap_get_pooled_storage() == 0);
+
+                REQUIRE(movemm_tagged_heap_alloc(tag, 512) != 0);
+                REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+                REQUIRE(movemm_tagged_heap_get_pooled_storage() == 0);
+            }
+        }
+
+        movemm_tagged_heap_set_page_pool_limit(originalLimit);
+    }
+}
+
+SCENARIO("Testing tagged heap allocation across threads")
+{
+    GIVEN("A tag that several live threads have allocated from")
+    {
+        movemm_heap_tag_t tag = {104};
+        movemm_heap_tag_t otherTag = {105};
+        size_t tagSizePreAlloc =
+            movemm_tagged_heap_get_current_tag_storage(tag);
+
+        // Thread local storage is released when a thread exits, so the
+        // workers stay alive until the tag has been freed.
+        std::atomic_int allocated = {0};
+        std::atomic_bool done = {false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    for (int i = 0; i < 1000; ++i)
+                    {
+                        movemm_tagged_heap_alloc(i & 1 ? tag : otherTag, 64);
+                    }
+                    ++allocated;
+                    while (!done)
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    // The freed tag must be usable again on this thread
+                    movemm_tagged_heap_alloc(tag, 64);
+                });
+        }
+        while (allocated != 4)
+        {
+            std::this_thread::yield();
+        }
+
+        THEN("Freeing the tag from another thread releases its storage")
+        {
+            REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) >
+                    tagSizePreAlloc);
+            REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+            REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) ==
+                    tagSizePreAlloc);
+            REQUIRE(movemm_tagged_heap_get_current_tag_storage(otherTag) > 0);
+        }
+
+        done = true;
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        movemm_tagged_heap_free(tag);
+        movemm_tagged_heap_free(otherTag);
+    }
+}
+
+static bool is_aligned(void* ptr, size_t alignment)
+{
+    return (reinterpret_cast<uintptr_t>(ptr) & (alignment - 1)) == 0;
+}
+
+SCENARIO("Testing tagged heap bump allocation")
+{
+    constexpr size_t pageSize = MOVEMM_TAGGED_HEAP_PAGE_SIZE;
+
+    GIVEN("A fresh tag")
+    {
+        movemm_heap_tag_t tag = {106};
+        size_t tagSizePreAlloc =
+            movemm_tagged_heap_get_current_tag_storage(tag);
+
+        WHEN("Several small allocations are made")
+        {
+            char* first = (char*)movemm_tagged_heap_alloc(tag, 3);
+            char* second = (char*)movemm_tagged_heap_alloc(tag, 3);
+            char* third = (char*)movemm_tagged_heap_alloc(tag, 40);
+
+            THEN("Each allocation is distinct, ordered and default aligned")
+            {
+                REQUIRE(first != 0);
+                REQUIRE(second >= first + 3);
+                REQUIRE(third >= second + 3);
+                constexpr size_t alignment =
+                    MOVEMM_TAGGED_HEAP_DEFAULT_ALIGNMENT;
+                REQUIRE(is_aligned(first, alignment));
+                REQUIRE(is_aligned(second, alignment));
+                REQUIRE(is_aligned(third, alignment));
+            }
+        }
+
+        WHEN("Aligned allocations are made")
+        {
+            const size_t alignments[] = {16, 32, 64, 4096, pageSize};
+            for (auto alignment : alignments)
+            {
+                // Knock the bump pointer off alignment first
+                REQUIRE(movemm_tagged_heap_alloc(tag, 1) != 0);
+
+                auto ptr =
+                    movemm_tagged_heap_aligned_alloc(tag, 100, alignment);
+                INFO("Alignment = " << alignment);
+                REQUIRE(ptr != 0);
+                REQUIRE(is_aligned(ptr, alignment));
+                memset(ptr, 0xAB, 100);
+            }
+        }
+
+        WHEN("An invalid alignment is requested")
+        {
+            THEN("The allocation fails")
+            {
+                REQUIRE(movemm_tagged_heap_aligned_alloc(tag, 16, 24) == 0);
+                REQUIRE(movemm_tagged_heap_aligned_alloc(tag, 16, 0) == 0);
+            }
+        }
+
+        WHEN("A page is filled with allocations")
+        {
+            constexpr size_t allocSize = 4096;
+            constexpr size_t count = 2 * pageSize / allocSize;
+
+            std::vector<char*> ptrs;
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto ptr = (char*)movemm_tagged_heap_alloc(tag, allocSize);
+                REQUIRE(ptr != 0);
+                memset(ptr, int(i), allocSize);
+                ptrs.push_back(ptr);
+            }
+
+            THEN("No allocations overlap and the tag spans several pages")
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    REQUIRE(ptrs[i][0] == char(i));
+                    REQUIRE(ptrs[i][allocSize - 1] == char(i));
+                }
+                REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) -
+                            tagSizePreAlloc >=
+                        3 * pageSize);
+            }
+        }
+
+        WHEN("Allocations around the page size boundary are made")
+        {
+            const size_t alignments[] = {16, 64, 4096};
+            for (size_t size = pageSize - 8192; size <= pageSize + 8192;
+                 size += 1024 + 8)
+            {
+                for (auto alignment : alignments)
+                {
+                    movemm_heap_tag_t boundaryTag = {107};
+                    auto ptr = movemm_tagged_heap_aligned_alloc(
+                        boundaryTag, size, alignment);
+
+                    INFO("Size = " << size << ", alignment = " << alignment);
+                    REQUIRE(ptr != 0);
+                    REQUIRE(is_aligned(ptr, alignment));
+                    memset(ptr, 0xCD, size);
+
+                    auto storage =
+                        movemm_tagged_heap_get_current_tag_storage(boundaryTag);
+                    REQUIRE(storage % pageSize == 0);
+                    REQUIRE(storage <= 2 * pageSize);
+                    REQUIRE(storage >= size);
+
+                    movemm_tagged_heap_free(boundaryTag);
+                }
+            }
+        }
+
+        WHEN("An oversized allocation is made between small ones")
+        {
+            auto before = (char*)movemm_tagged_heap_alloc(tag, 64);
+            auto large = (char*)movemm_tagged_heap_alloc(tag, 3 * pageSize + 1);
+            auto after = (char*)movemm_tagged_heap_alloc(tag, 64);
+
+            THEN(
+                "It gets a dedicated page rounded up to the page size, and "
+                "later allocations continue in its tail")
+            {
+                REQUIRE(before != 0);
+                REQUIRE(large != 0);
+                REQUIRE(after == large + 3 * pageSize + 16);
+                memset(large, 0xEF, 3 * pageSize + 1);
+                REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) -
+                            tagSizePreAlloc ==
+                        pageSize + 4 * pageSize);
+            }
+        }
+
+        WHEN("Allocations too large for any page are made")
+        {
+            movemm_heap_tag_t hugeTag = {102};
+            auto ptr = movemm_tagged_heap_alloc(hugeTag, SIZE_MAX);
+            auto aligned =
+                movemm_tagged_heap_aligned_alloc(hugeTag, SIZE_MAX / 2, 64);
+            void* batch[2];
+            auto batched =
+                movemm_tagged_heap_alloc_batch(hugeTag, SIZE_MAX, 2, batch);
+            auto storage = movemm_tagged_heap_get_current_tag_storage(hugeTag);
+            movemm_tagged_heap_free(hugeTag);
+
+            THEN("They fail before any page is taken")
+            {
+                REQUIRE(ptr == nullptr);
+                REQUIRE(aligned == nullptr);
+                REQUIRE(batched == 0);
+                REQUIRE(storage == 0);
+            }
+        }
+
+        REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) ==
+                tagSizePreAlloc);
+    }
+}
+
+SCENARIO("Testing huge page backed tagged heap pages")
+{
+    GIVEN("Huge page backing is enabled with an empty page pool")
+    {
+        movemm_heap_tag_t tag = {108};
+        size_t originalLimit = movemm_tagged_heap_get_page_pool_limit();
+        movemm_tagged_heap_release_pooled_pages();
+        movemm_tagged_heap_set_huge_pages_enabled(1);
+        REQUIRE(movemm_tagged_heap_get_huge_pages_enabled());
+
+        movemm_tagged_heap_backing_stats_t before;
+        movemm_tagged_heap_get_backing_stats(&before);
+
+        WHEN("A page sized allocation is made")
+        {
+            constexpr size_t size = MOVEMM_TAGGED_HEAP_PAGE_SIZE / 2;
+            auto ptr = movemm_tagged_heap_aligned_alloc(
+                tag, size, MOVEMM_TAGGED_HEAP_PAGE_SIZE);
+
+            THEN(
+                "It is usable and the page is reported under exactly one "
+                "backing")
+            {
+                REQUIRE(ptr != 0);
+                REQUIRE(is_aligned(ptr, MOVEMM_TAGGED_HEAP_PAGE_SIZE));
+                memset(ptr, 0x5A, size);
+
+                movemm_tagged_heap_backing_stats_t after;
+                movemm_tagged_heap_get_backing_stats(&after);
+
+                size_t hugeBacked =
+                    (after.huge_pages - before.huge_pages) +
+                    (after.transparent_huge_pages -
+                        before.transparent_huge_pages);
+                size_t heapBacked = after.heap_pages - before.heap_pages;
+                size_t fallbacks =
+                    after.huge_page_fallbacks - before.huge_page_fallbacks;
+
+                INFO("Huge backed = " << hugeBacked
+                                      << ", heap backed = " << heapBacked);
+                REQUIRE(hugeBacked + heapBacked >= 1);
+                REQUIRE(heapBacked == fallbacks);
+            }
+
+            REQUIRE_NOTHROW(movemm_tagged_heap_free(tag));
+        }
+
+        movemm_tagged_heap_set_huge_pages_enabled(0);
+        movemm_tagged_heap_release_pooled_pages();
+        movemm_tagged_heap_set_page_pool_limit(originalLimit);
+
+        THEN("Releasing the pool releases every page it held")
+        {
+            movemm_tagged_heap_backing_stats_t after;
+            movemm_tagged_heap_get_backing_stats(&after);
+            REQUIRE(after.huge_pages <= before.huge_pages);
+            REQUIRE(
+                after.transparent_huge_pages <= before.transparent_huge_pages);
+        }
+    }
+}
+
+SCENARIO("Testing frame ring tags")
+{
+    // The ring is global state, so this runs as a single straight-line
+    // sequence rather than in independent sections.
+    GIVEN("The default ring of 4 slots starting at frame 0")
+    {
+        auto frame0 = movemm_tagged_heap_ring_tag(0);
+        auto frame1 = movemm_tagged_heap_ring_tag(1);
+
+        REQUIRE(movemm_tagged_heap_alloc(frame0, 1024) != 0);
+        REQUIRE(movemm_tagged_heap_alloc(frame1, 1024) != 0);
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame0) > 0);
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame1) > 0);
+
+        int destroyed = 0;
+        struct counted
+        {
+            counted(int& count) : count(count)
+            {
+            }
+
+            ~counted()
+            {
+                ++count;
+            }
+
+            int& count;
+        };
+        movemm::tagged_new<counted>(frame0, destroyed);
+
+        // The ring can't be changed once frames are in flight
+        REQUIRE_THROWS(movemm_tagged_heap_configure_ring(8, 0));
+
+        // Frames must be freed oldest first
+        REQUIRE_THROWS(movemm_tagged_heap_free(frame1));
+        REQUIRE_NOTHROW(movemm_tagged_heap_free(frame0));
+        REQUIRE(destroyed == 1);
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame0) == 0);
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame1) > 0);
+
+        // A freed frame can't be allocated from again
+        REQUIRE_THROWS(movemm_tagged_heap_alloc(frame0, 16));
+
+        // Frame 4 reuses frame 0's slot and the pages this thread kept for
+        // it, which are charged to the category allocating from them now
+        auto category = movemm_budget_register("test-ring");
+        movemm_budget_statistics_t budget;
+        size_t storagePreReuse = movemm_tagged_heap_get_current_storage();
+        auto frame4 = movemm_tagged_heap_ring_tag(4);
+        {
+            movemm::budget_scope scope(category);
+            REQUIRE(movemm_tagged_heap_alloc(frame4, 1024) != 0);
+        }
+        REQUIRE(movemm_tagged_heap_get_current_storage() == storagePreReuse);
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame4) > 0);
+        movemm_budget_get_statistics(category, &budget);
+        REQUIRE(budget.usage > 0);
+
+        // Frame 5 would need frame 1's slot, which is still in flight
+        REQUIRE_THROWS(
+            movemm_tagged_heap_alloc(movemm_tagged_heap_ring_tag(5), 16));
+
+        for (uint64_t frame = 1; frame <= 7; ++frame)
+        {
+            REQUIRE_NOTHROW(
+                movemm_tagged_heap_free(movemm_tagged_heap_ring_tag(frame)));
+        }
+        REQUIRE(movemm_tagged_heap_get_current_tag_storage(frame4) == 0);
+
+        // The category keeps its pages until the slot is reused outside of it
+        auto frame8 = movemm_tagged_heap_ring_tag(8);
+        REQUIRE(movemm_tagged_heap_alloc(frame8, 1024) != 0);
+        movemm_budget_get_statistics(category, &budget);
+        REQUIRE(budget.usage == 0);
+        REQUIRE_NOTHROW(movemm_tagged_heap_free(frame8));
+    }
+}
+
+SCENARIO("Testing tagged heap destructors")
+{
+    struct ordered
+    {
+        ordered(std::vector<int>& order, int id) : order(order), id(id)
+        {
+        }
+
+        ~ordered()
+        {
+            order.push_back(id);
+        }
+
+        std::vector<int>& order;
+        int id;
+    };
+
+    GIVEN("Several objects created with tagged_new on one thread")
+    {
+        movemm_heap_tag_t tag = {109};
+        std::vector<int> order;
+        for (int i = 0; i < 100; ++i)
+        {
+            movemm::tagged_new<ordered>(tag, order, i);
+        }
+
+        WHEN("The tag is freed")
+        {
+            movemm_tagged_heap_free(tag);
+
+            THEN("Every destructor runs once, in reverse order")
+            {
+                REQUIRE(order.size() == 100);
+                for (int i = 0; i < 100; ++i)
+                {
+                    REQUIRE(order[i] == 99 - i);
+                }
+            }
+        }
+    }
+
+    GIVEN("Objects registered on several live threads")
+    {
+        movemm_heap_tag_t tag = {110};
+        constexpr int threadCount = 4;
+        constexpr int perThread = 1000;
+
+        std::vector<int> orders[threadCount];
+        std::atomic_int registered = {0};
+        std::atomic_bool done = {false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back(
+                [&, t]
+                {
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        movemm::tagged_new<ordered>(tag, orders[t], i);
+                    }
+                    ++registered;
+                    while (!done)
+                    {
+                        std::this_thread::yield();
+                    }
+                });
+        }
+        while (registered != threadCount)
+        {
+            std::this_thread::yield();
+        }
+
+        WHEN("The tag is freed through a parallel dispatcher")
+        {
+            struct dispatcher
+            {
+                static void dispatch(void* userData, movemm_job_cb_t job,
+                    void* jobData, size_t count)
+                {
+                    *static_cast<size_t*>(userData) = count;
+
+                    std::vector<std::thread> workers;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        workers.emplace_back(job, jobData, i);
+                    }
+                    for (auto& worker : workers)
+                    {
+                        worker.join();
+                    }
+                }
+            };
+
+            size_t jobCount = 0;
+            movemm_tagged_heap_free_parallel(
+                tag, &dispatcher::dispatch, &jobCount);
+
+            THEN(
+                "There is one job per thread and each thread's destructors "
+                "ran in reverse order")
+            {
+                REQUIRE(jobCount == threadCount);
+                for (auto& order : orders)
+                {
+                    REQUIRE(order.size() == perThread);
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        REQUIRE(order[i] == perThread - 1 - i);
+                    }
+                }
+            }
+        }
+
+        done = true;
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("An array created with tagged_new_array")
+    {
+        movemm_heap_tag_t tag = {112};
+        std::vector<int> order;
+        auto arr = movemm::tagged_new_array<ordered>(tag, 50, order, 7);
+        for (int i = 0; i < 50; ++i)
+        {
+            arr[i].id = i;
+        }
+
+        WHEN("The tag is freed")
+        {
+            movemm_tagged_heap_free(tag);
+
+            THEN("Every element is destroyed once, in reverse order")
+            {
+                REQUIRE(order.size() == 50);
+                for (int i = 0; i < 50; ++i)
+                {
+                    REQUIRE(order[i] == 49 - i);
+                }
+            }
+        }
+    }
+
+    GIVEN("Arrays of trivially destructible and over-aligned types")
+    {
+        struct alignas(64) wide
+        {
+            std::vector<int>* order;
+
+            ~wide()
+            {
+                order->push_back(0);
+            }
+        };
+
+        movemm_heap_tag_t tag = {113};
+        std::vector<int> order;
+        auto ints = movemm::tagged_new_array<int>(tag, 100, 3);
+        auto empty = movemm::tagged_new_array<int>(tag, 0);
+        auto wides = movemm::tagged_new_array<wide>(tag, 4, wide{&order});
+
+        THEN("Elements are constructed from the arguments and aligned")
+        {
+            REQUIRE(empty != nullptr);
+            for (int i = 0; i < 100; ++i)
+            {
+                REQUIRE(ints[i] == 3);
+            }
+            REQUIRE(is_aligned(ints, alignof(int)));
+            REQUIRE(is_aligned(wides, 64));
+            REQUIRE(wides[3].order == &order);
+
+            // The temporary passed to tagged_new_array is destroyed too.
+            REQUIRE(order.size() == 1);
+            movemm_tagged_heap_free(tag);
+            REQUIRE(order.size() == 5);
+        }
+
+        THEN("Counts too large for a size_t of bytes return null")
+        {
+            // Both byte counts wrap around to a few bytes unchecked
+            REQUIRE(movemm::tagged_new_array<int>(tag, SIZE_MAX / 4 + 2) ==
+                    nullptr);
+            REQUIRE(movemm::tagged_new_array<wide>(tag, SIZE_MAX / 64) ==
+                    nullptr);
+            movemm_tagged_heap_free(tag);
+            REQUIRE(order.size() == 5);
+        }
+    }
+
+    GIVEN("An object registered on a thread that exits before the free")
+    {
+        movemm_heap_tag_t tag = {111};
+        std::vector<int> order;
+        std::thread(
+            [&]
+            {
+                movemm::tagged_new<ordered>(tag, order, 1);
+            })
+            .join();
+
+        THEN("Its destructor runs when the thread's storage is released")
+        {
+            REQUIRE(order.size() == 1);
+            movemm_tagged_heap_free(tag);
+            REQUIRE(order.size() == 1);
+        }
+    }
+}
+
+SCENARIO("Testing tagged heap realloc")
+{
+    constexpr size_t pageSize = MOVEMM_TAGGED_HEAP_PAGE_SIZE;
+
+    GIVEN("The most recent allocation in a tag")
+    {
+        movemm_heap_tag_t tag = {130};
+        auto ptr = static_cast<char*>(movemm::tagged_alloc(tag, 64));
+        memset(ptr, 7, 64);
+
+        THEN("It grows and shrinks in place")
+        {
+            REQUIRE(movemm::tagged_realloc(tag, ptr, 64, 4096) == ptr);
+            REQUIRE(movemm::tagged_realloc(tag, ptr, 4096, 32) == ptr);
+            REQUIRE(movemm::tagged_alloc(tag, 16) == ptr + 32);
+        }
+
+        THEN("Growing past the end of the page moves it")
+        {
+            auto moved = static_cast<char*>(
+                movemm::tagged_realloc(tag, ptr, 64, pageSize));
+            REQUIRE(moved != ptr);
+            for (int i = 0; i < 64; ++i)
+            {
+                REQUIRE(moved[i] == 7);
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("An allocation followed by another one")
+    {
+        movemm_heap_tag_t tag = {131};
+        auto ptr = static_cast<char*>(movemm::tagged_alloc(tag, 64));
+        memset(ptr, 7, 64);
+        auto next = movemm::tagged_alloc(tag, 64);
+
+        THEN("Growing copies it into a new allocation")
+        {
+            auto moved = static_cast<char*>(
+                movemm::tagged_realloc(tag, ptr, 64, 128));
+            REQUIRE(moved == static_cast<char*>(next) + 64);
+            for (int i = 0; i < 64; ++i)
+            {
+                REQUIRE(moved[i] == 7);
+            }
+        }
+
+        THEN("Shrinking leaves it where it is")
+        {
+            REQUIRE(movemm::tagged_realloc(tag, ptr, 64, 16) == ptr);
+            REQUIRE(movemm::tagged_alloc(tag, 16) ==
+                    static_cast<char*>(next) + 64);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("Aligned and null reallocations")
+    {
+        movemm_heap_tag_t tag = {132};
+        auto ptr = movemm::tagged_aligned_realloc(tag, 0, 0, 100, 256);
+        REQUIRE(is_aligned(ptr, 256));
+
+        movemm::tagged_alloc(tag, 16);
+        auto moved = movemm::tagged_aligned_realloc(tag, ptr, 100, 200, 256);
+        REQUIRE(moved != ptr);
+        REQUIRE(is_aligned(moved, 256));
+        REQUIRE(!movemm::tagged_aligned_realloc(tag, moved, 200, 300, 3));
+        movemm_tagged_heap_free(tag);
+    }
+}
+
+SCENARIO("Testing tagged heap markers")
+{
+    constexpr size_t pageSize = MOVEMM_TAGGED_HEAP_PAGE_SIZE;
+
+    GIVEN("Allocations made after a marker")
+    {
+        movemm_heap_tag_t tag = {120};
+        movemm::tagged_alloc(tag, 64);
+        auto marker = movemm_tagged_heap_get_marker(tag);
+        auto first = movemm::tagged_alloc(tag, 64);
+        for (int i = 0; i < 8; ++i)
+        {
+            movemm::tagged_alloc(tag, pageSize / 2);
+        }
+        auto storage = movemm_tagged_heap_get_current_tag_storage(tag);
+        REQUIRE(storage >= 4 * pageSize);
+
+        WHEN("The tag is rewound to the marker")
+        {
+            movemm_tagged_heap_rewind(tag, marker);
+
+            THEN("The memory is reused and the pages are kept")
+            {
+                REQUIRE(movemm::tagged_alloc(tag, 64) == first);
+                REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) ==
+                        storage);
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("A scope used repeatedly")
+    {
+        movemm_heap_tag_t tag = {121};
+        for (int i = 0; i < 100; ++i)
+        {
+            movemm::tagged_scope scope(tag);
+            movemm::tagged_alloc(tag, pageSize / 2);
+            movemm::tagged_alloc(tag, pageSize / 2);
+        }
+
+        THEN("The tag never grows past the memory of a single iteration")
+        {
+            REQUIRE(movemm_tagged_heap_get_current_tag_storage(tag) <=
+                    2 * pageSize);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("Objects created before and inside nested scopes")
+    {
+        struct ordered
+        {
+            ordered(std::vector<int>& order, int id) : order(order), id(id)
+            {
+            }
+
+            ~ordered()
+            {
+                order.push_back(id);
+            }
+
+            std::vector<int>& order;
+            int id;
+        };
+
+        movemm_heap_tag_t tag = {122};
+        std::vector<int> order;
+        movemm::tagged_new<ordered>(tag, order, 0);
+
+        THEN("Leaving each scope destroys only the objects created in it")
+        {
+            {
+                movemm::tagged_scope outer(tag);
+                movemm::tagged_new<ordered>(tag, order, 1);
+                {
+                    movemm::tagged_scope inner(tag);
+                    movemm::tagged_new<ordered>(tag, order, 2);
+                    movemm::tagged_new<ordered>(tag, order, 3);
+                }
+                REQUIRE(order == std::vector<int>{3, 2});
+                movemm::tagged_new<ordered>(tag, order, 4);
+            }
+            REQUIRE(order == std::vector<int>{3, 2, 4, 1});
+        }
+
+        movemm_tagged_heap_free(tag);
+        REQUIRE(order.back() == 0);
+    }
+
+    GIVEN("Markers that no longer apply")
+    {
+        movemm_heap_tag_t tag = {123};
+        movemm::tagged_alloc(tag, 64);
+        auto outer = movemm_tagged_heap_get_marker(tag);
+        movemm::tagged_alloc(tag, 64);
+        auto inner = movemm_tagged_heap_get_marker(tag);
+        movemm::tagged_alloc(tag, 64);
+
+        THEN("Rewinding past a newer marker makes it a no-op")
+        {
+            movemm_tagged_heap_rewind(tag, outer);
+            auto next = movemm::tagged_alloc(tag, 64);
+            movemm_tagged_heap_rewind(tag, inner);
+            REQUIRE(movemm::tagged_alloc(tag, 64) ==
+                    static_cast<char*>(next) + 64);
+        }
+
+        THEN("Rewinding after the tag has been freed is a no-op")
+        {
+            movemm_tagged_heap_free(tag);
+            auto first = movemm::tagged_alloc(tag, 64);
+            movemm::tagged_alloc(tag, 64);
+            movemm_tagged_heap_rewind(tag, outer);
+            REQUIRE(movemm::tagged_alloc(tag, 64) ==
+                    static_cast<char*>(first) + 128);
+        }
+
+        THEN("Rewinding on another thread is a no-op")
+        {
+            std::thread(
+                [&]
+                {
+                    movemm::tagged_alloc(tag, 64);
+                    movemm_tagged_heap_rewind(tag, outer);
+                })
+                .join();
+            auto next = movemm::tagged_alloc(tag, 64);
+            movemm_tagged_heap_rewind(tag, inner);
+            REQUIRE(movemm::tagged_alloc(tag, 64) ==
+                    static_cast<char*>(next) - 64);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+}
+
+SCENARIO("Testing tagged heap statistics")
+{
+    constexpr size_t pageSize = MOVEMM_TAGGED_HEAP_PAGE_SIZE;
+
+    GIVEN("A tag that has moved past the tail of a page")
+    {
+        movemm_heap_tag_t tag = {140};
+        movemm_tagged_heap_statistics_t before;
+        movemm_tagged_heap_get_statistics(&before);
+
+        movemm::tagged_alloc(tag, pageSize / 2);
+        movemm::tagged_alloc(tag, pageSize / 2);
+        movemm::tagged_new<std::vector<int>>(tag);
+
+        WHEN("Its statistics are read")
+        {
+            movemm_tagged_heap_tag_statistics_t stats;
+            movemm_tagged_heap_get_tag_statistics(tag, &stats);
+
+            THEN("The tail of the first page is counted as wasted")
+            {
+                REQUIRE(stats.pages == 2);
+                REQUIRE(stats.bytes_reserved == 2 * pageSize);
+                REQUIRE(stats.bytes_used >= pageSize);
+                REQUIRE(stats.bytes_wasted > 0);
+                REQUIRE(stats.bytes_wasted < pageSize / 2);
+                REQUIRE(stats.bytes_used + stats.bytes_wasted <
+                        stats.bytes_reserved);
+            }
+
+            THEN("The global counters include the allocations")
+            {
+                movemm_tagged_heap_statistics_t after;
+                movemm_tagged_heap_get_statistics(&after);
+                REQUIRE(after.allocations - before.allocations == 3);
+                REQUIRE(after.allocated_bytes - before.allocated_bytes ==
+                        pageSize + sizeof(std::vector<int>));
+                REQUIRE(after.destructors_registered -
+                            before.destructors_registered ==
+                        1);
+                REQUIRE(after.destructors_pending >= 1);
+                REQUIRE(after.pages_live >= 2);
+                REQUIRE(after.bytes_reserved >= stats.bytes_reserved);
+            }
+        }
+
+        WHEN("The tag is freed")
+        {
+            movemm_tagged_heap_free(tag);
+
+            THEN("It has nothing left and its destructor has run")
+            {
+                movemm_tagged_heap_tag_statistics_t stats;
+                movemm_tagged_heap_get_tag_statistics(tag, &stats);
+                REQUIRE(stats.pages == 0);
+                REQUIRE(stats.bytes_reserved == 0);
+
+                movemm_tagged_heap_statistics_t after;
+                movemm_tagged_heap_get_statistics(&after);
+                REQUIRE(after.destructors_run - before.destructors_run == 1);
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("Allocations made on a thread that has exited")
+    {
+        movemm_heap_tag_t tag = {141};
+        movemm_tagged_heap_statistics_t before;
+        movemm_tagged_heap_get_statistics(&before);
+
+        std::thread(
+            [&]
+            {
+                movemm::tagged_alloc(tag, 64);
+            })
+            .join();
+
+        THEN("They are still counted")
+        {
+            movemm_tagged_heap_statistics_t after;
+            movemm_tagged_heap_get_statistics(&after);
+            REQUIRE(after.allocations - before.allocations == 1);
+            REQUIRE(after.allocated_bytes - before.allocated_bytes == 64);
+        }
+    }
+}
+
+SCENARIO("Testing tagged heap batches")
+{
+    GIVEN("A batch big enough to spill onto a second page")
+    {
+        movemm_heap_tag_t tag = {150};
+        constexpr size_t blockSize = 64 * 1024;
+        constexpr size_t count = MOVEMM_TAGGED_HEAP_PAGE_SIZE / blockSize + 8;
+
+        movemm_tagged_heap_statistics_t before;
+        movemm_tagged_heap_get_statistics(&before);
+
+        void* ptrs[count];
+        REQUIRE(movemm::tagged_alloc_batch(tag, blockSize, count, ptrs) ==
+                count);
+
+        THEN("Every block is distinct, aligned and counted once")
+        {
+            std::vector<char*> sorted;
+            for (auto ptr : ptrs)
+            {
+                REQUIRE(reinterpret_cast<uintptr_t>(ptr) %
+                            MOVEMM_TAGGED_HEAP_DEFAULT_ALIGNMENT ==
+                        0);
+                sorted.push_back(static_cast<char*>(ptr));
+            }
+            std::sort(sorted.begin(), sorted.end());
+            for (size_t i = 1; i < count; ++i)
+            {
+                REQUIRE(sorted[i] - sorted[i - 1] >= ptrdiff_t(blockSize));
+            }
+
+            movemm_tagged_heap_statistics_t after;
+            movemm_tagged_heap_get_statistics(&after);
+            REQUIRE(after.allocations - before.allocations == count);
+            REQUIRE(after.allocated_bytes - before.allocated_bytes ==
+                    count * blockSize);
+
+            movemm_tagged_heap_tag_statistics_t stats;
+            movemm_tagged_heap_get_tag_statistics(tag, &stats);
+            REQUIRE(stats.pages == 2);
+        }
+
+        THEN("Aligned batches respect the alignment")
+        {
+            void* aligned[16];
+            REQUIRE(movemm::tagged_aligned_alloc_batch(
+                        tag, 24, 256, 16, aligned) == 16);
+            for (auto ptr : aligned)
+            {
+                REQUIRE(reinterpret_cast<uintptr_t>(ptr) % 256 == 0);
+            }
+            REQUIRE(movemm::tagged_aligned_alloc_batch(
+                        tag, 24, 48, 16, aligned) == 0);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+}
@@ -0,0 +1,126 @@
+#include <catch2/catch_all.hpp>
+
+#include <movemm/tagged_vector.hpp>
+#include "catch2/catch_test_macros.hpp"
+
+#include <cstdint>
+#include <new>
+#include <string>
+
+SCENARIO("Testing tagged vectors")
+{
+    GIVEN("A vector that is the only thing allocating from its tag")
+    {
+        movemm_heap_tag_t tag = {200};
+        movemm::tagged_vector<int> vec(tag);
+        vec.push_back(0);
+        auto data = vec.data();
+        for (int i = 1; i < 10000; ++i)
+        {
+            vec.push_back(i);
+        }
+
+        THEN("It grows in place and keeps its contents")
+        {
+            REQUIRE(vec.data() == data);
+            REQUIRE(vec.size() == 10000);
+            for (int i = 0; i < 10000; ++i)
+            {
+                REQUIRE(vec[i] == i);
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("Vectors of strings growing alongside each other")
+    {
+        movemm_heap_tag_t tag = {201};
+        {
+            movemm::tagged_vector<std::string> first(tag);
+            movemm::tagged_vector<std::string> second(tag);
+            for (int i = 0; i < 100; ++i)
+            {
+                first.push_back(std::string(64, char('a' + i % 26)));
+                second.emplace_back(std::to_string(i));
+            }
+
+            THEN("Moved elements keep their values")
+            {
+                REQUIRE(first.size() == 100);
+                REQUIRE(second.size() == 100);
+                for (int i = 0; i < 100; ++i)
+                {
+                    REQUIRE(first[i] == std::string(64, char('a' + i % 26)));
+                    REQUIRE(second[i] == std::to_string(i));
+                }
+            }
+
+            THEN("Resizing constructs and destroys elements")
+            {
+                second.resize(10);
+                REQUIRE(second.back() == "9");
+                second.resize(20);
+                REQUIRE(second.size() == 20);
+                REQUIRE(second.back().empty());
+                second.pop_back();
+                second.clear();
+                REQUIRE(second.empty());
+            }
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("A reserved vector")
+    {
+        movemm_heap_tag_t tag = {202};
+        movemm::tagged_vector<double> vec(tag);
+        vec.reserve(100);
+        vec.push_back(1.0);
+        vec.shrink_to_fit();
+
+        THEN("Giving back its capacity lets the tag reuse the memory")
+        {
+            REQUIRE(vec.capacity() == 1);
+            auto next = static_cast<char*>(movemm::tagged_alloc(tag, 16));
+            REQUIRE(next ==
+                    reinterpret_cast<char*>(vec.data()) +
+                        MOVEMM_TAGGED_HEAP_DEFAULT_ALIGNMENT);
+        }
+        movemm_tagged_heap_free(tag);
+    }
+
+    GIVEN("A vector in a category with a hard limit")
+    {
+        auto category = movemm_budget_register("test-vector-limit");
+        movemm_budget_set_limits(
+            category, 0, 2 * MOVEMM_TAGGED_HEAP_PAGE_SIZE);
+        movemm_budget_set_thread_category(category);
+
+        movemm_heap_tag_t tag = {203};
+        movemm::tagged_vector<int> vec(tag);
+        for (int i = 0; i < 10; ++i)
+        {
+            vec.push_back(i);
+        }
+        auto data = vec.data();
+        auto capacity = vec.capacity();
+
+        THEN("Growing past the limit or a size_t of bytes throws")
+        {
+            REQUIRE_THROWS_AS(
+                vec.reserve(4 * MOVEMM_TAGGED_HEAP_PAGE_SIZE), std::bad_alloc);
+            REQUIRE_THROWS_AS(vec.reserve(SIZE_MAX / 2), std::bad_alloc);
+
+            REQUIRE(vec.data() == data);
+            REQUIRE(vec.capacity() == capacity);
+            REQUIRE(vec.size() == 10);
+            for (int i = 0; i < 10; ++i)
+            {
+                REQUIRE(vec[i] == i);
+            }
+        }
+        movemm_tagged_heap_free(tag);
+        movemm_budget_set_thread_category(MOVEMM_BUDGET_NONE);
+        movemm_budget_set_limits(category, 0, 0);
+    }
+}
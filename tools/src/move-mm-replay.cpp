@@ -0,0 +1,800 @@
+#include <movemm/memory-allocator.h>
+#include <movemm/memory-trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Replays a trace written by movemm_trace_start against this build of movemm
+// and reports how quickly it ran, its peak memory use and how fragmented the
+// allocator's memory was at that peak.
+//
+// The trace is first compiled into a list of operations on numbered slots,
+// so the timed replay only indexes arrays rather than looking up the traced
+// pointers.  Events from every thread are replayed in timestamp order on a
+// single thread, so a rewind releases everything allocated in the tag since
+// its marker, whichever thread made it.  Frees of allocations made before the
+// start of the trace, or lost when its ring wrapped, are dropped, as are
+// rewinds to markers it never saw.
+namespace
+{
+    enum class op_type : uint8_t
+    {
+        alloc,
+        realloc,
+        free,
+        heap_alloc,
+        heap_realloc,
+        heap_free,
+        heap_destroy,
+        tagged_alloc,
+        tagged_realloc,
+        tagged_free,
+        tagged_marker,
+        tagged_rewind,
+    };
+
+    struct replay_op
+    {
+        op_type type;
+        uint32_t slot;
+
+        // The heap index for heap operations, or the marker index for marker
+        // operations
+        uint32_t heap;
+        uint64_t size;
+        uint64_t alignment;
+        uint64_t tag;
+    };
+
+    struct replay_program
+    {
+        std::vector<replay_op> ops;
+        size_t slotCount = 0;
+        size_t heapCount = 0;
+        size_t markerCount = 0;
+        size_t events = 0;
+        size_t skipped = 0;
+        uint32_t threads = 0;
+
+        // General allocations the trace never freed
+        std::vector<uint32_t> leaked;
+    };
+
+    struct traced_event
+    {
+        uint64_t time;
+        movemm_trace_event_t event;
+    };
+
+    bool read_events(const char* path, std::vector<traced_event>& events,
+        uint32_t& threads)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        std::vector<char> data((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+
+        movemm_trace_file_header_t header;
+        if (data.size() < MOVEMM_TRACE_CHUNK_BYTES) return false;
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != MOVEMM_TRACE_MAGIC ||
+            header.version != MOVEMM_TRACE_VERSION ||
+            header.chunk_bytes != MOVEMM_TRACE_CHUNK_BYTES ||
+            data.size() < (header.chunk_count + 1) * MOVEMM_TRACE_CHUNK_BYTES)
+        {
+            return false;
+        }
+
+        std::vector<std::pair<uint64_t, const char*>> chunks;
+        for (uint64_t i = 0; i < header.chunk_count; ++i)
+        {
+            auto chunk = data.data() + (i + 1) * MOVEMM_TRACE_CHUNK_BYTES;
+            movemm_trace_chunk_header_t chunkHeader;
+            memcpy(&chunkHeader, chunk, sizeof(chunkHeader));
+            if (chunkHeader.sequence &&
+                chunkHeader.count <= MOVEMM_TRACE_EVENTS_PER_CHUNK)
+            {
+                chunks.emplace_back(chunkHeader.sequence, chunk);
+            }
+        }
+        std::sort(chunks.begin(), chunks.end());
+
+        threads = 0;
+        for (auto& [sequence, chunk] : chunks)
+        {
+            movemm_trace_chunk_header_t chunkHeader;
+            memcpy(&chunkHeader, chunk, sizeof(chunkHeader));
+            threads = std::max(threads, chunkHeader.thread + 1);
+
+            auto first = chunk + sizeof(chunkHeader);
+            for (uint32_t i = 0; i < chunkHeader.count; ++i)
+            {
+                traced_event event;
+                memcpy(&event.event, first + i * sizeof(movemm_trace_event_t),
+                    sizeof(movemm_trace_event_t));
+                event.time = MOVEMM_TRACE_EVENT_TIME(event.event.header);
+                if (MOVEMM_TRACE_EVENT_TYPE(event.event.header) !=
+                    MOVEMM_TRACE_ALLOC_BATCH)
+                {
+                    events.push_back(event);
+                    continue;
+                }
+
+                // Batches are replayed as one allocation per pointer
+                auto count = event.event.extra;
+                auto packed = first + (i + 1) * sizeof(movemm_trace_event_t);
+                i += uint32_t(MOVEMM_TRACE_BATCH_EVENTS(count));
+                if (i >= chunkHeader.count) break;
+
+                event.event.header =
+                    (uint64_t(MOVEMM_TRACE_ALLOC) << 56) | event.time;
+                event.event.extra = 0;
+                events.push_back(event);
+                for (uint64_t j = 1; j < count; ++j)
+                {
+                    memcpy(&event.event.ptr,
+                        packed + (j - 1) * sizeof(uint64_t), sizeof(uint64_t));
+                    events.push_back(event);
+                }
+            }
+        }
+
+        // Each thread's events are already in order, so a stable sort keeps
+        // them that way where timestamps tie
+        std::stable_sort(events.begin(), events.end(),
+            [](const traced_event& lhs, const traced_event& rhs)
+            {
+                return lhs.time < rhs.time;
+            });
+        return true;
+    }
+
+    enum class slot_kind : uint8_t
+    {
+        general,
+        heap,
+        tagged,
+    };
+
+    struct live_slot
+    {
+        uint32_t slot;
+        slot_kind kind;
+        uint32_t heap;
+        uint64_t tag;
+
+        // The op that allocated it, or moved it when reallocating
+        size_t order;
+    };
+
+    // A marker taken in the trace, found again by its storage and position
+    struct traced_marker
+    {
+        uint64_t storage;
+        uint64_t position;
+        uint32_t index;
+
+        // The op that takes the replay's copy of it
+        size_t order;
+    };
+
+    // Turns traced pointers, heaps and tags into slot and heap indices
+    class program_builder
+    {
+    public:
+        inline explicit program_builder(replay_program& program)
+            : _program(program)
+        {
+        }
+
+        void add(const movemm_trace_event_t& event)
+        {
+            ++_program.events;
+            auto type = MOVEMM_TRACE_EVENT_TYPE(event.header);
+            auto alignment = MOVEMM_TRACE_EVENT_ALIGNMENT(event.header);
+            switch (type)
+            {
+            case MOVEMM_TRACE_ALLOC:
+                emit(op_type::alloc, add_slot(event.ptr, {}), event.size,
+                    alignment);
+                break;
+
+            case MOVEMM_TRACE_REALLOC:
+                if (auto old = take_slot(event.extra, slot_kind::general))
+                {
+                    set_live(event.ptr, *old);
+                    emit(op_type::realloc, old->slot, event.size, alignment);
+                }
+                else
+                {
+                    emit(op_type::alloc, add_slot(event.ptr, {}), event.size,
+                        alignment);
+                }
+                break;
+
+            case MOVEMM_TRACE_FREE:
+                if (auto old = take_slot(event.ptr, slot_kind::general))
+                {
+                    emit(op_type::free, old->slot, 0, 0);
+                    _freeSlots.push_back(old->slot);
+                }
+                else
+                {
+                    ++_program.skipped;
+                }
+                break;
+
+            case MOVEMM_TRACE_HEAP_ALLOC:
+            {
+                live_slot slot = {0, slot_kind::heap, heap_index(event.extra)};
+                auto& op = emit(op_type::heap_alloc,
+                    add_slot(event.ptr, slot), event.size, alignment);
+                op.heap = slot.heap;
+                break;
+            }
+
+            case MOVEMM_TRACE_HEAP_REALLOC:
+                if (auto old = take_slot(event.extra, slot_kind::heap))
+                {
+                    set_live(event.ptr, *old);
+                    auto& op = emit(op_type::heap_realloc, old->slot,
+                        event.size, alignment);
+                    op.heap = old->heap;
+                }
+                else
+                {
+                    ++_program.skipped;
+                }
+                break;
+
+            case MOVEMM_TRACE_HEAP_FREE:
+                if (auto old = take_slot(event.ptr, slot_kind::heap))
+                {
+                    auto& op = emit(op_type::heap_free, old->slot, 0, 0);
+                    op.heap = old->heap;
+                    _freeSlots.push_back(old->slot);
+                }
+                else
+                {
+                    ++_program.skipped;
+                }
+                break;
+
+            case MOVEMM_TRACE_HEAP_DESTROY:
+            {
+                auto heap = heap_index(event.extra);
+                auto& op = emit(op_type::heap_destroy, 0, 0, 0);
+                op.heap = heap;
+                release_slots(
+                    [heap](const live_slot& slot)
+                    {
+                        return slot.kind == slot_kind::heap &&
+                               slot.heap == heap;
+                    });
+
+                // A later heap may be given the same handle
+                _heaps.erase(event.extra);
+                break;
+            }
+
+            case MOVEMM_TRACE_TAGGED_ALLOC:
+            {
+                live_slot slot = {
+                    0, slot_kind::tagged, 0, replay_tag(event.extra)};
+                auto& op = emit(op_type::tagged_alloc,
+                    add_slot(event.ptr, slot), event.size, alignment);
+                op.tag = slot.tag;
+                break;
+            }
+
+            case MOVEMM_TRACE_TAGGED_REALLOC:
+                if (auto old = take_slot(event.extra, slot_kind::tagged))
+                {
+                    // Memory it moves to is released by rewinding past the
+                    // move, even if it was first allocated before the marker
+                    auto moved = *old;
+                    if (event.ptr != event.extra)
+                    {
+                        moved.order = _program.ops.size();
+                    }
+                    set_live(event.ptr, moved);
+                    auto& op = emit(op_type::tagged_realloc, old->slot,
+                        event.size, alignment);
+                    op.tag = old->tag;
+                }
+                else
+                {
+                    ++_program.skipped;
+                }
+                break;
+
+            case MOVEMM_TRACE_TAGGED_FREE:
+            {
+                auto tag = replay_tag(event.extra);
+                auto& op = emit(op_type::tagged_free, 0, 0, 0);
+                op.tag = tag;
+                release_slots(
+                    [tag](const live_slot& slot)
+                    {
+                        return slot.kind == slot_kind::tagged &&
+                               slot.tag == tag;
+                    });
+                release_markers(tag);
+                break;
+            }
+
+            case MOVEMM_TRACE_TAGGED_MARKER:
+            {
+                auto tag = replay_tag(event.extra);
+                auto index = add_marker(tag, event.ptr, event.size);
+                auto& op = emit(op_type::tagged_marker, 0, 0, 0);
+                op.tag = tag;
+                op.heap = index;
+                break;
+            }
+
+            case MOVEMM_TRACE_TAGGED_REWIND:
+            {
+                auto tag = replay_tag(event.extra);
+                auto marker = find_marker(tag, event.ptr, event.size);
+                if (!marker)
+                {
+                    ++_program.skipped;
+                    break;
+                }
+
+                auto& op = emit(op_type::tagged_rewind, 0, 0, 0);
+                op.tag = tag;
+                op.heap = marker->index;
+                auto order = marker->order;
+                release_slots(
+                    [tag, order](const live_slot& slot)
+                    {
+                        return slot.kind == slot_kind::tagged &&
+                               slot.tag == tag && slot.order > order;
+                    });
+                rewind_markers(tag, event.ptr, event.size);
+                break;
+            }
+
+            default:
+                ++_program.skipped;
+                break;
+            }
+        }
+
+        // Lists the general allocations still live at the end of the trace
+        void finish()
+        {
+            for (auto& [ptr, slot] : _live)
+            {
+                if (slot.kind == slot_kind::general)
+                {
+                    _program.leaked.push_back(slot.slot);
+                }
+            }
+        }
+
+    private:
+        // Ring tags can only be used in frame order from the ring's first
+        // frame, which the trace doesn't record, so they are replayed as
+        // plain tags in a range of their own
+        static inline uint64_t replay_tag(uint64_t tag)
+        {
+            if (tag & MOVEMM_TAGGED_HEAP_RING_TAG_BIT)
+            {
+                return (tag & ~MOVEMM_TAGGED_HEAP_RING_TAG_BIT) | (1ull << 62);
+            }
+            return tag;
+        }
+
+        inline replay_op& emit(
+            op_type type, uint32_t slot, uint64_t size, uint64_t alignment)
+        {
+            _program.ops.push_back({type, slot, 0, size, alignment, 0});
+            return _program.ops.back();
+        }
+
+        uint32_t heap_index(uint64_t heap)
+        {
+            auto found = _heaps.find(heap);
+            if (found != _heaps.end()) return found->second;
+
+            auto index = uint32_t(_program.heapCount++);
+            _heaps.emplace(heap, index);
+            return index;
+        }
+
+        uint32_t add_slot(uint64_t ptr, live_slot slot)
+        {
+            if (!_freeSlots.empty())
+            {
+                slot.slot = _freeSlots.back();
+                _freeSlots.pop_back();
+            }
+            else
+            {
+                slot.slot = uint32_t(_program.slotCount++);
+            }
+            slot.order = _program.ops.size();
+            set_live(ptr, slot);
+            return slot.slot;
+        }
+
+        // An allocation the trace missed the free of is dropped when its
+        // pointer is reused, and its slot left to the replay's final cleanup
+        void set_live(uint64_t ptr, const live_slot& slot)
+        {
+            auto [found, added] = _live.try_emplace(ptr, slot);
+            if (added) return;
+            if (found->second.kind == slot_kind::general)
+            {
+                _program.leaked.push_back(found->second.slot);
+            }
+            found->second = slot;
+        }
+
+        const live_slot* take_slot(uint64_t ptr, slot_kind kind)
+        {
+            auto found = _live.find(ptr);
+            if (found == _live.end() || found->second.kind != kind)
+            {
+                return nullptr;
+            }
+            _taken = found->second;
+            _live.erase(found);
+            return &_taken;
+        }
+
+        // Taking a marker where one was already taken replaces it, since
+        // rewinding to either releases the same memory
+        uint32_t add_marker(uint64_t tag, uint64_t storage, uint64_t position)
+        {
+            auto& markers = _markers[tag];
+            traced_marker marker = {storage, position, 0, _program.ops.size()};
+            for (auto& existing : markers)
+            {
+                if (existing.storage == storage &&
+                    existing.position == position)
+                {
+                    marker.index = existing.index;
+                    existing = marker;
+                    return marker.index;
+                }
+            }
+
+            if (!_freeMarkers.empty())
+            {
+                marker.index = _freeMarkers.back();
+                _freeMarkers.pop_back();
+            }
+            else
+            {
+                marker.index = uint32_t(_program.markerCount++);
+            }
+            markers.push_back(marker);
+            return marker.index;
+        }
+
+        const traced_marker* find_marker(
+            uint64_t tag, uint64_t storage, uint64_t position)
+        {
+            auto found = _markers.find(tag);
+            if (found == _markers.end()) return nullptr;
+            for (auto& marker : found->second)
+            {
+                if (marker.storage == storage && marker.position == position)
+                {
+                    return &marker;
+                }
+            }
+            return nullptr;
+        }
+
+        // Markers taken after the one rewound to can no longer be used
+        void rewind_markers(uint64_t tag, uint64_t storage, uint64_t position)
+        {
+            auto& markers = _markers[tag];
+            for (auto it = markers.begin(); it != markers.end();)
+            {
+                if (it->storage == storage && it->position > position)
+                {
+                    _freeMarkers.push_back(it->index);
+                    it = markers.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        void release_markers(uint64_t tag)
+        {
+            auto found = _markers.find(tag);
+            if (found == _markers.end()) return;
+            for (auto& marker : found->second)
+            {
+                _freeMarkers.push_back(marker.index);
+            }
+            _markers.erase(found);
+        }
+
+        template <typename Predicate>
+        void release_slots(Predicate predicate)
+        {
+            for (auto it = _live.begin(); it != _live.end();)
+            {
+                if (predicate(it->second))
+                {
+                    _freeSlots.push_back(it->second.slot);
+                    it = _live.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        replay_program& _program;
+        std::unordered_map<uint64_t, live_slot> _live;
+        std::unordered_map<uint64_t, uint32_t> _heaps;
+        std::unordered_map<uint64_t, std::vector<traced_marker>> _markers;
+        std::vector<uint32_t> _freeSlots;
+        std::vector<uint32_t> _freeMarkers;
+        live_slot _taken = {};
+    };
+
+    struct replay_result
+    {
+        double seconds = 0;
+        size_t peakLiveBytes = 0;
+        size_t peakCommitted = 0;
+
+        // Live bytes as a share of committed memory when committed memory
+        // peaked
+        double utilisationAtPeak = 1;
+        size_t failures = 0;
+    };
+
+    constexpr size_t ops_per_sample = 16 * 1024;
+
+    replay_result run(const replay_program& program)
+    {
+        replay_result res;
+        // Heap destroys and tag frees use slot 0 without touching it
+        std::vector<void*> slots(std::max<size_t>(program.slotCount, 1));
+        std::vector<uint64_t> sizes(program.slotCount, 0);
+        std::vector<movemm_heap_t> heaps(program.heapCount, nullptr);
+        std::unordered_map<uint64_t, uint64_t> tagBytes;
+        std::vector<movemm_tagged_heap_marker_t> markers(program.markerCount);
+        std::vector<uint64_t> markerBytes(program.markerCount, 0);
+        size_t liveBytes = 0;
+
+        auto sample = [&]()
+        {
+            movemm_statistics_t statistics;
+            movemm_get_statistics(&statistics);
+            res.peakLiveBytes = std::max(res.peakLiveBytes, liveBytes);
+            if (statistics.committed > res.peakCommitted)
+            {
+                res.peakCommitted = statistics.committed;
+                res.utilisationAtPeak =
+                    double(liveBytes) / double(statistics.committed);
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < program.ops.size(); ++i)
+        {
+            auto& op = program.ops[i];
+            auto& slot = slots[op.slot];
+            switch (op.type)
+            {
+            case op_type::alloc:
+                slot = op.alignment
+                           ? movemm_aligned_alloc(op.size, op.alignment)
+                           : movemm_alloc(op.size);
+                sizes[op.slot] = op.size;
+                liveBytes += op.size;
+                break;
+
+            case op_type::realloc:
+                slot = op.alignment
+                           ? movemm_aligned_realloc(slot, op.size, op.alignment)
+                           : movemm_realloc(slot, op.size);
+                liveBytes += op.size - sizes[op.slot];
+                sizes[op.slot] = op.size;
+                break;
+
+            case op_type::free:
+                movemm_free(slot);
+                liveBytes -= sizes[op.slot];
+                slot = nullptr;
+                break;
+
+            case op_type::heap_alloc:
+            {
+                auto& heap = heaps[op.heap];
+                if (!heap) heap = movemm_create_heap();
+                slot = op.alignment
+                           ? movemm_heap_aligned_alloc(
+                                 heap, op.size, op.alignment)
+                           : movemm_heap_alloc(heap, op.size);
+                sizes[op.slot] = op.size;
+                liveBytes += op.size;
+                break;
+            }
+
+            case op_type::heap_realloc:
+                slot = op.alignment
+                           ? movemm_heap_aligned_realloc(
+                                 heaps[op.heap], slot, op.size, op.alignment)
+                           : movemm_heap_realloc(heaps[op.heap], slot, op.size);
+                liveBytes += op.size - sizes[op.slot];
+                sizes[op.slot] = op.size;
+                break;
+
+            case op_type::heap_free:
+                movemm_heap_free(heaps[op.heap], slot);
+                liveBytes -= sizes[op.slot];
+                slot = nullptr;
+                break;
+
+            case op_type::heap_destroy:
+                if (heaps[op.heap])
+                {
+                    movemm_destroy_heap(heaps[op.heap]);
+                    heaps[op.heap] = nullptr;
+                }
+                break;
+
+            case op_type::tagged_alloc:
+                slot = op.alignment
+                           ? movemm_tagged_heap_aligned_alloc(
+                                 {op.tag}, op.size, op.alignment)
+                           : movemm_tagged_heap_alloc({op.tag}, op.size);
+                sizes[op.slot] = op.size;
+                tagBytes[op.tag] += op.size;
+                liveBytes += op.size;
+                break;
+
+            case op_type::tagged_realloc:
+            {
+                auto old = slot;
+                slot = op.alignment
+                           ? movemm_tagged_heap_aligned_realloc({op.tag}, slot,
+                                 sizes[op.slot], op.size, op.alignment)
+                           : movemm_tagged_heap_realloc(
+                                 {op.tag}, slot, sizes[op.slot], op.size);
+
+                // Moving leaves the old block held by the tag, while
+                // growing in place only adds the difference
+                auto added = slot == old ? op.size - sizes[op.slot] : op.size;
+                if (slot)
+                {
+                    tagBytes[op.tag] += added;
+                    liveBytes += added;
+                    sizes[op.slot] = op.size;
+                }
+                break;
+            }
+
+            case op_type::tagged_free:
+                movemm_tagged_heap_free({op.tag});
+                liveBytes -= tagBytes[op.tag];
+                tagBytes.erase(op.tag);
+                break;
+
+            case op_type::tagged_marker:
+                markers[op.heap] = movemm_tagged_heap_get_marker({op.tag});
+                markerBytes[op.heap] = tagBytes[op.tag];
+                break;
+
+            case op_type::tagged_rewind:
+            {
+                movemm_tagged_heap_rewind({op.tag}, markers[op.heap]);
+                auto& bytes = tagBytes[op.tag];
+                if (bytes > markerBytes[op.heap])
+                {
+                    liveBytes -= bytes - markerBytes[op.heap];
+                    bytes = markerBytes[op.heap];
+                }
+                break;
+            }
+            }
+
+            if (!slot && op.size &&
+                (op.type == op_type::alloc || op.type == op_type::realloc ||
+                    op.type == op_type::heap_alloc ||
+                    op.type == op_type::heap_realloc ||
+                    op.type == op_type::tagged_alloc ||
+                    op.type == op_type::tagged_realloc))
+            {
+                ++res.failures;
+            }
+
+            if (i % ops_per_sample == 0) sample();
+        }
+        sample();
+        res.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start)
+                          .count();
+
+        // Whatever the trace never freed
+        for (auto leaked : program.leaked)
+        {
+            movemm_free(slots[leaked]);
+        }
+        for (auto& [tag, bytes] : tagBytes)
+        {
+            movemm_tagged_heap_free({tag});
+        }
+        for (auto heap : heaps)
+        {
+            if (heap) movemm_destroy_heap(heap);
+        }
+        return res;
+    }
+
+    inline double megabytes(size_t bytes)
+    {
+        return double(bytes) / (1024.0 * 1024.0);
+    }
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<traced_event> events;
+    replay_program program;
+    if (!read_events(argv[1], events, program.threads))
+    {
+        fprintf(stderr, "%s is not a movemm trace\n", argv[1]);
+        return 1;
+    }
+
+    {
+        program_builder builder(program);
+        for (auto& event : events)
+        {
+            builder.add(event.event);
+        }
+        builder.finish();
+    }
+    std::vector<traced_event>().swap(events);
+
+    auto result = run(program);
+
+    movemm_statistics_t statistics;
+    movemm_get_statistics(&statistics);
+
+    printf("events:          %zu from %u threads (%zu skipped)\n",
+        program.events, program.threads, program.skipped);
+    printf("replay time:     %.3f s\n", result.seconds);
+    printf("throughput:      %.0f ops/s\n",
+        result.seconds > 0 ? double(program.ops.size()) / result.seconds : 0.0);
+    printf("peak live:       %.2f MB\n", megabytes(result.peakLiveBytes));
+    printf("peak committed:  %.2f MB\n", megabytes(result.peakCommitted));
+    printf("peak RSS:        %.2f MB\n", megabytes(statistics.peak_resident));
+    printf("fragmentation:   %.1f%% of committed memory unused at peak\n",
+        100.0 * (1.0 - std::min(result.utilisationAtPeak, 1.0)));
+    if (result.failures)
+    {
+        printf("failed:          %zu allocations\n", result.failures);
+    }
+    return 0;
+}